@@ -35,6 +35,7 @@ const int FastBoard::MAXSQ;
 const int FastBoard::BIG;
 const int FastBoard::PASS;
 const int FastBoard::RESIGN;
+const int FastBoard::PLANE_WORDS;
 
 const std::array<int, 2> FastBoard::s_eyemask = {
     4 * (1 << (NBR_SHIFT * BLACK)),
@@ -86,7 +87,26 @@ void FastBoard::set_square(int vertex, FastBoard::square_t content) {
     assert(vertex >= 0 && vertex < m_maxsq);
     assert(content >= BLACK && content <= INVAL);
 
+    if (m_square[vertex] == BLACK || m_square[vertex] == WHITE) {
+        flip_stone_bit(m_square[vertex], vertex);
+    }
     m_square[vertex] = content;
+    if (content == BLACK || content == WHITE) {
+        flip_stone_bit(content, vertex);
+    }
+}
+
+const FastBoard::stone_plane_t& FastBoard::get_stone_plane(int color) const {
+    assert(color == BLACK || color == WHITE);
+
+    return m_stone_planes[color];
+}
+
+void FastBoard::flip_stone_bit(const int color, const int i) {
+    const auto x = i % m_squaresize - 1;
+    const auto y = i / m_squaresize - 1;
+    const auto idx = y * m_boardsize + x;
+    m_stone_planes[color][idx / 64] ^= std::uint64_t{1} << (idx % 64);
 }
 
 FastBoard::square_t FastBoard::get_square(int x, int y) const {
@@ -105,6 +125,8 @@ void FastBoard::reset_board(int size) {
     m_prisoners[BLACK] = 0;
     m_prisoners[WHITE] = 0;
     m_empty_cnt = 0;
+    m_stone_planes[BLACK].fill(0);
+    m_stone_planes[WHITE].fill(0);
 
     m_dirs[0] = -m_squaresize;
     m_dirs[1] = +1;
@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <array>
+#include <cstdint>
 #include <queue>
 #include <string>
 #include <utility>
@@ -69,6 +70,13 @@ public:
     using movescore_t = std::pair<int, float>;
     using scoredmoves_t = std::vector<movescore_t>;
 
+    /*
+        stones of one color as bits, bit y * boardsize + x is set if
+        there is a stone on (x, y)
+    */
+    static constexpr int PLANE_WORDS = (BOARD_SQUARES + 63) / 64;
+    using stone_plane_t = std::array<std::uint64_t, PLANE_WORDS>;
+
     int get_boardsize(void) const;
     square_t get_square(int x, int y) const;
     square_t get_square(int vertex) const ;
@@ -76,6 +84,7 @@ public:
     void set_square(int x, int y, square_t content);
     void set_square(int vertex, square_t content);
     std::pair<int, int> get_xy(int vertex) const;
+    const stone_plane_t& get_stone_plane(int color) const;
 
     bool is_suicide(int i, int color) const;
     int count_pliberties(const int i) const;
@@ -117,6 +126,7 @@ protected:
     std::array<int, 2>                     m_prisoners;   /* prisoners per color */
     std::array<unsigned short, MAXSQ>      m_empty;       /* empty squares */
     std::array<unsigned short, MAXSQ>      m_empty_idx;   /* indexes of square */
+    std::array<stone_plane_t, 2>           m_stone_planes; /* stones per color */
     int m_empty_cnt;                                      /* count of empties */
 
     int m_tomove;
@@ -131,6 +141,7 @@ protected:
     void merge_strings(const int ip, const int aip);
     void add_neighbour(const int i, const int color);
     void remove_neighbour(const int i, const int color);
+    void flip_stone_bit(const int color, const int i);
     void print_columns();
 };
 
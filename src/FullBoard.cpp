@@ -38,6 +38,7 @@ int FullBoard::remove_string(int i) {
 
         m_square[pos] = EMPTY;
         m_parent[pos] = MAXSQ;
+        flip_stone_bit(color, pos);
 
         remove_neighbour(pos, color);
 
@@ -116,6 +117,7 @@ int FullBoard::update_board(const int color, const int i) {
     m_ko_hash ^= Zobrist::zobrist[m_square[i]][i];
 
     m_square[i] = square_t(color);
+    flip_stone_bit(color, i);
     m_next[i] = i;
     m_parent[i] = i;
     m_libs[i] = count_pliberties(i);
@@ -26,9 +26,11 @@
 #include <cstdlib>
 #include <exception>
 #include <fstream>
+#include <iomanip>
 #include <limits>
 #include <memory>
 #include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -36,6 +38,7 @@
 #include "FullBoard.h"
 #include "GameState.h"
 #include "Network.h"
+#include "NNCache.h"
 #include "SGFTree.h"
 #include "SMP.h"
 #include "Training.h"
@@ -48,9 +51,13 @@ using namespace Utils;
 bool cfg_gtp_mode;
 bool cfg_allow_pondering;
 int cfg_num_threads;
+int cfg_inference_threads;
 int cfg_max_threads;
 int cfg_max_playouts;
 int cfg_max_visits;
+int cfg_batch_size;
+bool cfg_transpositions;
+size_t cfg_max_tree_memory;
 TimeManagement::enabled_t cfg_timemanage;
 int cfg_lagbuffer_cs;
 int cfg_resignpct;
@@ -65,10 +72,18 @@ std::vector<int> cfg_gpus;
 bool cfg_sgemm_exhaustive;
 bool cfg_tune_only;
 #endif
+#ifdef USE_INT8
+bool cfg_int8;
+#endif
 float cfg_puct;
 float cfg_softmax_temp;
 float cfg_fpu_reduction;
 std::string cfg_weightsfile;
+std::string cfg_pack_weights_file;
+std::string cfg_shared_weights_dir;
+int cfg_nncache_mib;
+std::string cfg_nncache_file;
+int cfg_nncache_file_mib;
 std::string cfg_logfile;
 FILE* cfg_logfile_handle;
 bool cfg_quiet;
@@ -85,14 +100,23 @@ void GTP::setup_default_parameters() {
 #else
     cfg_num_threads = cfg_max_threads;
 #endif
+    cfg_inference_threads = 1;
     cfg_max_playouts = UCTSearch::UNLIMITED_PLAYOUTS;
     cfg_max_visits = UCTSearch::UNLIMITED_PLAYOUTS;
+    cfg_batch_size = 1;
+    cfg_transpositions = false;
+    cfg_max_tree_memory = 0;
+    cfg_nncache_mib = 0;
+    cfg_nncache_file_mib = 1024;
     cfg_timemanage = TimeManagement::AUTO;
     cfg_lagbuffer_cs = 100;
 #ifdef USE_OPENCL
     cfg_gpus = { };
     cfg_sgemm_exhaustive = false;
     cfg_tune_only = false;
+#endif
+#ifdef USE_INT8
+    cfg_int8 = false;
 #endif
     cfg_puct = 0.8f;
     cfg_softmax_temp = 1.0f;
@@ -147,6 +171,14 @@ const std::string GTP::s_commands[] = {
     "kgs-time_settings",
     "kgs-game_over",
     "heatmap",
+    "tree_memory",
+    "nncache_stats",
+    "save_tree",
+    "load_tree",
+    "multi_analyze",
+    "analyze_start",
+    "analyze_status",
+    "analyze_stop",
     ""
 };
 
@@ -183,11 +215,17 @@ std::string GTP::get_life_list(const GameState & game, bool live) {
 bool GTP::execute(GameState & game, std::string xinput) {
     std::string input;
     static auto search = std::make_unique<UCTSearch>(game);
+    // Searches of other positions, running beside the game.
+    static UCTSearchService service;
 
     bool transform_lowercase = true;
 
     // Required on Unixy systems
-    if (xinput.find("loadsgf") != std::string::npos) {
+    if (xinput.find("loadsgf") != std::string::npos
+        || xinput.find("save_tree") != std::string::npos
+        || xinput.find("load_tree") != std::string::npos
+        || xinput.find("multi_analyze") != std::string::npos
+        || xinput.find("analyze_start") != std::string::npos) {
         transform_lowercase = false;
     }
 
@@ -689,19 +727,207 @@ bool GTP::execute(GameState & game, std::string xinput) {
     } else if (command.find("netbench") == 0) {
         std::istringstream cmdstream(command);
         std::string tmp;
-        int iterations;
+        auto iterations = 1600;
+        auto profile = false;
 
         cmdstream >> tmp;  // eat netbench
-        cmdstream >> iterations;
+        while (cmdstream >> tmp) {
+            if (tmp == "profile") {
+                profile = true;
+            } else {
+                try {
+                    iterations = std::stoi(tmp);
+                } catch (const std::exception&) {
+                    gtp_fail_printf(id, "syntax not understood");
+                    return true;
+                }
+            }
+        }
+
+        Network::benchmark(&game, iterations, profile);
+        gtp_printf(id, "");
+        return true;
+
+    } else if (command.find("tree_memory") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp;
+        int mib;
+
+        cmdstream >> tmp;  // eat tree_memory
+        cmdstream >> mib;
 
         if (!cmdstream.fail()) {
-            Network::benchmark(&game, iterations);
+            if (mib < 0) {
+                gtp_fail_printf(id, "syntax not understood");
+                return true;
+            }
+            cfg_max_tree_memory = size_t(mib) * 1024 * 1024;
+            search->set_memory_limit(cfg_max_tree_memory);
+        }
+
+        const auto used_mib =
+            static_cast<int>(search->get_tree_bytes() / (1024 * 1024));
+        if (cfg_max_tree_memory > 0) {
+            gtp_printf(id, "%d MiB used of %d MiB", used_mib,
+                static_cast<int>(cfg_max_tree_memory / (1024 * 1024)));
         } else {
-            Network::benchmark(&game);
+            gtp_printf(id, "%d MiB used, no budget", used_mib);
         }
+        return true;
+
+    } else if (command.find("nncache_stats") == 0) {
+        NNCache::get_NNCache().dump_stats();
         gtp_printf(id, "");
         return true;
 
+    } else if (command.find("save_tree") == 0
+               || command.find("load_tree") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+
+        cmdstream >> tmp;   // eat save_tree or load_tree
+        cmdstream >> filename;
+
+        if (cmdstream.fail()) {
+            gtp_fail_printf(id, "Missing filename.");
+            return true;
+        }
+
+        if (tmp == "save_tree") {
+            if (search->save_tree(filename)) {
+                gtp_printf(id, "");
+            } else {
+                gtp_fail_printf(id, "cannot save file");
+            }
+        } else {
+            if (search->load_tree(filename)) {
+                gtp_printf(id, "");
+            } else {
+                gtp_fail_printf(id, "cannot load file");
+            }
+        }
+        return true;
+
+    } else if (command.find("multi_analyze") == 0) {
+        // multi_analyze visits file1.sgf [file2.sgf ...]
+        // Searches the final positions of all files at the same time.
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+        int visits;
+
+        cmdstream >> tmp;   // eat multi_analyze
+        cmdstream >> visits;
+
+        if (cmdstream.fail() || visits <= 0) {
+            gtp_fail_printf(id, "syntax not understood");
+            return true;
+        }
+
+        auto filenames = std::vector<std::string>{};
+        auto states = std::vector<GameState>{};
+        while (cmdstream >> filename) {
+            auto sgftree = std::make_unique<SGFTree>();
+            try {
+                sgftree->load_from_file(filename);
+                states.emplace_back(sgftree->follow_mainline_state());
+                filenames.emplace_back(filename);
+            } catch (const std::exception&) {
+                gtp_fail_printf(id, "cannot load file %s", filename.c_str());
+                return true;
+            }
+        }
+        if (filenames.empty()) {
+            gtp_fail_printf(id, "Missing filename.");
+            return true;
+        }
+
+        auto searches = std::vector<UCTSearchService::Id>{};
+        for (const auto& state : states) {
+            searches.emplace_back(
+                service.start(state, visits, cfg_max_tree_memory));
+        }
+
+        // One line per file: the best move and its winrate.
+        auto result = std::ostringstream{};
+        result << std::fixed << std::setprecision(2);
+        for (auto i = size_t{0}; i < searches.size(); i++) {
+            service.wait(searches[i]);
+            const auto status = service.get_status(searches[i]);
+            result << (i == 0 ? "" : "\n") << filenames[i] << " "
+                   << states[i].move_to_text(status.move) << " "
+                   << 100.0f * status.winrate;
+            service.remove(searches[i]);
+        }
+        gtp_printf(id, "%s", result.str().c_str());
+        return true;
+
+    } else if (command.find("analyze_start") == 0) {
+        // analyze_start file.sgf visits [mib]
+        // Starts searching the final position of the file in the
+        // background, with its own tree memory budget, and prints the
+        // number to refer to the search by.
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+        int visits;
+        int mib = static_cast<int>(cfg_max_tree_memory / (1024 * 1024));
+
+        cmdstream >> tmp;   // eat analyze_start
+        cmdstream >> filename >> visits;
+        if (cmdstream.fail() || visits <= 0) {
+            gtp_fail_printf(id, "syntax not understood");
+            return true;
+        }
+        cmdstream >> mib;
+        if (mib < 0) {
+            gtp_fail_printf(id, "syntax not understood");
+            return true;
+        }
+
+        auto sgftree = std::make_unique<SGFTree>();
+        try {
+            sgftree->load_from_file(filename);
+        } catch (const std::exception&) {
+            gtp_fail_printf(id, "cannot load file %s", filename.c_str());
+            return true;
+        }
+        const auto search_id =
+            service.start(sgftree->follow_mainline_state(), visits,
+                          size_t(mib) * 1024 * 1024);
+        gtp_printf(id, "%d", search_id);
+        return true;
+
+    } else if (command.find("analyze_status") == 0
+               || command.find("analyze_stop") == 0) {
+        // analyze_status id, analyze_stop id
+        // Prints whether the search is still running, its visits, best
+        // move and winrate. analyze_stop ends the search and forgets it.
+        std::istringstream cmdstream(command);
+        std::string tmp;
+        UCTSearchService::Id search_id;
+
+        cmdstream >> tmp >> search_id;
+        if (cmdstream.fail() || !service.has_search(search_id)) {
+            gtp_fail_printf(id, "unknown search");
+            return true;
+        }
+
+        const auto stop = (tmp == "analyze_stop");
+        if (stop) {
+            service.stop(search_id);
+        }
+        const auto status = service.get_status(search_id);
+        auto result = std::ostringstream{};
+        result << std::fixed << std::setprecision(2)
+               << (status.running ? "running" : "done") << " "
+               << status.visits << " "
+               << service.get_state(search_id).move_to_text(status.move)
+               << " " << 100.0f * status.winrate;
+        if (stop) {
+            service.remove(search_id);
+        }
+        gtp_printf(id, "%s", result.str().c_str());
+        return true;
+
     } else if (command.find("printsgf") == 0) {
         std::istringstream cmdstream(command);
         std::string tmp, filename;
@@ -31,9 +31,13 @@
 extern bool cfg_gtp_mode;
 extern bool cfg_allow_pondering;
 extern int cfg_num_threads;
+extern int cfg_inference_threads;
 extern int cfg_max_threads;
 extern int cfg_max_playouts;
 extern int cfg_max_visits;
+extern int cfg_batch_size;
+extern bool cfg_transpositions;
+extern size_t cfg_max_tree_memory;
 extern TimeManagement::enabled_t cfg_timemanage;
 extern int cfg_lagbuffer_cs;
 extern int cfg_resignpct;
@@ -48,11 +52,19 @@ extern std::vector<int> cfg_gpus;
 extern bool cfg_sgemm_exhaustive;
 extern bool cfg_tune_only;
 #endif
+#ifdef USE_INT8
+extern bool cfg_int8;
+#endif
 extern float cfg_puct;
 extern float cfg_softmax_temp;
 extern float cfg_fpu_reduction;
 extern std::string cfg_logfile;
 extern std::string cfg_weightsfile;
+extern std::string cfg_pack_weights_file;
+extern std::string cfg_shared_weights_dir;
+extern int cfg_nncache_mib;
+extern std::string cfg_nncache_file;
+extern int cfg_nncache_file_mib;
 extern FILE* cfg_logfile_handle;
 extern bool cfg_quiet;
 extern std::string cfg_options_str;
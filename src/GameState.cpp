@@ -57,6 +57,7 @@ void GameState::reset_game() {
 }
 
 bool GameState::forward_move(void) {
+    assert(m_undo_stack.empty());
     if (game_history.size() > m_movenum + 1) {
         m_movenum++;
         *(static_cast<KoState*>(this)) = *game_history[m_movenum];
@@ -67,6 +68,7 @@ bool GameState::forward_move(void) {
 }
 
 bool GameState::undo_move(void) {
+    assert(m_undo_stack.empty());
     if (m_movenum > 0) {
         m_movenum--;
 
@@ -81,6 +83,7 @@ bool GameState::undo_move(void) {
 }
 
 void GameState::rewind(void) {
+    assert(m_undo_stack.empty());
     *(static_cast<KoState*>(this)) = *game_history[0];
     m_movenum = 0;
 }
@@ -90,6 +93,7 @@ void GameState::play_move(int vertex) {
 }
 
 void GameState::play_move(int color, int vertex) {
+    assert(m_undo_stack.empty());
     if (vertex == FastBoard::RESIGN) {
         m_resigned = color;
     } else {
@@ -101,6 +105,30 @@ void GameState::play_move(int color, int vertex) {
     game_history.emplace_back(std::make_shared<KoState>(*this));
 }
 
+void GameState::push_move(int vertex) {
+    assert(vertex != FastBoard::RESIGN);
+    m_undo_stack.emplace_back(*this);
+    KoState::play_move(vertex);
+}
+
+void GameState::pop_move() {
+    assert(!m_undo_stack.empty());
+    *(static_cast<FastState*>(this)) = m_undo_stack.back();
+    m_undo_stack.pop_back();
+    pop_ko_hash();
+}
+
+void GameState::pop_all_moves() {
+    if (m_undo_stack.empty()) {
+        return;
+    }
+    *(static_cast<FastState*>(this)) = m_undo_stack.front();
+    for (auto i = size_t{0}; i < m_undo_stack.size(); i++) {
+        pop_ko_hash();
+    }
+    m_undo_stack.clear();
+}
+
 bool GameState::play_textmove(const std::string& color,
                               const std::string& vertex) {
     int who;
@@ -335,6 +363,14 @@ void GameState::place_free_handicap(int stones) {
 
 const FullBoard& GameState::get_past_board(int moves_ago) const {
     assert(moves_ago >= 0 && (unsigned)moves_ago <= m_movenum);
-    assert(m_movenum + 1 <= game_history.size());
+    // Positions reached by search moves are not in the game history.
+    const auto pushed = m_undo_stack.size();
+    if ((unsigned)moves_ago < pushed) {
+        if (moves_ago == 0) {
+            return board;
+        }
+        return m_undo_stack[pushed - moves_ago].board;
+    }
+    assert(m_movenum - pushed + 1 <= game_history.size());
     return game_history[m_movenum - moves_ago]->board;
 }
@@ -48,6 +48,16 @@ public:
     bool forward_move(void);
     const FullBoard& get_past_board(int moves_ago) const;
 
+    /*
+        Search moves are played on top of the game without recording
+        them in the game history. They are taken back with pop_move,
+        which restores a copy of the previous position, so once the
+        undo stack has grown to the search depth no allocation happens.
+    */
+    void push_move(int vertex);
+    void pop_move();
+    void pop_all_moves();
+
     void play_move(int color, int vertex);
     void play_move(int vertex);
     bool play_textmove(const std::string& color,
@@ -69,6 +79,7 @@ private:
     bool valid_handicap(int stones);
 
     std::vector<std::shared_ptr<const KoState>> game_history;
+    std::vector<FastState> m_undo_stack;
     TimeControl m_timecontrol;
     int m_resigned{FastBoard::EMPTY};
 };
@@ -0,0 +1,65 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "config.h"
+#include "Int8Simd.h"
+
+#ifdef USE_INT8_SIMD
+
+#include <immintrin.h>
+
+#include "Int8Kernels.h"
+
+namespace {
+    struct Avx2 {
+        using type = __m256i;
+        static constexpr auto WIDTH = 32;
+
+        static __m256i zero() {
+            return _mm256_setzero_si256();
+        }
+        template <typename T>
+        static __m256i load(const T* p) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        }
+        // Adds the products of the unsigned bytes of x and the signed bytes
+        // of w, four at a time, to the 32 bit lanes of acc.
+        static __m256i dot(const __m256i acc, const __m256i x, const __m256i w) {
+            const auto pairs = _mm256_maddubs_epi16(x, w);
+            const auto quads = _mm256_madd_epi16(pairs, _mm256_set1_epi16(1));
+            return _mm256_add_epi32(acc, quads);
+        }
+        static std::int32_t sum(const __m256i v) {
+            auto s = _mm_add_epi32(_mm256_castsi256_si128(v),
+                                   _mm256_extracti128_si256(v, 1));
+            s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+            s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+            return _mm_cvtsi128_si32(s);
+        }
+    };
+}
+
+void Int8Simd::dot_avx2(const std::int8_t* weights,
+                        const std::uint8_t* columns,
+                        std::int32_t* out,
+                        const int outputs, const int pixels, const int length) {
+    Int8Kernels::dot<Avx2>(weights, columns, out, outputs, pixels, length);
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "config.h"
+#include "Int8Simd.h"
+
+#ifdef USE_INT8_SIMD
+
+#include <immintrin.h>
+
+#include "Int8Kernels.h"
+
+namespace {
+    struct Avx512Vnni {
+        using type = __m512i;
+        static constexpr auto WIDTH = 64;
+
+        static __m512i zero() {
+            return _mm512_setzero_si512();
+        }
+        template <typename T>
+        static __m512i load(const T* p) {
+            return _mm512_loadu_si512(p);
+        }
+        static __m512i dot(const __m512i acc, const __m512i x, const __m512i w) {
+            return _mm512_dpbusd_epi32(acc, x, w);
+        }
+        static std::int32_t sum(const __m512i v) {
+            return _mm512_reduce_add_epi32(v);
+        }
+    };
+}
+
+void Int8Simd::dot_avx512_vnni(const std::int8_t* weights,
+                               const std::uint8_t* columns,
+                               std::int32_t* out,
+                               const int outputs, const int pixels,
+                               const int length) {
+    Int8Kernels::dot<Avx512Vnni>(weights, columns, out,
+                                 outputs, pixels, length);
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef INT8KERNELS_H_INCLUDED
+#define INT8KERNELS_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+
+#include "Int8Simd.h"
+
+/*
+    The dot products of Int8Simd written against a vector type Vec,
+    instantiated by Int8Avx2.cpp and Int8Avx512Vnni.cpp. As with
+    WinogradKernels.h, only include this from a file built for a specific
+    instruction set.
+
+    Every step computes a block of ROWS outputs for COLUMNS pixels, so a
+    load of the weights is used for every pixel of the block and the
+    other way around.
+*/
+namespace Int8Kernels {
+    template <typename Vec>
+    void dot(const std::int8_t* weights, const std::uint8_t* columns,
+             std::int32_t* out,
+             const int outputs, const int pixels, const int length) {
+        using vec_t = typename Vec::type;
+        constexpr auto ROWS = Int8Simd::ROWS;
+        constexpr auto COLUMNS = Int8Simd::COLUMNS;
+
+        for (auto o = 0; o < outputs; o += ROWS) {
+            for (auto p = 0; p < pixels; p += COLUMNS) {
+                vec_t acc[ROWS][COLUMNS];
+                for (auto r = 0; r < ROWS; r++) {
+                    for (auto c = 0; c < COLUMNS; c++) {
+                        acc[r][c] = Vec::zero();
+                    }
+                }
+
+                for (auto i = 0; i < length; i += Vec::WIDTH) {
+                    vec_t x[COLUMNS];
+                    for (auto c = 0; c < COLUMNS; c++) {
+                        x[c] = Vec::load(&columns[(p + c) * length + i]);
+                    }
+                    for (auto r = 0; r < ROWS; r++) {
+                        const auto w = Vec::load(&weights[(o + r) * length + i]);
+                        for (auto c = 0; c < COLUMNS; c++) {
+                            acc[r][c] = Vec::dot(acc[r][c], x[c], w);
+                        }
+                    }
+                }
+
+                for (auto r = 0; r < ROWS; r++) {
+                    for (auto c = 0; c < COLUMNS; c++) {
+                        out[(o + r) * pixels + p + c] = Vec::sum(acc[r][c]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef INT8SIMD_H_INCLUDED
+#define INT8SIMD_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+
+// The vectorized kernels are only built for x86-64, where they are picked
+// at runtime by what the CPU supports.
+#if defined(__x86_64__) || defined(_M_X64)
+#define USE_INT8_SIMD
+#endif
+
+/*
+    Integer dot products for the 8-bit convolutions of QuantizedNetwork.
+    weights holds a row of length values for each output, columns a row
+    of length values for each pixel, and
+
+        out[o * pixels + p] = sum(weights[o][i] * columns[p][i])
+
+    outputs has to be a multiple of ROWS, pixels of COLUMNS and length of
+    ALIGN. The columns are at most 127, so that the pairwise 16 bit sums
+    of AVX2 can't saturate.
+
+    Every instruction set lives in its own translation unit, which is the
+    only one built with the flags that enable it.
+*/
+namespace Int8Simd {
+    enum class Isa {
+        SCALAR, AVX2, AVX512_VNNI
+    };
+
+    constexpr auto ROWS = 4;
+    constexpr auto COLUMNS = 2;
+    constexpr auto ALIGN = 64;
+
+    void dot_scalar(const std::int8_t* weights, const std::uint8_t* columns,
+                    std::int32_t* out, int outputs, int pixels, int length);
+#ifdef USE_INT8_SIMD
+    void dot_avx2(const std::int8_t* weights, const std::uint8_t* columns,
+                  std::int32_t* out, int outputs, int pixels, int length);
+    void dot_avx512_vnni(const std::int8_t* weights,
+                         const std::uint8_t* columns,
+                         std::int32_t* out, int outputs, int pixels,
+                         int length);
+#endif
+}
+
+#endif
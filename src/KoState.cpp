@@ -34,6 +34,7 @@ void KoState::init_game(int size, float komi) {
 
     m_ko_hash_history.clear();
     m_ko_hash_history.emplace_back(board.get_ko_hash());
+    m_ko_hash_sum = board.get_ko_hash();
 }
 
 bool KoState::superko(void) const {
@@ -45,11 +46,16 @@ bool KoState::superko(void) const {
     return (res != last);
 }
 
+std::uint64_t KoState::get_ko_hash_sum() const {
+    return m_ko_hash_sum;
+}
+
 void KoState::reset_game() {
     FastState::reset_game();
 
     m_ko_hash_history.clear();
     m_ko_hash_history.push_back(board.get_ko_hash());
+    m_ko_hash_sum = board.get_ko_hash();
 }
 
 void KoState::play_move(int vertex) {
@@ -61,4 +67,11 @@ void KoState::play_move(int color, int vertex) {
         FastState::play_move(color, vertex);
     }
     m_ko_hash_history.push_back(board.get_ko_hash());
+    m_ko_hash_sum += board.get_ko_hash();
+}
+
+void KoState::pop_ko_hash() {
+    assert(m_ko_hash_history.size() > 1);
+    m_ko_hash_sum -= m_ko_hash_history.back();
+    m_ko_hash_history.pop_back();
 }
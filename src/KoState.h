@@ -30,13 +30,21 @@ class KoState : public FastState {
 public:
     void init_game(int size, float komi);
     bool superko(void) const;
+    // Sum of the ko hashes of all positions so far. It doesn't depend
+    // on their order, only on which positions superko compares against.
+    std::uint64_t get_ko_hash_sum() const;
     void reset_game();
 
     void play_move(int color, int vertex);
     void play_move(int vertex);
 
+protected:
+    // Forget the ko hash of the last move, the caller restores the board.
+    void pop_ko_hash();
+
 private:
     std::vector<std::uint64_t> m_ko_hash_history;
+    std::uint64_t m_ko_hash_sum{0};
 };
 
 #endif
@@ -63,12 +63,39 @@ static void parse_commandline(int argc, char *argv[]) {
                        "Requires --noponder.")
         ("visits,v", po::value<int>(),
                      "Weaken engine by limiting the number of visits.")
+        ("batchsize", po::value<int>()->default_value(cfg_batch_size),
+                      "Number of positions each search thread sends to "
+                      "the network at once.")
+        ("transpositions", "Share search statistics between transposed "
+                           "positions.")
+        ("max-tree-memory", po::value<int>(),
+                            "Memory budget for the search tree in MiB. "
+                            "Subtrees with few visits are freed to stay "
+                            "within it. 0 means no budget.")
         ("lagbuffer,b", po::value<int>()->default_value(cfg_lagbuffer_cs),
                         "Safety margin for time usage in centiseconds.")
         ("resignpct,r", po::value<int>()->default_value(cfg_resignpct),
                         "Resign when winrate is less than x%.\n"
                         "-1 uses 10% but scales for handicap.")
-        ("weights,w", po::value<std::string>(), "File with network weights.")
+        ("weights,w", po::value<std::string>(),
+                      "File with network weights, as text or packed.")
+        ("pack-weights", po::value<std::string>(),
+                         "Write the weights in the packed binary format, "
+                         "which loads much faster, to this file and exit.")
+        ("shared-weights", po::value<std::string>(),
+                           "Directory for packed copies of text weights. "
+                           "Processes using the same weights map one copy "
+                           "of them instead of each loading their own.")
+        ("nncache-size", po::value<int>(),
+                         "Memory for cached network evaluations in MiB. "
+                         "By default it follows the playout limit.")
+        ("nncache-file", po::value<std::string>(),
+                         "Keep network evaluations in this file, so later "
+                         "runs and other processes with the same network "
+                         "can reuse them.")
+        ("nncache-file-size",
+            po::value<int>()->default_value(cfg_nncache_file_mib),
+            "Size in MiB of a new --nncache-file.")
         ("logfile,l", po::value<std::string>(), "File to log input/output to.")
         ("quiet,q", "Disable all diagnostic output.")
         ("timemanage", po::value<std::string>()->default_value("auto"),
@@ -86,6 +113,22 @@ static void parse_commandline(int argc, char *argv[]) {
         ("full-tuner", "Try harder to find an optimal OpenCL tuning.")
         ("tune-only", "Tune OpenCL only and then exit.")
         ;
+#endif
+#ifndef USE_OPENCL
+    po::options_description cpu_desc("CPU options");
+    cpu_desc.add_options()
+        ("inference-threads",
+            po::value<int>()->default_value(cfg_inference_threads),
+            "Threads that share the work of one network evaluation. "
+            "Lowers the latency of each evaluation; combine with fewer "
+            "search threads (-t) so the total fits the cores. The int8 "
+            "tower (--int8) is not split.")
+#ifdef USE_INT8
+        ("int8", "Run the residual tower with 8-bit integers. Calibrated "
+                 "at startup, faster on large networks but slightly less "
+                 "accurate.")
+#endif
+        ;
 #endif
     po::options_description selfplay_desc("Self-play options");
     selfplay_desc.add_options()
@@ -119,6 +162,9 @@ static void parse_commandline(int argc, char *argv[]) {
     visible.add(gen_desc)
 #ifdef USE_OPENCL
        .add(gpu_desc)
+#endif
+#ifndef USE_OPENCL
+       .add(cpu_desc)
 #endif
        .add(selfplay_desc)
 #ifdef USE_TUNER
@@ -191,6 +237,19 @@ static void parse_commandline(int argc, char *argv[]) {
         printf("A network weights file is required to use the program.\n");
         exit(EXIT_FAILURE);
     }
+    if (vm.count("pack-weights")) {
+        cfg_pack_weights_file = vm["pack-weights"].as<std::string>();
+    }
+    if (vm.count("shared-weights")) {
+        cfg_shared_weights_dir = vm["shared-weights"].as<std::string>();
+    }
+    if (vm.count("nncache-size")) {
+        cfg_nncache_mib = std::max(1, vm["nncache-size"].as<int>());
+    }
+    if (vm.count("nncache-file")) {
+        cfg_nncache_file = vm["nncache-file"].as<std::string>();
+        cfg_nncache_file_mib = std::max(1, vm["nncache-file-size"].as<int>());
+    }
 
     if (vm.count("gtp")) {
         cfg_gtp_mode = true;
@@ -206,6 +265,21 @@ static void parse_commandline(int argc, char *argv[]) {
     }
     myprintf("Using %d thread(s).\n", cfg_num_threads);
 
+#ifndef USE_OPENCL
+    if (!vm["inference-threads"].defaulted()) {
+        auto inference_threads = vm["inference-threads"].as<int>();
+        if (inference_threads < 1 || inference_threads > cfg_max_threads) {
+            myprintf("Clamping inference threads to 1-%d\n", cfg_max_threads);
+        }
+        cfg_inference_threads = std::max(1,
+            std::min(inference_threads, cfg_max_threads));
+    }
+    if (cfg_inference_threads > 1) {
+        myprintf("Using %d thread(s) per network evaluation.\n",
+                 cfg_inference_threads);
+    }
+#endif
+
     if (vm.count("seed")) {
         cfg_rng_seed = vm["seed"].as<std::uint64_t>();
         if (cfg_num_threads > 1) {
@@ -227,6 +301,15 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_dumbpass = true;
     }
 
+    if (vm.count("transpositions")) {
+        cfg_transpositions = true;
+    }
+
+    if (vm.count("max-tree-memory")) {
+        const auto mib = std::max(0, vm["max-tree-memory"].as<int>());
+        cfg_max_tree_memory = size_t(mib) * 1024 * 1024;
+    }
+
     if (vm.count("playouts")) {
         cfg_max_playouts = vm["playouts"].as<int>();
         if (!vm.count("noponder")) {
@@ -251,6 +334,10 @@ static void parse_commandline(int argc, char *argv[]) {
         }
     }
 
+    if (vm.count("batchsize")) {
+        cfg_batch_size = std::max(1, vm["batchsize"].as<int>());
+    }
+
     if (vm.count("resignpct")) {
         cfg_resignpct = vm["resignpct"].as<int>();
     }
@@ -309,6 +396,12 @@ static void parse_commandline(int argc, char *argv[]) {
     }
 #endif
 
+#ifdef USE_INT8
+    if (vm.count("int8")) {
+        cfg_int8 = true;
+    }
+#endif
+
     if (vm.count("benchmark")) {
         // These must be set later to override default arguments.
         cfg_allow_pondering = false;
@@ -348,12 +441,24 @@ void init_global_objects() {
     // improves reproducibility across platforms.
     Random::get_Rng().seedrandom(cfg_rng_seed);
 
-    // When visits are limited ensure cache size is still limited.
-    auto playouts = std::min(cfg_max_playouts, cfg_max_visits);
-    NNCache::get_NNCache().set_size_from_playouts(playouts);
+    if (cfg_nncache_mib > 0) {
+        NNCache::get_NNCache().set_size_mib(cfg_nncache_mib);
+    } else {
+        // When visits are limited ensure cache size is still limited.
+        auto playouts = std::min(cfg_max_playouts, cfg_max_visits);
+        NNCache::get_NNCache().set_size_from_playouts(playouts);
+    }
 
     // Initialize network
     Network::initialize();
+
+    // Entries in the file are keyed by the network, so it is opened once
+    // the weights are loaded.
+    if (!cfg_nncache_file.empty()) {
+        NNCache::get_NNCache().open_file(cfg_nncache_file,
+                                         cfg_nncache_file_mib,
+                                         Network::get_weights_hash());
+    }
 }
 
 void benchmark(GameState& game) {
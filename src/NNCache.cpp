@@ -17,79 +17,249 @@
 */
 
 #include "config.h"
+#include <algorithm>
+#include <cmath>
 #include <functional>
 
 #include "NNCache.h"
+#include "NNCacheFile.h"
 #include "Utils.h"
 #include "UCTSearch.h"
 
-NNCache::NNCache(int size) : m_size(size) {}
+NNCache::NNCache(int size) : m_size(size) {
+    resize(size);
+}
+
+NNCache::~NNCache() = default;
 
 NNCache& NNCache::get_NNCache(void) {
     static NNCache cache;
     return cache;
 }
 
+void NNCache::encode(const Network::Netresult& result,
+                     CompactResult& compact) {
+    const auto max_prior = std::max(result.policy_pass,
+        *std::max_element(begin(result.policy), end(result.policy)));
+    const auto code = [max_prior](const float prior) {
+        if (!(prior > 0.0f)) {
+            return ZERO_CODE;
+        }
+        const auto q = std::round(-std::log(prior / max_prior) * LOG_STEPS);
+        return std::uint8_t(std::min(q, float(ZERO_CODE - 1)));
+    };
+    compact.max_prior = max_prior;
+    compact.winrate = result.winrate;
+    std::transform(begin(result.policy), end(result.policy),
+                   begin(compact.priors), code);
+    compact.priors[BOARD_SQUARES] = code(result.policy_pass);
+}
+
+void NNCache::decode(const CompactResult& compact,
+                     Network::Netresult& result) {
+    static const auto scale = []() {
+        auto scale = std::array<float, 256>{};
+        for (auto q = size_t{0}; q < ZERO_CODE; q++) {
+            scale[q] = std::exp(-float(q) / LOG_STEPS);
+        }
+        scale[ZERO_CODE] = 0.0f;
+        return scale;
+    }();
+    const auto prior = [&compact](const std::uint8_t q) {
+        return compact.max_prior * scale[q];
+    };
+    std::transform(begin(compact.priors),
+                   begin(compact.priors) + BOARD_SQUARES,
+                   begin(result.policy), prior);
+    result.policy_pass = prior(compact.priors[BOARD_SQUARES]);
+    result.winrate = compact.winrate;
+}
+
+NNCache::Shard& NNCache::get_shard(std::uint64_t hash) {
+    return m_shards[hash % NUM_SHARDS];
+}
+
+NNCache::Entry* NNCache::find(Shard& shard, std::uint64_t hash) {
+    const auto home = (hash / NUM_SHARDS) % m_shard_size;
+    for (auto i = size_t{0}; i < PROBE_LENGTH; i++) {
+        auto& entry = shard.entries[(home + i) % m_shard_size];
+        if (entry.stamp != 0 && entry.hash == hash) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool NNCache::open_file(const std::string& filename, size_t size_mib,
+                        std::uint64_t network_hash) {
+    auto file = std::make_unique<NNCacheFile>();
+    if (!file->open(filename, size_mib * 1024 * 1024)) {
+        return false;
+    }
+    Utils::myprintf("NN cache file %s holds %zu positions.\n",
+                    filename.c_str(), file->size());
+    m_file = std::move(file);
+    m_network_hash = network_hash;
+    return true;
+}
+
 bool NNCache::lookup(std::uint64_t hash, Network::Netresult & result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
     ++m_lookups;
 
-    auto iter = m_cache.find(hash);
-    if (iter == m_cache.end()) {
-        return false;  // Not found.
+    {
+        auto& shard = get_shard(hash);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const auto entry = find(shard, hash);
+        if (entry) {
+            // Found it.
+            ++m_hits;
+            const auto age = (shard.stamp - entry->stamp) & STAMP_MASK;
+            auto bucket = size_t{0};
+            while (bucket + 1 < AGE_BUCKETS
+                   && size_t{age} * 16 >= m_shard_size << bucket) {
+                bucket++;
+            }
+            ++m_hits_by_age[bucket];
+            entry->stamp |= REFERENCED;
+            decode(entry->result, result);
+            return true;
+        }
     }
 
-    const auto& entry = iter->second;
-
-    // Found it.
-    ++m_hits;
-    result = entry->result;
-    return true;
+    // Results from other runs are only good for the same network.
+    auto compact = CompactResult{};
+    if (m_file && m_file->lookup(hash ^ m_network_hash, compact)) {
+        ++m_hits;
+        ++m_file_hits;
+        decode(compact, result);
+        insert(hash, compact);
+        return true;
+    }
+    return false;  // Not found.
 }
 
 void NNCache::insert(std::uint64_t hash,
                      const Network::Netresult& result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    auto compact = CompactResult{};
+    encode(result, compact);
+    insert(hash, compact);
+    if (m_file) {
+        m_file->insert(hash ^ m_network_hash, compact);
+    }
+}
+
+void NNCache::insert(std::uint64_t hash, const CompactResult& compact) {
+    auto& shard = get_shard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
 
-    if (m_cache.find(hash) != m_cache.end()) {
+    if (find(shard, hash)) {
         return;  // Already in the cache.
     }
 
-    m_cache.emplace(hash, std::make_unique<Entry>(result));
-    m_order.push_back(hash);
-    ++m_inserts;
-
-    // If the cache is too large, remove the oldest entry.
-    if (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+    // Take an empty slot if there is one. Otherwise take the oldest entry
+    // that was not hit since it was last passed over. Entries that were
+    // hit lose their mark when an entry after them is taken, so they are
+    // only kept as long as they keep being hit.
+    const auto home = (hash / NUM_SHARDS) % m_shard_size;
+    const auto slot = [&](const size_t i) -> Entry& {
+        return shard.entries[(home + i) % m_shard_size];
+    };
+    Entry* victim = nullptr;
+    for (auto i = size_t{0}; i < PROBE_LENGTH; i++) {
+        auto& entry = slot(i);
+        if (entry.stamp == 0) {
+            victim = &entry;
+            break;
+        }
+        if (!(entry.stamp & REFERENCED)
+            && (!victim || entry.stamp < victim->stamp)) {
+            victim = &entry;
+        }
+    }
+    if (!victim) {
+        // All were hit, start over from the oldest.
+        victim = &slot(0);
+        for (auto i = size_t{0}; i < PROBE_LENGTH; i++) {
+            auto& entry = slot(i);
+            entry.stamp &= STAMP_MASK;
+            if (entry.stamp < victim->stamp) {
+                victim = &entry;
+            }
+        }
+    }
+    for (auto i = size_t{0}; i < PROBE_LENGTH; i++) {
+        auto& entry = slot(i);
+        if ((entry.stamp & STAMP_MASK) < victim->stamp) {
+            entry.stamp &= STAMP_MASK;
+        }
     }
+    if (victim->stamp == 0) {
+        ++m_entries;
+    }
+
+    victim->hash = hash;
+    victim->stamp = ++shard.stamp;
+    victim->result = compact;
+    ++m_inserts;
 }
 
 void NNCache::resize(int size) {
     m_size = size;
-    while (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+    // Every home slot needs a full probe sequence of distinct slots.
+    m_shard_size = std::max((m_size + NUM_SHARDS - 1) / NUM_SHARDS,
+                            PROBE_LENGTH);
+
+    // calloc leaves big allocations to the OS, which hands out zero
+    // pages on first use. Allocate a line more to align the slots.
+    const auto entries = m_shard_size * NUM_SHARDS;
+    m_storage.reset(std::calloc(entries * sizeof(Entry) + alignof(Entry),
+                                1));
+    if (!m_storage) {
+        throw std::bad_alloc();
     }
+    const auto address = reinterpret_cast<std::uintptr_t>(m_storage.get());
+    const auto aligned = (address + alignof(Entry) - 1)
+                         / alignof(Entry) * alignof(Entry);
+    auto slots = reinterpret_cast<Entry*>(aligned);
+    for (auto& shard : m_shards) {
+        shard.entries = slots;
+        shard.stamp = 0;
+        slots += m_shard_size;
+    }
+    m_entries = 0;
+}
+
+void NNCache::set_size_mib(int mib) {
+    const auto entries = size_t(mib) * 1024 * 1024 / sizeof(Entry);
+    resize(static_cast<int>(std::max(entries, NUM_SHARDS * PROBE_LENGTH)));
 }
 
 void NNCache::set_size_from_playouts(int max_playouts) {
     // cache hits are generally from last several moves so setting cache
     // size based on playouts increases the hit rate while balancing memory
-    // usage for low playout instances. 150'000 cache entries is ~225 MB
+    // usage for low playout instances. 500'000 cache entries is ~190 MB
     constexpr auto num_cache_moves = 3;
     auto max_playouts_per_move =
         std::min(max_playouts,
                  UCTSearch::UNLIMITED_PLAYOUTS / num_cache_moves);
     auto max_size = num_cache_moves * max_playouts_per_move;
-    max_size = std::min(150'000, std::max(6'000, max_size));
+    max_size = std::min(500'000, std::max(6'000, max_size));
     NNCache::get_NNCache().resize(max_size);
 }
 
 void NNCache::dump_stats() {
     Utils::myprintf(
-        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %u size\n",
-        m_hits, m_lookups, 100. * m_hits / (m_lookups + 1),
-        m_inserts, m_cache.size());
+        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %d size\n",
+        m_hits.load(), m_lookups.load(),
+        100. * m_hits / (m_lookups + 1),
+        m_inserts.load(), m_entries.load());
+    Utils::myprintf("NNCache: hits by age in shard turnovers: "
+                    "<1/16 %d, <1/8 %d, <1/4 %d, <1/2 %d, <1 %d, older %d\n",
+                    m_hits_by_age[0].load(), m_hits_by_age[1].load(),
+                    m_hits_by_age[2].load(), m_hits_by_age[3].load(),
+                    m_hits_by_age[4].load(), m_hits_by_age[5].load());
+    if (m_file) {
+        Utils::myprintf("NNCache: %d hits from the cache file\n",
+                        m_file_hits.load());
+    }
 }
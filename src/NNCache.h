@@ -21,22 +21,56 @@
 
 #include "config.h"
 
-#include <deque>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
 #include <mutex>
-#include <unordered_map>
+#include <string>
 
 #include "Network.h"
 
+class NNCacheFile;
+
 class NNCache {
 public:
+    // The priors are kept as 8-bit codes on a log scale below the
+    // largest one. A code of q stands for max_prior * exp(-q / LOG_STEPS),
+    // which is within 3% of the prior, and the last code for 0.
+    static constexpr auto LOG_STEPS = 16.0f;
+    static constexpr auto ZERO_CODE = std::uint8_t{255};
+
+    // A result as the cache stores it
+    struct CompactResult {
+        float winrate;
+        float max_prior;
+        // The board points, then pass
+        std::array<std::uint8_t, BOARD_SQUARES + 1> priors;
+    };
+
+    static void encode(const Network::Netresult& result,
+                       CompactResult& compact);
+    static void decode(const CompactResult& compact,
+                       Network::Netresult& result);
+
     // return the global NNCache
     static NNCache& get_NNCache(void);
 
     // Set a reasonable size gives max number of playouts
     void set_size_from_playouts(int max_playouts);
 
-    // Resize NNCache
+    // Resize NNCache. This drops all entries and must not run while
+    // other threads use the cache.
     void resize(int size);
+    // Resize to the number of entries that fit in mib MiB.
+    void set_size_mib(int mib);
+
+    // Also keep the results in filename, shared with other runs and
+    // processes using the same network. size_mib is used when the file
+    // is created.
+    bool open_file(const std::string& filename, size_t size_mib,
+                   std::uint64_t network_hash);
 
     // Try and find an existing entry.
     bool lookup(std::uint64_t hash, Network::Netresult & result);
@@ -53,27 +87,67 @@ public:
     void dump_stats();
 
 private:
-    NNCache(int size = 150000);  // ~ 225MB
+    NNCache(int size = 500000);  // ~ 190MB
+    ~NNCache();
+
+    // The table is split in shards with a lock each, so threads only
+    // wait for each other when they hit the same shard.
+    static constexpr size_t NUM_SHARDS = 64;
+    // An entry goes in one of the PROBE_LENGTH slots following its
+    // home slot. When they are all used, one is replaced with a second
+    // chance policy, see insert().
+    static constexpr size_t PROBE_LENGTH = 8;
+
+    // Set in the stamp of an entry when it is hit
+    static constexpr std::uint32_t REFERENCED = 0x80000000;
+    static constexpr std::uint32_t STAMP_MASK = ~REFERENCED;
+
+    // Hits are counted by the age of the entry, in inserts into its shard
+    // as a fraction of the shard size: below 1/16, 1/8, 1/4, 1/2, 1 and
+    // older.
+    static constexpr size_t AGE_BUCKETS = 6;
+
+    // Stored inline in the table, a slot is a whole number of cache lines
+    // (6 on 19x19).
+    struct alignas(64) Entry {
+        std::uint64_t hash;
+        // Insertion order in the shard and the REFERENCED bit, 0 for an
+        // empty slot
+        std::uint32_t stamp;
+        CompactResult result;
+    };
 
-    std::mutex m_mutex;
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        Entry* entries{nullptr};
+        std::uint32_t stamp{0};
+    };
+
+    Shard& get_shard(std::uint64_t hash);
+    Entry* find(Shard& shard, std::uint64_t hash);
+    void insert(std::uint64_t hash, const CompactResult& compact);
 
     size_t m_size;
+    size_t m_shard_size{0};
 
-    // Statistics
-    int m_hits{0};
-    int m_lookups{0};
-    int m_inserts{0};
-
-    struct Entry {
-        Entry(const Network::Netresult& r)
-            : result(r) {}
-        Network::Netresult result;  // ~ 1.5KB
-    };
+    // Zeroed memory for all slots. The pages are only touched once
+    // entries land in them.
+    std::unique_ptr<void, decltype(&std::free)> m_storage{nullptr,
+                                                          &std::free};
+    std::array<Shard, NUM_SHARDS> m_shards;
+
+    // Second level behind the table, if one was opened
+    std::unique_ptr<NNCacheFile> m_file;
+    // Mixed into the keys in the file
+    std::uint64_t m_network_hash{0};
 
-    // Map from hash to {features, result}
-    std::unordered_map<std::uint64_t, std::unique_ptr<const Entry>> m_cache;
-    // Order entries were added to the map.
-    std::deque<size_t> m_order;
+    // Statistics
+    std::atomic<int> m_hits{0};
+    std::atomic<int> m_lookups{0};
+    std::atomic<int> m_inserts{0};
+    std::atomic<int> m_entries{0};
+    std::atomic<int> m_file_hits{0};
+    std::array<std::atomic<int>, AGE_BUCKETS> m_hits_by_age{};
 };
 
 #endif
@@ -0,0 +1,273 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "NNCacheFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Utils.h"
+
+using namespace Utils;
+
+static constexpr char MAGIC[8] = {'L', 'Z', 'N', 'N', 'C', 'A', 'C', 'H'};
+// The records start on a cache line after the header.
+static constexpr auto RECORDS_OFFSET = std::size_t{64};
+static_assert(sizeof(NNCacheFile::Header) <= RECORDS_OFFSET,
+              "Header must fit before the records");
+
+NNCacheFile::~NNCacheFile() {
+    close();
+}
+
+bool NNCacheFile::create(const std::string& filename,
+                         const std::size_t size) {
+    auto header = Header{};
+    std::copy(MAGIC, MAGIC + sizeof(MAGIC), header.magic);
+    header.version = VERSION;
+    header.record_size = sizeof(Record);
+    header.board_size = BOARD_SIZE;
+    header.reserved = 0;
+    header.records = (size - RECORDS_OFFSET) / sizeof(Record);
+
+#ifdef _WIN32
+    const auto pid = GetCurrentProcessId();
+#else
+    const auto pid = getpid();
+#endif
+    const auto tmpname = filename + "." + std::to_string(pid) + ".tmp";
+    auto file = std::ofstream{tmpname, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    // Only the last byte is written, so the table stays sparse where
+    // the file system allows it. Zeros are empty records.
+    file.seekp(size - 1);
+    file.put('\0');
+    file.close();
+    if (file.fail()) {
+        std::remove(tmpname.c_str());
+        return false;
+    }
+    // Unlike rename, these don't replace a file that another process
+    // created in the meantime, which that process may be using already.
+#ifdef _WIN32
+    const auto moved = MoveFileExA(tmpname.c_str(), filename.c_str(), 0);
+#else
+    const auto moved = link(tmpname.c_str(), filename.c_str()) == 0;
+#endif
+    std::remove(tmpname.c_str());
+    return moved || std::ifstream{filename}.good();
+}
+
+bool NNCacheFile::open(const std::string& filename,
+                       const std::size_t size_bytes) {
+    close();
+    // A new file only appears under its name with the header written,
+    // so other processes opening it at the same time see all of it.
+    const auto new_size = RECORDS_OFFSET
+        + std::max(size_bytes / sizeof(Record), PROBE_LENGTH)
+          * sizeof(Record);
+    if (!std::ifstream{filename} && !create(filename, new_size)) {
+        myprintf("Could not create NN cache file: %s\n", filename.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    m_file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        m_file = nullptr;
+        myprintf("Could not open NN cache file: %s\n", filename.c_str());
+        return false;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(m_file, &size);
+    m_size = size.QuadPart;
+    if (m_size > 0) {
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE,
+                                       0, 0, nullptr);
+    }
+    if (m_mapping != nullptr) {
+        m_data = static_cast<char*>(
+            MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, 0));
+    }
+#else
+    const auto fd = ::open(filename.c_str(), O_RDWR);
+    if (fd < 0) {
+        myprintf("Could not open NN cache file: %s\n", filename.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        m_size = st.st_size;
+    }
+    if (m_size > 0) {
+        const auto data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            m_data = static_cast<char*>(data);
+        }
+    }
+    ::close(fd);
+#endif
+    if (m_data == nullptr) {
+        myprintf("Could not map NN cache file: %s\n", filename.c_str());
+        close();
+        return false;
+    }
+
+    const auto& header = *reinterpret_cast<const Header*>(m_data);
+    // Other processes see the records through their own mappings, which
+    // only works if the atomics don't take a lock in this one.
+    const auto valid = m_size >= RECORDS_OFFSET
+        && std::equal(MAGIC, MAGIC + sizeof(MAGIC), header.magic)
+        && header.version == VERSION
+        && header.record_size == sizeof(Record)
+        && header.board_size == BOARD_SIZE
+        && header.records >= PROBE_LENGTH
+        && header.records <= (m_size - RECORDS_OFFSET) / sizeof(Record)
+        && records()[0].sequence.is_lock_free();
+    if (!valid) {
+        myprintf("NN cache file is not usable by this build: %s\n",
+                 filename.c_str());
+        close();
+        return false;
+    }
+    m_records = header.records;
+    return true;
+}
+
+NNCacheFile::Record* NNCacheFile::records() const {
+    return reinterpret_cast<Record*>(m_data + RECORDS_OFFSET);
+}
+
+std::uint64_t NNCacheFile::checksum(const std::uint64_t key,
+                                    const NNCache::CompactResult& result) {
+    // FNV-1a
+    auto hash = std::uint64_t{0xcbf29ce484222325} ^ key;
+    const auto bytes = reinterpret_cast<const unsigned char*>(&result);
+    for (auto i = std::size_t{0}; i < sizeof(result); i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+bool NNCacheFile::lookup(const std::uint64_t key,
+                         NNCache::CompactResult& result) const {
+    const auto home = key % m_records;
+    for (auto i = std::size_t{0}; i < PROBE_LENGTH; i++) {
+        const auto& record = records()[(home + i) % m_records];
+        if (record.words[0].load(std::memory_order_relaxed) != key) {
+            continue;
+        }
+        // Copy first and check that no one wrote the record meanwhile.
+        const auto sequence = record.sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            continue;
+        }
+        std::uint64_t words[ENTRY_WORDS];
+        for (auto w = std::size_t{0}; w < ENTRY_WORDS; w++) {
+            words[w] = record.words[w].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (record.sequence.load(std::memory_order_relaxed) != sequence) {
+            continue;
+        }
+        auto entry = Entry{};
+        std::memcpy(&entry, words, sizeof(entry));
+        if (entry.key == key
+            && entry.checksum == checksum(key, entry.result)) {
+            result = entry.result;
+            return true;
+        }
+    }
+    return false;
+}
+
+void NNCacheFile::insert(const std::uint64_t key,
+                         const NNCache::CompactResult& result) {
+    const auto home = key % m_records;
+    // Take an empty slot or the one holding key. Otherwise the upper
+    // bits of the key pick which one to replace.
+    auto target = (home + (key >> 32) % PROBE_LENGTH) % m_records;
+    for (auto i = std::size_t{0}; i < PROBE_LENGTH; i++) {
+        const auto slot = (home + i) % m_records;
+        const auto slot_key =
+            records()[slot].words[0].load(std::memory_order_relaxed);
+        if (slot_key == key) {
+            return;  // Already in the file.
+        }
+        if (slot_key == 0) {
+            target = slot;
+            break;
+        }
+    }
+
+    auto entry = Entry{};
+    entry.key = key;
+    entry.result = result;
+    entry.checksum = checksum(key, entry.result);
+    std::uint64_t words[ENTRY_WORDS];
+    std::memcpy(words, &entry, sizeof(entry));
+
+    // The sequence is odd while the words change. A process that dies
+    // in between leaves it odd until the next write of the record.
+    auto& record = records()[target];
+    const auto sequence =
+        record.sequence.load(std::memory_order_relaxed) | 1;
+    record.sequence.store(sequence, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (auto w = std::size_t{0}; w < ENTRY_WORDS; w++) {
+        record.words[w].store(words[w], std::memory_order_relaxed);
+    }
+    record.sequence.store(sequence + 1, std::memory_order_release);
+}
+
+void NNCacheFile::close() {
+#ifdef _WIN32
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file != nullptr) {
+        CloseHandle(m_file);
+    }
+    m_mapping = nullptr;
+    m_file = nullptr;
+#else
+    if (m_data != nullptr) {
+        munmap(m_data, m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_records = 0;
+}
@@ -0,0 +1,109 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NNCACHEFILE_H_INCLUDED
+#define NNCACHEFILE_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "NNCache.h"
+
+/*
+    Network results kept in a memory-mapped file, so they outlive the
+    process and are shared by every process mapping the same file.
+
+    The file is a fixed-size table of records after a header. A record
+    goes in one of PROBE_LENGTH slots from its home slot, and when those
+    are taken it replaces one of them. Writers don't lock, from this
+    process or others. Every word of a record is read and written as a
+    lock-free atomic, and a sequence word that is odd while the record
+    is written makes readers skip records that change under them. Two
+    writers can still interleave on one record, so a checksum over the
+    key and the result makes a torn record read as a miss. The OS writes
+    the pages back in the background.
+*/
+class NNCacheFile {
+public:
+    static constexpr std::uint32_t VERSION = 2;
+    static constexpr std::size_t PROBE_LENGTH = 4;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        // Layout checks, the file is only valid for the build that
+        // wrote it.
+        std::uint32_t record_size;
+        std::uint32_t board_size;
+        std::uint32_t reserved;
+        std::uint64_t records;
+    };
+    struct Entry {
+        // 0 for an empty slot
+        std::uint64_t key;
+        std::uint64_t checksum;
+        NNCache::CompactResult result;
+    };
+    static constexpr auto ENTRY_WORDS = sizeof(Entry) / sizeof(std::uint64_t);
+    static_assert(sizeof(Entry) % sizeof(std::uint64_t) == 0,
+                  "Entry must be a whole number of words");
+    struct Record {
+        std::atomic<std::uint64_t> sequence;
+        std::atomic<std::uint64_t> words[ENTRY_WORDS];
+    };
+
+    NNCacheFile() = default;
+    ~NNCacheFile();
+    NNCacheFile(const NNCacheFile&) = delete;
+    NNCacheFile& operator=(const NNCacheFile&) = delete;
+
+    // Maps filename, creating it with room for size_bytes if it doesn't
+    // exist. An existing file keeps its size. Prints the reason and
+    // returns false if it can't be used.
+    bool open(const std::string& filename, std::size_t size_bytes);
+
+    bool lookup(std::uint64_t key, NNCache::CompactResult& result) const;
+    void insert(std::uint64_t key, const NNCache::CompactResult& result);
+
+    std::size_t size() const {
+        return m_records;
+    }
+
+private:
+    void close();
+    Record* records() const;
+    // Writes a new file with an empty table and moves it to filename,
+    // unless another process got there first.
+    static bool create(const std::string& filename, std::size_t size);
+    static std::uint64_t checksum(std::uint64_t key,
+                                  const NNCache::CompactResult& result);
+
+    char* m_data{nullptr};
+    std::size_t m_size{0};
+    std::size_t m_records{0};
+#ifdef _WIN32
+    void* m_file{nullptr};
+    void* m_mapping{nullptr};
+#endif
+};
+
+#endif
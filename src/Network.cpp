@@ -22,10 +22,15 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iterator>
 #include <memory>
+#include <random>
 #include <sstream>
 #include <string>
 #include <boost/utility.hpp>
@@ -41,6 +46,9 @@
 #ifdef USE_OPENBLAS
 #include <cblas.h>
 #endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #include "zlib.h"
 #ifdef USE_OPENCL
 #include "OpenCLScheduler.h"
@@ -54,16 +62,24 @@
 #include "GTP.h"
 #include "Im2Col.h"
 #include "NNCache.h"
+#include "PackedWeights.h"
+#include "QuantizedNetwork.h"
 #include "Random.h"
 #include "ThreadPool.h"
 #include "Timing.h"
 #include "Utils.h"
+#include "WinogradSimd.h"
+#include "Zobrist.h"
 
 namespace x3 = boost::spirit::x3;
 using namespace Utils;
 
 // Input + residual block tower
 static std::vector<std::vector<float>> conv_weights;
+// The Winograd transformed weights of every convolution. They point
+// into conv_weights, or into packed_weights if it was loaded.
+static std::vector<const float*> conv_U;
+static PackedWeights packed_weights;
 static std::vector<std::vector<float>> conv_biases;
 static std::vector<std::vector<float>> batchnorm_means;
 static std::vector<std::vector<float>> batchnorm_stddivs;
@@ -90,10 +106,218 @@ static std::array<float, 256> ip2_val_w;
 static std::array<float, 1> ip2_val_b;
 static bool value_head_not_stm;
 
+// Vectorized Winograd transforms to use, picked in initialize()
+static WinogradSimd::Isa winograd_isa = WinogradSimd::Isa::SCALAR;
+
+#ifdef USE_INT8
+// The tower with 8-bit weights, used once it is calibrated
+static QuantizedNetwork int8_net;
+static std::atomic<bool> use_int8{false};
+// Positions the int8 tower is calibrated on
+static constexpr auto INT8_CALIBRATION_POSITIONS = 64;
+// Self-checks in a row that can find the int8 tower off before the
+// float one takes over for good
+static constexpr auto INT8_SELFCHECK_FAILS = 3;
+static std::atomic<int> int8_selfcheck_fails{0};
+#endif
+
 // Symmetry helper
 static std::array<std::array<int, BOARD_SQUARES>, 8> symmetry_nn_idx_table;
+// Where each point of the board goes under a symmetry, the inverse of
+// symmetry_nn_idx_table
+static std::array<std::array<int, BOARD_SQUARES>, 8> symmetry_nn_idx_inverse;
+// Zobrist key of a stone of each color on each point after a symmetry,
+// with the key of the empty point taken out
+static std::array<std::array<std::array<std::uint64_t, BOARD_SQUARES>, 2>, 8>
+    symmetry_zobrist;
+
+// Time and work of every stage of an evaluation, taken by netbench profile.
+// A stage is identified by the order it runs in, so every evaluation adds
+// to the same entries.
+struct Profile {
+    struct Stage {
+        std::string name;
+        double seconds;
+        // Arithmetic done and memory read and written, as counted by
+        // the stage from its sizes
+        double flops;
+        double bytes;
+    };
+    std::vector<Stage> stages;
+    size_t next{0};
+    // Convolution that is running, -1 outside of the tower
+    int layer{-1};
+};
+
+// Buffers for evaluating a batch of positions. Every thread that runs the
+// network keeps its own. They are sized for the loaded network on first use
+// and only grow for a bigger batch, so an evaluation does not allocate.
+struct Workspace {
+    std::vector<net_t> input;
+    std::vector<float> policy_data;
+    std::vector<float> value_data;
+#ifdef USE_OPENCL
+    std::vector<net_t> input_n;
+    std::vector<net_t> policy_data_n;
+    std::vector<net_t> value_data_n;
+#endif
+#ifdef USE_BLAS
+    // forward_cpu
+    std::vector<float> conv_out;
+    std::vector<float> conv_mid;
+    std::vector<float> res;
+    std::vector<float> V;
+    std::vector<float> M;
+    // im2col of convolve, for filters wider than 1x1
+    std::vector<float> col;
+#endif
+#ifdef USE_INT8
+    QuantizedNetwork::Buffers int8;
+    // While calibrating, forward_cpu records the largest input of every
+    // convolution here.
+    std::vector<float>* conv_max{nullptr};
+#endif
+    // Heads
+    std::vector<float> policy_out;
+    std::vector<float> winrate_data;
+    std::vector<float> winrate_out;
+    std::vector<float> policy_in;
+    std::vector<float> policy_softmax;
+    // NNCache entries, in the orientation they are stored in
+    Network::Netresult cached;
+    // Only set while netbench profiles
+    Profile* profile{nullptr};
+};
+static thread_local Workspace workspace;
+
+static void set_profile_layer(const int layer) {
+    if (workspace.profile) {
+        workspace.profile->layer = layer;
+    }
+}
 
-void Network::benchmark(const GameState* const state, const int iterations) {
+// Runs f, adding its time to the stage op of the current layer if a
+// profile is being taken.
+template <typename F>
+static void profile_stage(const char* const op,
+                          const double flops, const double bytes, F&& f) {
+    const auto profile = workspace.profile;
+    if (!profile) {
+        f();
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto end = std::chrono::steady_clock::now();
+
+    if (profile->next == profile->stages.size()) {
+        auto name = std::string{op};
+        if (profile->layer == 0) {
+            name = "input conv " + name;
+        } else if (profile->layer > 0) {
+            name = "block " + std::to_string((profile->layer + 1) / 2)
+                   + " conv" + std::to_string(2 - profile->layer % 2)
+                   + " " + name;
+        }
+        profile->stages.push_back({name, 0.0, 0.0, 0.0});
+    }
+    auto& stage = profile->stages[profile->next++];
+    stage.seconds += std::chrono::duration<double>(end - start).count();
+    stage.flops += flops;
+    stage.bytes += bytes;
+}
+
+#ifdef USE_BLAS
+// Helpers for --inference-threads. The search threads (-t) each evaluate
+// their own positions; with more than one inference thread the caller
+// also hands parts of every Winograd convolution to these workers. The
+// int8 tower and the heads run on the caller alone. Every part is
+// computed the same way whatever the split, so the results don't depend
+// on the thread count.
+static Utils::ThreadPool inference_pool;
+static auto inference_pool_size = 0;
+
+// Splits [0, count) into one contiguous range per inference thread and
+// calls f(first, last) on each. The caller does the first range itself.
+// The workers must not use the thread_local workspace.
+template <typename F>
+static void parallel_for(const int count, F&& f) {
+    const auto threads = std::min(cfg_inference_threads, count);
+    if (threads <= 1) {
+        f(0, count);
+        return;
+    }
+    const auto chunk = (count + threads - 1) / threads;
+    ThreadGroup tg(inference_pool);
+    for (auto first = chunk; first < count; first += chunk) {
+        const auto last = std::min(first + chunk, count);
+        tg.add_task([&f, first, last]() { f(first, last); });
+    }
+    f(0, chunk);
+    tg.wait_all();
+}
+#endif
+
+void Network::set_inference_threads(const int threads) {
+    cfg_inference_threads = threads;
+#ifdef USE_BLAS
+    // The caller does a part of the work itself.
+    if (threads - 1 > inference_pool_size) {
+        inference_pool.initialize(threads - 1 - inference_pool_size);
+        inference_pool_size = threads - 1;
+    }
+#endif
+}
+
+// Runs the evaluations on this thread and prints where their time went.
+static void benchmark_profile(const GameState* const state,
+                              const int iterations) {
+    const auto batch_size = std::max(cfg_batch_size, 1);
+    const auto batch = std::vector<const GameState*>(batch_size, state);
+    auto profile = Profile{};
+    workspace.profile = &profile;
+    auto runcount = 0;
+    const Time start;
+    while (runcount < iterations) {
+        runcount += batch_size;
+        Network::get_scored_moves_batch(batch,
+                                        Network::Ensemble::RANDOM_SYMMETRY,
+                                        -1, true);
+    }
+    const Time end;
+    workspace.profile = nullptr;
+
+    const auto elapsed = Time::timediff_seconds(start, end);
+    myprintf("%5d evaluations in %5.2f seconds -> %d n/s, batch size %d\n",
+             runcount, elapsed, int(runcount / elapsed), batch_size);
+    myprintf("%-28s %9s %6s %8s %8s\n",
+             "stage", "ms/eval", "%", "GFLOPS", "GB/s");
+    auto total = Profile::Stage{"total", 0.0, 0.0, 0.0};
+    for (const auto& stage : profile.stages) {
+        total.seconds += stage.seconds;
+        total.flops += stage.flops;
+        total.bytes += stage.bytes;
+    }
+    profile.stages.push_back(total);
+    for (const auto& stage : profile.stages) {
+        myprintf("%-28s %9.4f %6.2f", stage.name.c_str(),
+                 1000.0 * stage.seconds / runcount,
+                 100.0 * stage.seconds / total.seconds);
+        // Stages that don't count their work only have a time.
+        if (stage.flops > 0.0) {
+            myprintf(" %8.2f %8.2f", stage.flops / stage.seconds * 1e-9,
+                     stage.bytes / stage.seconds * 1e-9);
+        }
+        myprintf("\n");
+    }
+}
+
+void Network::benchmark(const GameState* const state, const int iterations,
+                        const bool profile) {
+    if (profile) {
+        benchmark_profile(state, iterations);
+        return;
+    }
     const auto cpus = cfg_num_threads;
     const Time start;
 
@@ -102,6 +326,16 @@ void Network::benchmark(const GameState* const state, const int iterations) {
 
     for (auto i = 0; i < cpus; i++) {
         tg.add_task([&runcount, iterations, state]() {
+            if (cfg_batch_size > 1) {
+                const auto batch = std::vector<const GameState*>(
+                    cfg_batch_size, state);
+                while (runcount < iterations) {
+                    runcount += cfg_batch_size;
+                    get_scored_moves_batch(batch, Ensemble::RANDOM_SYMMETRY,
+                                           -1, true);
+                }
+                return;
+            }
             while (runcount < iterations) {
                 runcount++;
                 get_scored_moves(state, Ensemble::RANDOM_SYMMETRY, -1, true);
@@ -165,7 +399,7 @@ std::vector<float> Network::winograd_transform_f(const std::vector<float>& f,
     return U;
 }
 
-std::vector<float> Network::zeropad_U(const std::vector<float>& U,
+std::vector<float> Network::zeropad_U(const float* const U,
                                       const int outputs, const int channels,
                                       const int outputs_pad,
                                       const int channels_pad) {
@@ -348,21 +582,134 @@ std::pair<int, int> Network::load_network_file(const std::string& filename) {
     return {0, 0};
 }
 
-void Network::initialize() {
-    // Prepare symmetry table
-    for (auto s = 0; s < 8; s++) {
-        for (auto v = 0; v < BOARD_SQUARES; v++) {
-            symmetry_nn_idx_table[s][v] = get_nn_idx_symmetry(v, s);
+// Packed weights files hold, for every convolution, the Winograd
+// transformed weights, the batchnorm means with the bias folded in, the
+// stddivs and the 3x3 weights before the transform. Then the heads.
+static constexpr auto PACKED_TENSORS_PER_CONV = size_t{4};
+
+static std::vector<std::pair<float*, size_t>> packed_head_tensors() {
+    auto tensors = std::vector<std::pair<float*, size_t>>{};
+    const auto add = [&tensors](float* const data, const size_t size) {
+        tensors.emplace_back(data, size);
+    };
+    add(conv_pol_w.data(), conv_pol_w.size());
+    add(bn_pol_w1.data(), bn_pol_w1.size());
+    add(bn_pol_w2.data(), bn_pol_w2.size());
+    add(ip_pol_w.data(), ip_pol_w.size());
+    add(ip_pol_b.data(), ip_pol_b.size());
+    add(conv_val_w.data(), conv_val_w.size());
+    add(bn_val_w1.data(), bn_val_w1.size());
+    add(bn_val_w2.data(), bn_val_w2.size());
+    add(ip1_val_w.data(), ip1_val_w.size());
+    add(ip1_val_b.data(), ip1_val_b.size());
+    add(ip2_val_w.data(), ip2_val_w.size());
+    add(ip2_val_b.data(), ip2_val_b.size());
+    return tensors;
+}
+
+std::pair<int, int> Network::load_packed_network(
+    const std::string& filename,
+    std::vector<std::vector<float>>* const weights_3x3) {
+
+    if (!packed_weights.open(filename)) {
+        return {0, 0};
+    }
+    const auto& header = packed_weights.header();
+    if (header.board_size != BOARD_SIZE
+        || header.input_channels != INPUT_CHANNELS) {
+        myprintf("Packed weights are for a different board size.\n");
+        return {0, 0};
+    }
+    const auto channels = size_t{header.channels};
+    const auto residual_blocks = size_t{header.residual_blocks};
+    value_head_not_stm = header.value_head_not_stm != 0;
+    myprintf("Packed weights: v%d, %d channels, %d blocks.\n",
+             value_head_not_stm ? 2 : 1, channels, residual_blocks);
+
+    const auto layers = 1 + 2 * residual_blocks;
+    conv_pol_w.resize(OUTPUTS_POLICY * channels);
+    conv_val_w.resize(OUTPUTS_VALUE * channels);
+    const auto heads = packed_head_tensors();
+    if (header.tensor_count != layers * PACKED_TENSORS_PER_CONV
+                               + heads.size()) {
+        myprintf("Packed weights file has the wrong number of tensors.\n");
+        return {0, 0};
+    }
+    auto index = size_t{0};
+    // Takes the next tensor, which must have size floats.
+    const auto next = [&index](const size_t size) {
+        const auto tensor = packed_weights.tensor(index++);
+        return tensor.second == size ? tensor.first : nullptr;
+    };
+    const auto read = [&next](const size_t size) {
+        const auto data = next(size);
+        return data ? std::vector<float>(data, data + size)
+                    : std::vector<float>{};
+    };
+
+    // The biases stay zero as they were folded into the batchnorm.
+    // The Winograd weights aren't copied, they are used from the mapping
+    // so every process that loads the file shares them.
+    auto valid = true;
+    for (auto i = size_t{0}; i < layers; i++) {
+        const auto inputs = i == 0 ? size_t{INPUT_CHANNELS} : channels;
+        conv_U.emplace_back(next(WINOGRAD_TILE * channels * inputs));
+        conv_biases.emplace_back(channels);
+        batchnorm_means.emplace_back(read(channels));
+        batchnorm_stddivs.emplace_back(read(channels));
+        valid = valid && conv_U.back() && !batchnorm_means.back().empty()
+                && !batchnorm_stddivs.back().empty();
+        // The 3x3 weights that aren't needed are never read in.
+        if (weights_3x3) {
+            weights_3x3->emplace_back(read(9 * channels * inputs));
+            valid = valid && !weights_3x3->back().empty();
+        } else {
+            index++;
+        }
+    }
+    conv_pol_b.assign(OUTPUTS_POLICY, 0.0f);
+    conv_val_b.assign(OUTPUTS_VALUE, 0.0f);
+    for (const auto& head : heads) {
+        const auto data = next(head.second);
+        valid = valid && data;
+        if (data) {
+            std::copy(data, data + head.second, head.first);
         }
     }
+    if (!valid) {
+        myprintf("Packed weights file has a tensor of the wrong size.\n");
+        return {0, 0};
+    }
+    return {channels, residual_blocks};
+}
 
-    // Load network from file
-    size_t channels, residual_blocks;
-    std::tie(channels, residual_blocks) = load_network_file(cfg_weightsfile);
-    if (channels == 0) {
-        exit(EXIT_FAILURE);
+bool Network::write_packed_network(
+    const std::string& filename,
+    const size_t channels, const size_t residual_blocks,
+    const std::vector<std::vector<float>>& weights_3x3) {
+
+    auto tensors = std::vector<PackedWeights::Tensor>{};
+    for (auto i = size_t{0}; i < conv_U.size(); i++) {
+        const auto inputs = i == 0 ? size_t{INPUT_CHANNELS} : channels;
+        tensors.emplace_back(conv_U[i], WINOGRAD_TILE * channels * inputs);
+        tensors.emplace_back(batchnorm_means[i].data(), channels);
+        tensors.emplace_back(batchnorm_stddivs[i].data(), channels);
+        tensors.emplace_back(weights_3x3[i].data(), weights_3x3[i].size());
     }
+    for (const auto& head : packed_head_tensors()) {
+        tensors.emplace_back(head.first, head.second);
+    }
+    auto header = PackedWeights::Header{};
+    header.board_size = BOARD_SIZE;
+    header.input_channels = INPUT_CHANNELS;
+    header.channels = channels;
+    header.residual_blocks = residual_blocks;
+    header.value_head_not_stm = value_head_not_stm;
+    return PackedWeights::write(filename, header, tensors);
+}
 
+void Network::prepare_weights(const size_t channels,
+                              const size_t residual_blocks) {
     auto weight_index = size_t{0};
     // Input convolution
     // Winograd transform convolution weights
@@ -400,6 +747,96 @@ void Network::initialize() {
         conv_pol_b[i] = 0.0f;
     }
 
+    conv_U.clear();
+    for (const auto& U : conv_weights) {
+        conv_U.emplace_back(U.data());
+    }
+}
+
+void Network::initialize() {
+    // Prepare symmetry table
+    for (auto s = 0; s < 8; s++) {
+        for (auto v = 0; v < BOARD_SQUARES; v++) {
+            symmetry_nn_idx_table[s][v] = get_nn_idx_symmetry(v, s);
+            symmetry_nn_idx_inverse[s][symmetry_nn_idx_table[s][v]] = v;
+
+            const auto sym_v = symmetry_nn_idx_table[s][v];
+            const auto vertex = (sym_v / BOARD_SIZE + 1) * (BOARD_SIZE + 2)
+                                + sym_v % BOARD_SIZE + 1;
+            for (auto color : {FastBoard::BLACK, FastBoard::WHITE}) {
+                symmetry_zobrist[s][color][v] =
+                    Zobrist::zobrist[color][vertex]
+                    ^ Zobrist::zobrist[FastBoard::EMPTY][vertex];
+            }
+        }
+    }
+
+    // The 3x3 weights as they are in the file. The int8 tower convolves
+    // with them directly and packed weights keep a copy of them.
+    auto weights_3x3 = std::vector<std::vector<float>>{};
+    auto need_3x3 = !cfg_pack_weights_file.empty();
+#ifdef USE_INT8
+    need_3x3 = need_3x3 || cfg_int8;
+#endif
+
+    // With shared weights, the first process to load a text file packs
+    // it into the shared directory and the later ones map that instead.
+    auto weightsfile = cfg_weightsfile;
+    auto shared_file = std::string{};
+    if (!cfg_shared_weights_dir.empty()
+        && !PackedWeights::is_packed(cfg_weightsfile)) {
+        shared_file = PackedWeights::shared_filename(cfg_shared_weights_dir,
+                                                     cfg_weightsfile);
+        if (PackedWeights::is_packed(shared_file)) {
+            weightsfile = shared_file;
+            shared_file.clear();
+        }
+    }
+
+    // Load network from file. Packed weights are already prepared.
+    size_t channels, residual_blocks;
+    const auto packed = PackedWeights::is_packed(weightsfile);
+    if (packed) {
+        std::tie(channels, residual_blocks) = load_packed_network(
+            weightsfile, need_3x3 ? &weights_3x3 : nullptr);
+    } else {
+        std::tie(channels, residual_blocks) =
+            load_network_file(weightsfile);
+    }
+    if (channels == 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (!packed) {
+        if (need_3x3 || !shared_file.empty()) {
+            weights_3x3 = conv_weights;
+        }
+        prepare_weights(channels, residual_blocks);
+    }
+    if (!shared_file.empty()
+        && write_packed_network(shared_file, channels, residual_blocks,
+                                weights_3x3)) {
+        myprintf("Wrote shared packed weights to %s.\n",
+                 shared_file.c_str());
+    }
+
+    if (!cfg_pack_weights_file.empty()) {
+        if (!write_packed_network(cfg_pack_weights_file,
+                                  channels, residual_blocks, weights_3x3)) {
+            exit(EXIT_FAILURE);
+        }
+        myprintf("Wrote packed weights to %s.\n",
+                 cfg_pack_weights_file.c_str());
+        exit(EXIT_SUCCESS);
+    }
+
+#ifdef USE_INT8
+    for (auto i = size_t{0}; cfg_int8 && i < weights_3x3.size(); i++) {
+        const auto inputs = i == 0 ? size_t{INPUT_CHANNELS} : channels;
+        int8_net.push_convolution(inputs, channels, weights_3x3[i],
+                                  batchnorm_means[i], batchnorm_stddivs[i]);
+    }
+#endif
+
 #ifdef USE_OPENCL
     myprintf("Initializing OpenCL.\n");
     opencl.initialize(channels);
@@ -411,12 +848,12 @@ void Network::initialize() {
         const auto kwg = tuners[2];
         const auto vwm = tuners[3];
 
-        weight_index = 0;
+        auto weight_index = size_t{0};
 
         const auto m_ceil = ceilMultiple(ceilMultiple(channels, mwg), vwm);
         const auto k_ceil = ceilMultiple(ceilMultiple(INPUT_CHANNELS, kwg), vwm);
 
-        const auto Upad = zeropad_U(conv_weights[weight_index],
+        const auto Upad = zeropad_U(conv_U[weight_index],
                                     channels, INPUT_CHANNELS,
                                     m_ceil, k_ceil);
 
@@ -428,10 +865,10 @@ void Network::initialize() {
 
         // residual blocks
         for (auto i = size_t{0}; i < residual_blocks; i++) {
-            const auto Upad1 = zeropad_U(conv_weights[weight_index],
+            const auto Upad1 = zeropad_U(conv_U[weight_index],
                                          channels, channels,
                                          m_ceil, m_ceil);
-            const auto Upad2 = zeropad_U(conv_weights[weight_index + 1],
+            const auto Upad2 = zeropad_U(conv_U[weight_index + 1],
                                          channels, channels,
                                          m_ceil, m_ceil);
             opencl_net->push_residual(WINOGRAD_ALPHA, channels, channels,
@@ -450,6 +887,8 @@ void Network::initialize() {
     }
 #endif
 #ifdef USE_BLAS
+    // The inference threads split the work, so BLAS itself stays serial.
+    set_inference_threads(cfg_inference_threads);
 #ifndef __APPLE__
 #ifdef USE_OPENBLAS
     openblas_set_num_threads(1);
@@ -463,17 +902,86 @@ void Network::initialize() {
     myprintf("BLAS core: MKL %s\n", Version.Processor);
 #endif
 #endif
+#ifdef USE_WINOGRAD_SIMD
+    const auto cpu = detect_cpu_features();
+    if (cpu.avx512) {
+        winograd_isa = WinogradSimd::Isa::AVX512;
+        myprintf("Winograd transforms: AVX-512\n");
+    } else if (cpu.avx2) {
+        winograd_isa = WinogradSimd::Isa::AVX2;
+        myprintf("Winograd transforms: AVX2\n");
+    }
+#endif
+#ifdef USE_INT8
+    if (cfg_int8) {
+#ifdef USE_INT8_SIMD
+        const auto cpu = detect_cpu_features();
+        if (cpu.avx512_vnni) {
+            int8_net.set_isa(Int8Simd::Isa::AVX512_VNNI);
+        } else if (cpu.avx2) {
+            int8_net.set_isa(Int8Simd::Isa::AVX2);
+        }
+#endif
+        myprintf("Calibrating int8 tower on %d positions.\n",
+                 INT8_CALIBRATION_POSITIONS);
+        calibrate_int8();
+        use_int8 = true;
+    }
+#endif
 #endif
 }
 
+std::uint64_t Network::get_weights_hash() {
+    // FNV-1a over 32-bit words
+    auto hash = std::uint64_t{0xcbf29ce484222325};
+    const auto mix = [&hash](const float* const data, const size_t size) {
+        for (auto i = size_t{0}; i < size; i++) {
+            auto bits = std::uint32_t{};
+            std::memcpy(&bits, &data[i], sizeof(bits));
+            hash = (hash ^ bits) * 0x100000001b3;
+        }
+    };
+
+    for (auto i = size_t{0}; i < conv_U.size(); i++) {
+        const auto outputs = conv_biases[i].size();
+        const auto inputs = i == 0 ? size_t{INPUT_CHANNELS} : outputs;
+        mix(conv_U[i], WINOGRAD_TILE * outputs * inputs);
+        mix(batchnorm_means[i].data(), batchnorm_means[i].size());
+        mix(batchnorm_stddivs[i].data(), batchnorm_stddivs[i].size());
+    }
+    mix(conv_pol_w.data(), conv_pol_w.size());
+    mix(bn_pol_w1.data(), bn_pol_w1.size());
+    mix(bn_pol_w2.data(), bn_pol_w2.size());
+    mix(ip_pol_w.data(), ip_pol_w.size());
+    mix(ip_pol_b.data(), ip_pol_b.size());
+    mix(conv_val_w.data(), conv_val_w.size());
+    mix(bn_val_w1.data(), bn_val_w1.size());
+    mix(bn_val_w2.data(), bn_val_w2.size());
+    mix(ip1_val_w.data(), ip1_val_w.size());
+    mix(ip1_val_b.data(), ip1_val_b.size());
+    mix(ip2_val_w.data(), ip2_val_w.size());
+    mix(ip2_val_b.data(), ip2_val_b.size());
+
+    auto flags = std::vector<float>{cfg_softmax_temp,
+                                    value_head_not_stm ? 1.0f : 0.0f};
+#ifdef USE_INT8
+    flags.emplace_back(use_int8 ? 1.0f : 0.0f);
+#endif
+    mix(flags.data(), flags.size());
+    return hash;
+}
+
 #ifdef USE_BLAS
-void Network::winograd_transform_in(const std::vector<float>& in,
-                                    std::vector<float>& V,
-                                    const int C) {
+// Transforms one plane of the input into the tiles for channel c
+// of V. offset is where the tiles of the plane's board start.
+static void winograd_transform_in_plane(const float* const plane,
+                                        float* const V,
+                                        const int C, const int BP,
+                                        const int c, const int offset) {
     constexpr auto W = BOARD_SIZE;
     constexpr auto H = BOARD_SIZE;
     constexpr auto WTILES = (W + 1) / 2;
-    constexpr auto P = WTILES * WTILES;
+    constexpr auto WINOGRAD_ALPHA = Network::WINOGRAD_ALPHA;
 
     std::array<std::array<float, WTILES * 2 + 2>, WTILES * 2 + 2> in_pad;
     for (auto xin = size_t{0}; xin < in_pad.size(); xin++) {
@@ -487,117 +995,175 @@ void Network::winograd_transform_in(const std::vector<float>& in,
         in_pad[yin][W + 2] = 0.0f;
     }
 
-    for (auto ch = 0; ch < C; ch++) {
-        for (auto yin = 0; yin < H; yin++) {
-            for (auto xin = 0; xin < W; xin++) {
-                in_pad[yin + 1][xin + 1] = in[ch*(W*H) + yin*W + xin];
-            }
+    for (auto yin = 0; yin < H; yin++) {
+        for (auto xin = 0; xin < W; xin++) {
+            in_pad[yin + 1][xin + 1] = plane[yin*W + xin];
         }
-        for (auto block_y = 0; block_y < WTILES; block_y++) {
-            // Tiles overlap by 2
-            const auto yin = 2 * block_y;
-            for (auto block_x = 0; block_x < WTILES; block_x++) {
-                const auto xin = 2 * block_x;
-
-                // Calculates transpose(B).x.B
-                // B = [[ 1.0,  0.0,  0.0,  0.0],
-                //      [ 0.0,  1.0, -1.0,  1.0],
-                //      [-1.0,  1.0,  1.0,  0.0],
-                //      [ 0.0,  0.0,  0.0, -1.0]]
-
-                using WinogradTile =
-                    std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
-                WinogradTile T1, T2;
-
-                T1[0][0] = in_pad[yin + 0][xin + 0] - in_pad[yin + 2][xin + 0];
-                T1[0][1] = in_pad[yin + 0][xin + 1] - in_pad[yin + 2][xin + 1];
-                T1[0][2] = in_pad[yin + 0][xin + 2] - in_pad[yin + 2][xin + 2];
-                T1[0][3] = in_pad[yin + 0][xin + 3] - in_pad[yin + 2][xin + 3];
-                T1[1][0] = in_pad[yin + 1][xin + 0] + in_pad[yin + 2][xin + 0];
-                T1[1][1] = in_pad[yin + 1][xin + 1] + in_pad[yin + 2][xin + 1];
-                T1[1][2] = in_pad[yin + 1][xin + 2] + in_pad[yin + 2][xin + 2];
-                T1[1][3] = in_pad[yin + 1][xin + 3] + in_pad[yin + 2][xin + 3];
-                T1[2][0] = in_pad[yin + 2][xin + 0] - in_pad[yin + 1][xin + 0];
-                T1[2][1] = in_pad[yin + 2][xin + 1] - in_pad[yin + 1][xin + 1];
-                T1[2][2] = in_pad[yin + 2][xin + 2] - in_pad[yin + 1][xin + 2];
-                T1[2][3] = in_pad[yin + 2][xin + 3] - in_pad[yin + 1][xin + 3];
-                T1[3][0] = in_pad[yin + 1][xin + 0] - in_pad[yin + 3][xin + 0];
-                T1[3][1] = in_pad[yin + 1][xin + 1] - in_pad[yin + 3][xin + 1];
-                T1[3][2] = in_pad[yin + 1][xin + 2] - in_pad[yin + 3][xin + 2];
-                T1[3][3] = in_pad[yin + 1][xin + 3] - in_pad[yin + 3][xin + 3];
-
-                T2[0][0] = T1[0][0] - T1[0][2];
-                T2[0][1] = T1[0][1] + T1[0][2];
-                T2[0][2] = T1[0][2] - T1[0][1];
-                T2[0][3] = T1[0][1] - T1[0][3];
-                T2[1][0] = T1[1][0] - T1[1][2];
-                T2[1][1] = T1[1][1] + T1[1][2];
-                T2[1][2] = T1[1][2] - T1[1][1];
-                T2[1][3] = T1[1][1] - T1[1][3];
-                T2[2][0] = T1[2][0] - T1[2][2];
-                T2[2][1] = T1[2][1] + T1[2][2];
-                T2[2][2] = T1[2][2] - T1[2][1];
-                T2[2][3] = T1[2][1] - T1[2][3];
-                T2[3][0] = T1[3][0] - T1[3][2];
-                T2[3][1] = T1[3][1] + T1[3][2];
-                T2[3][2] = T1[3][2] - T1[3][1];
-                T2[3][3] = T1[3][1] - T1[3][3];
-
-                const auto offset = ch * P + block_y * WTILES + block_x;
-                for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
-                    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
-                        V[(i*WINOGRAD_ALPHA + j)*C*P + offset] = T2[i][j];
-                    }
+    }
+    for (auto block_y = 0; block_y < WTILES; block_y++) {
+        // Tiles overlap by 2
+        const auto yin = 2 * block_y;
+        for (auto block_x = 0; block_x < WTILES; block_x++) {
+            const auto xin = 2 * block_x;
+
+            // Calculates transpose(B).x.B
+            // B = [[ 1.0,  0.0,  0.0,  0.0],
+            //      [ 0.0,  1.0, -1.0,  1.0],
+            //      [-1.0,  1.0,  1.0,  0.0],
+            //      [ 0.0,  0.0,  0.0, -1.0]]
+
+            using WinogradTile =
+                std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
+            WinogradTile T1, T2;
+
+            T1[0][0] = in_pad[yin + 0][xin + 0] - in_pad[yin + 2][xin + 0];
+            T1[0][1] = in_pad[yin + 0][xin + 1] - in_pad[yin + 2][xin + 1];
+            T1[0][2] = in_pad[yin + 0][xin + 2] - in_pad[yin + 2][xin + 2];
+            T1[0][3] = in_pad[yin + 0][xin + 3] - in_pad[yin + 2][xin + 3];
+            T1[1][0] = in_pad[yin + 1][xin + 0] + in_pad[yin + 2][xin + 0];
+            T1[1][1] = in_pad[yin + 1][xin + 1] + in_pad[yin + 2][xin + 1];
+            T1[1][2] = in_pad[yin + 1][xin + 2] + in_pad[yin + 2][xin + 2];
+            T1[1][3] = in_pad[yin + 1][xin + 3] + in_pad[yin + 2][xin + 3];
+            T1[2][0] = in_pad[yin + 2][xin + 0] - in_pad[yin + 1][xin + 0];
+            T1[2][1] = in_pad[yin + 2][xin + 1] - in_pad[yin + 1][xin + 1];
+            T1[2][2] = in_pad[yin + 2][xin + 2] - in_pad[yin + 1][xin + 2];
+            T1[2][3] = in_pad[yin + 2][xin + 3] - in_pad[yin + 1][xin + 3];
+            T1[3][0] = in_pad[yin + 1][xin + 0] - in_pad[yin + 3][xin + 0];
+            T1[3][1] = in_pad[yin + 1][xin + 1] - in_pad[yin + 3][xin + 1];
+            T1[3][2] = in_pad[yin + 1][xin + 2] - in_pad[yin + 3][xin + 2];
+            T1[3][3] = in_pad[yin + 1][xin + 3] - in_pad[yin + 3][xin + 3];
+
+            T2[0][0] = T1[0][0] - T1[0][2];
+            T2[0][1] = T1[0][1] + T1[0][2];
+            T2[0][2] = T1[0][2] - T1[0][1];
+            T2[0][3] = T1[0][1] - T1[0][3];
+            T2[1][0] = T1[1][0] - T1[1][2];
+            T2[1][1] = T1[1][1] + T1[1][2];
+            T2[1][2] = T1[1][2] - T1[1][1];
+            T2[1][3] = T1[1][1] - T1[1][3];
+            T2[2][0] = T1[2][0] - T1[2][2];
+            T2[2][1] = T1[2][1] + T1[2][2];
+            T2[2][2] = T1[2][2] - T1[2][1];
+            T2[2][3] = T1[2][1] - T1[2][3];
+            T2[3][0] = T1[3][0] - T1[3][2];
+            T2[3][1] = T1[3][1] + T1[3][2];
+            T2[3][2] = T1[3][2] - T1[3][1];
+            T2[3][3] = T1[3][1] - T1[3][3];
+
+            const auto tile = c * BP + offset + block_y * WTILES + block_x;
+            for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+                for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                    V[(i*WINOGRAD_ALPHA + j)*C*BP + tile] = T2[i][j];
                 }
             }
         }
     }
 }
 
-void Network::winograd_sgemm(const std::vector<float>& U,
+void WinogradSimd::transform_in_scalar(const float* const in, float* const V,
+                                       const int C, const int batch_size,
+                                       const int first, const int last) {
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+    constexpr auto WTILES = (W + 1) / 2;
+    constexpr auto P = WTILES * WTILES;
+    // The tiles of all boards in the batch are laid out next to each other,
+    // so a single sgemm per Winograd element covers the whole batch.
+    const auto BP = batch_size * P;
+
+    for (auto ch = first; ch < last; ch++) {
+        const auto batch = ch / C;
+        const auto c = ch % C;
+        winograd_transform_in_plane(&in[ch * (W*H)], V,
+                                    C, BP, c, batch * P);
+    }
+}
+
+void Network::winograd_transform_in(const std::vector<float>& in,
+                                    std::vector<float>& V,
+                                    const int C,
+                                    const int first, const int last,
+                                    const int batch_size) {
+#ifdef USE_WINOGRAD_SIMD
+    if (winograd_isa == WinogradSimd::Isa::AVX512) {
+        WinogradSimd::transform_in_avx512(in.data(), V.data(), C, batch_size,
+                                          first, last);
+        return;
+    } else if (winograd_isa == WinogradSimd::Isa::AVX2) {
+        WinogradSimd::transform_in_avx2(in.data(), V.data(), C, batch_size,
+                                        first, last);
+        return;
+    }
+#endif
+    WinogradSimd::transform_in_scalar(in.data(), V.data(), C, batch_size,
+                                      first, last);
+}
+
+void Network::winograd_sgemm(const float* const U,
                              const std::vector<float>& V,
                              std::vector<float>& M,
-                             const int C, const int K) {
+                             const int C, const int K,
+                             const int first, const int last,
+                             const int batch_size) {
     constexpr auto P = (BOARD_SIZE + 1) * (BOARD_SIZE + 1) / WINOGRAD_ALPHA;
+    const auto BP = batch_size * P;
 
     for (auto b = 0; b < WINOGRAD_TILE; b++) {
-        const auto offset_u = b * K * C;
-        const auto offset_v = b * C * P;
-        const auto offset_m = b * K * P;
+        const auto offset_u = b * K * C + first;
+        const auto offset_v = b * C * BP;
+        const auto offset_m = b * K * BP + first * BP;
 
         cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
-                    K, P, C,
+                    last - first, BP, C,
                     1.0f,
-                    &U[offset_u], K,
-                    &V[offset_v], P,
+                    U + offset_u, K,
+                    &V[offset_v], BP,
                     0.0f,
-                    &M[offset_m], P);
+                    &M[offset_m], BP);
     }
 }
 
-void Network::winograd_transform_out(const std::vector<float>& M,
-                                     std::vector<float>& Y,
-                                     const int K) {
+void WinogradSimd::transform_out_scalar(const float* const M, float* const Y,
+                                        const int K, const int batch_size,
+                                        const int first, const int last,
+                                        const float* const means,
+                                        const float* const stddivs,
+                                        const float* const eltwise,
+                                        float* const V_next) {
     constexpr auto W = BOARD_SIZE;
     constexpr auto H = BOARD_SIZE;
     constexpr auto WTILES = (W + 1) / 2;
     constexpr auto P = WTILES * WTILES;
-
-    for (auto k = 0; k < K; k++) {
-        const auto kHW = k * W * H;
+    constexpr auto WINOGRAD_ALPHA = Network::WINOGRAD_ALPHA;
+    const auto BP = batch_size * P;
+
+    for (auto bk = first; bk < last; bk++) {
+        const auto batch = bk / K;
+        const auto k = bk % K;
+        const auto kHW = bk * W * H;
+        const auto mean = means[k];
+        const auto scale_stddiv = stddivs[k];
+        // Batchnorm, the residual if any, and ReLU
+        const auto bn = [&](const float val, const int idx) {
+            auto out = scale_stddiv * (val - mean);
+            if (eltwise) {
+                out += eltwise[idx];
+            }
+            return out > 0.0f ? out : 0.0f;
+        };
         for (auto block_x = 0; block_x < WTILES; block_x++) {
             const auto x = 2 * block_x;
             for (auto block_y = 0; block_y < WTILES; block_y++) {
                 const auto y = 2 * block_y;
 
-                const auto b = block_y * WTILES + block_x;
+                const auto b = batch * P + block_y * WTILES + block_x;
                 using WinogradTile =
                     std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
                 WinogradTile temp_m;
                 for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) {
                     for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
                         temp_m[xi][nu] =
-                            M[xi*(WINOGRAD_ALPHA*K*P) + nu*(K*P)+ k*P + b];
+                            M[xi*(WINOGRAD_ALPHA*K*BP) + nu*(K*BP)+ k*BP + b];
                     }
                 }
 
@@ -623,34 +1189,97 @@ void Network::winograd_transform_out(const std::vector<float>& M,
                 };
 
                 const auto y_ind = kHW + (y)*W + (x);
-                Y[y_ind] = o[0][0];
+                Y[y_ind] = bn(o[0][0], y_ind);
                 if (x + 1 < W) {
-                    Y[y_ind + 1] = o[0][1];
+                    Y[y_ind + 1] = bn(o[0][1], y_ind + 1);
                 }
                 if (y + 1 < H) {
-                    Y[y_ind + W] = o[1][0];
+                    Y[y_ind + W] = bn(o[1][0], y_ind + W);
                     if (x + 1 < W) {
-                        Y[y_ind + W + 1] = o[1][1];
+                        Y[y_ind + W + 1] = bn(o[1][1], y_ind + W + 1);
                     }
                 }
             }
         }
+
+        // The plane is still in cache, turn it into the tiles the next
+        // convolution takes as input.
+        if (V_next) {
+            winograd_transform_in_plane(&Y[kHW], V_next,
+                                        K, BP, k, batch * P);
+        }
     }
 }
 
+void Network::winograd_transform_out(const std::vector<float>& M,
+                                     std::vector<float>& Y,
+                                     const int K,
+                                     const float* const means,
+                                     const float* const stddivs,
+                                     const float* const eltwise,
+                                     std::vector<float>* const V_next,
+                                     const int first, const int last,
+                                     const int batch_size) {
+#ifdef USE_WINOGRAD_SIMD
+    if (winograd_isa == WinogradSimd::Isa::AVX512) {
+        WinogradSimd::transform_out_avx512(M.data(), Y.data(), K, batch_size,
+            first, last,
+            means, stddivs, eltwise, V_next ? V_next->data() : nullptr);
+        return;
+    } else if (winograd_isa == WinogradSimd::Isa::AVX2) {
+        WinogradSimd::transform_out_avx2(M.data(), Y.data(), K, batch_size,
+            first, last,
+            means, stddivs, eltwise, V_next ? V_next->data() : nullptr);
+        return;
+    }
+#endif
+    WinogradSimd::transform_out_scalar(M.data(), Y.data(), K, batch_size,
+        first, last,
+        means, stddivs, eltwise, V_next ? V_next->data() : nullptr);
+}
+
 void Network::winograd_convolve3(const int outputs,
-                                 const std::vector<float>& input,
-                                 const std::vector<float>& U,
+                                 const int input_channels,
+                                 const float* const U,
                                  std::vector<float>& V,
                                  std::vector<float>& M,
-                                 std::vector<float>& output) {
-
-    constexpr unsigned int filter_len = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
-    const auto input_channels = U.size() / (outputs * filter_len);
-
-    winograd_transform_in(input, V, input_channels);
-    winograd_sgemm(U, V, M, input_channels, outputs);
-    winograd_transform_out(M, output, outputs);
+                                 std::vector<float>& output,
+                                 const float* const means,
+                                 const float* const stddivs,
+                                 const float* const eltwise,
+                                 const bool transform_next,
+                                 const int batch_size) {
+    constexpr auto P = (BOARD_SIZE + 1) * (BOARD_SIZE + 1) / WINOGRAD_ALPHA;
+    const auto C = double(input_channels);
+    const auto K = double(outputs);
+    const auto BP = double(batch_size * P);
+    const auto planes = K * batch_size * BOARD_SQUARES;
+
+    profile_stage("sgemm", 2.0 * WINOGRAD_TILE * K * C * BP,
+                  sizeof(float) * WINOGRAD_TILE * (K * C + C * BP + K * BP),
+                  [&]() {
+        parallel_for(outputs, [&](const int first, const int last) {
+            winograd_sgemm(U, V, M, input_channels, outputs, first, last,
+                           batch_size);
+        });
+    });
+    // V is free again once the sgemm is done.
+    // Every tile takes 32 additions to transform back and 32 more to
+    // transform for the next convolution, and every point 3 or 4
+    // operations for the batchnorm, the residual and ReLU.
+    const auto flops = (transform_next ? 64.0 : 32.0) * K * BP
+                       + (eltwise ? 4.0 : 3.0) * planes;
+    const auto bytes = sizeof(float) * (WINOGRAD_TILE * K * BP
+                                        * (transform_next ? 2.0 : 1.0)
+                                        + planes * (eltwise ? 2.0 : 1.0));
+    profile_stage("transform_out", flops, bytes, [&]() {
+        parallel_for(outputs * batch_size,
+                     [&](const int first, const int last) {
+            winograd_transform_out(M, output, outputs, means, stddivs,
+                                   eltwise, transform_next ? &V : nullptr,
+                                   first, last, batch_size);
+        });
+    });
 }
 
 template<unsigned int filter_size>
@@ -658,7 +1287,8 @@ void convolve(const size_t outputs,
               const std::vector<float>& input,
               const std::vector<float>& weights,
               const std::vector<float>& biases,
-              std::vector<float>& output) {
+              std::vector<float>& output,
+              const size_t batch_size = 1) {
     // The size of the board is defined at compile time
     constexpr unsigned int width = BOARD_SIZE;
     constexpr unsigned int height = BOARD_SIZE;
@@ -666,10 +1296,21 @@ void convolve(const size_t outputs,
     constexpr auto filter_len = filter_size * filter_size;
     const auto input_channels = weights.size() / (biases.size() * filter_len);
     const auto filter_dim = filter_len * input_channels;
-    assert(outputs * board_squares == output.size());
+    assert(outputs * board_squares * batch_size == output.size());
 
-    std::vector<float> col(filter_dim * width * height);
-    im2col<filter_size>(input_channels, input, col);
+    // A 1x1 filter multiplies the input planes as they are.
+    auto& col = workspace.col;
+    if (filter_size != 1) {
+        col.resize(filter_dim * board_squares);
+    }
+    for (auto batch = size_t{0}; batch < batch_size; batch++) {
+        const auto in = &input[batch * input_channels * board_squares];
+        const auto out = &output[batch * outputs * board_squares];
+        auto B = in;
+        if (filter_size != 1) {
+            im2col<filter_size>(input_channels, in, col);
+            B = col.data();
+        }
 
     // Weight shape (output, input, filter_size, filter_size)
     // 96 18 3 3
@@ -683,16 +1324,17 @@ void convolve(const size_t outputs,
     //    cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
     //                ldb, beta, C, N);
 
-    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
-                // M        N            K
-                outputs, board_squares, filter_dim,
-                1.0f, &weights[0], filter_dim,
-                &col[0], board_squares,
-                0.0f, &output[0], board_squares);
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                    // M        N            K
+                    outputs, board_squares, filter_dim,
+                    1.0f, &weights[0], filter_dim,
+                    B, board_squares,
+                    0.0f, out, board_squares);
 
-    for (unsigned int o = 0; o < outputs; o++) {
-        for (unsigned int b = 0; b < board_squares; b++) {
-            output[(o * board_squares) + b] += biases[o];
+        for (unsigned int o = 0; o < outputs; o++) {
+            for (unsigned int b = 0; b < board_squares; b++) {
+                out[(o * board_squares) + b] += biases[o];
+            }
         }
     }
 }
@@ -701,29 +1343,42 @@ template<unsigned int inputs,
          unsigned int outputs,
          bool ReLU,
          size_t W>
-std::vector<float> innerproduct(const std::vector<float>& input,
-                                const std::array<float, W>& weights,
-                                const std::array<float, outputs>& biases) {
-    std::vector<float> output(outputs);
-
-    cblas_sgemv(CblasRowMajor, CblasNoTrans,
-                // M     K
-                outputs, inputs,
-                1.0f, &weights[0], inputs,
-                &input[0], 1,
-                0.0f, &output[0], 1);
+void innerproduct(const std::vector<float>& input,
+                  const std::array<float, W>& weights,
+                  const std::array<float, outputs>& biases,
+                  std::vector<float>& output,
+                  const size_t batch_size = 1) {
+    output.resize(outputs * batch_size);
+
+    if (batch_size == 1) {
+        cblas_sgemv(CblasRowMajor, CblasNoTrans,
+                    // M     K
+                    outputs, inputs,
+                    1.0f, &weights[0], inputs,
+                    &input[0], 1,
+                    0.0f, &output[0], 1);
+    } else {
+        // output[batch, outputs] = input[batch, inputs] x weights^T
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                    // M          N        K
+                    batch_size, outputs, inputs,
+                    1.0f, &input[0], inputs,
+                    &weights[0], inputs,
+                    0.0f, &output[0], outputs);
+    }
 
     const auto lambda_ReLU = [](const auto val) { return (val > 0.0f) ?
                                                           val : 0.0f; };
-    for (unsigned int o = 0; o < outputs; o++) {
-        auto val = biases[o] + output[o];
-        if (ReLU) {
-            val = lambda_ReLU(val);
+    for (auto batch = size_t{0}; batch < batch_size; batch++) {
+        for (unsigned int o = 0; o < outputs; o++) {
+            auto& out = output[batch * outputs + o];
+            auto val = biases[o] + out;
+            if (ReLU) {
+                val = lambda_ReLU(val);
+            }
+            out = val;
         }
-        output[o] = val;
     }
-
-    return output;
 }
 
 template <size_t spatial_size>
@@ -731,24 +1386,27 @@ void batchnorm(const size_t channels,
                std::vector<float>& data,
                const float* const means,
                const float* const stddivs,
-               const float* const eltwise = nullptr)
+               const float* const eltwise = nullptr,
+               const size_t batch_size = 1)
 {
     const auto lambda_ReLU = [](const auto val) { return (val > 0.0f) ?
                                                           val : 0.0f; };
-    for (auto c = size_t{0}; c < channels; ++c) {
+    // Data is laid out as [batch][channels][spatial_size].
+    for (auto bc = size_t{0}; bc < channels * batch_size; ++bc) {
+        const auto c = bc % channels;
         const auto mean = means[c];
         const auto scale_stddiv = stddivs[c];
 
         if (eltwise == nullptr) {
             // Classical BN
-            const auto arr = &data[c * spatial_size];
+            const auto arr = &data[bc * spatial_size];
             for (auto b = size_t{0}; b < spatial_size; b++) {
                 arr[b] = lambda_ReLU(scale_stddiv * (arr[b] - mean));
             }
         } else {
             // BN + residual add
-            const auto arr = &data[c * spatial_size];
-            const auto res = &eltwise[c * spatial_size];
+            const auto arr = &data[bc * spatial_size];
+            const auto res = &eltwise[bc * spatial_size];
             for (auto b = size_t{0}; b < spatial_size; b++) {
                 arr[b] = lambda_ReLU((scale_stddiv * (arr[b] - mean)) + res[b]);
             }
@@ -756,9 +1414,16 @@ void batchnorm(const size_t channels,
     }
 }
 
+#ifdef USE_INT8
+static void update_max(float& max, const std::vector<float>& data) {
+    max = std::max(max, *std::max_element(cbegin(data), cend(data)));
+}
+#endif
+
 void Network::forward_cpu(const std::vector<float>& input,
                           std::vector<float>& output_pol,
-                          std::vector<float>& output_val) {
+                          std::vector<float>& output_val,
+                          const int batch_size) {
     // Input convolution
     constexpr auto width = BOARD_SIZE;
     constexpr auto height = BOARD_SIZE;
@@ -770,42 +1435,145 @@ void Network::forward_cpu(const std::vector<float>& input,
     // might be bigger when the network has very few filters
     const auto input_channels = std::max(static_cast<size_t>(output_channels),
                                          static_cast<size_t>(INPUT_CHANNELS));
-    auto conv_out = std::vector<float>(output_channels * width * height);
-
-    auto V = std::vector<float>(WINOGRAD_TILE * input_channels * tiles);
-    auto M = std::vector<float>(WINOGRAD_TILE * output_channels * tiles);
-
-    winograd_convolve3(output_channels, input, conv_weights[0], V, M, conv_out);
-    batchnorm<BOARD_SQUARES>(output_channels, conv_out,
-                             batchnorm_means[0].data(),
-                             batchnorm_stddivs[0].data());
+    const auto planes = output_channels * width * height * batch_size;
+    auto& conv_out = workspace.conv_out;
+    auto& conv_mid = workspace.conv_mid;
+    auto& res = workspace.res;
+    conv_out.resize(planes);
+    conv_mid.resize(planes);
+    res.resize(planes);
+
+    auto& V = workspace.V;
+    auto& M = workspace.M;
+    V.resize(WINOGRAD_TILE * input_channels * tiles * batch_size);
+    M.resize(WINOGRAD_TILE * output_channels * tiles * batch_size);
+
+    // Every convolution applies batchnorm, the residual and ReLU while
+    // transforming its output, and also leaves the input tiles of the
+    // next convolution in V.
+    const auto has_tower = conv_U.size() > 1;
+    const auto input_planes = double(INPUT_CHANNELS * batch_size);
+    set_profile_layer(0);
+    profile_stage("transform_in", 32.0 * input_planes * tiles,
+                  sizeof(float) * input_planes
+                  * (width * height + WINOGRAD_TILE * tiles), [&]() {
+        parallel_for(INPUT_CHANNELS * batch_size,
+                     [&](const int first, const int last) {
+            winograd_transform_in(input, V, INPUT_CHANNELS, first, last,
+                                  batch_size);
+        });
+    });
+    winograd_convolve3(output_channels, INPUT_CHANNELS, conv_U[0],
+                       V, M, conv_out,
+                       batchnorm_means[0].data(),
+                       batchnorm_stddivs[0].data(),
+                       nullptr, has_tower, batch_size);
+#ifdef USE_INT8
+    const auto conv_max = workspace.conv_max;
+    if (conv_max) {
+        update_max((*conv_max)[0], input);
+        if (has_tower) {
+            update_max((*conv_max)[1], conv_out);
+        }
+    }
+#endif
 
     // Residual tower
-    auto conv_in = std::vector<float>(output_channels * width * height);
-    auto res = std::vector<float>(output_channels * width * height);
-    for (auto i = size_t{1}; i < conv_weights.size(); i += 2) {
+    for (auto i = size_t{1}; i < conv_U.size(); i += 2) {
         auto output_channels = conv_biases[i].size();
-        std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in,
-                           conv_weights[i], V, M, conv_out);
-        batchnorm<BOARD_SQUARES>(output_channels, conv_out,
-                                 batchnorm_means[i].data(),
-                                 batchnorm_stddivs[i].data());
+        // The input of the block is added back at its end.
+        std::swap(conv_out, res);
+        set_profile_layer(i);
+        winograd_convolve3(output_channels, output_channels, conv_U[i],
+                           V, M, conv_mid,
+                           batchnorm_means[i].data(),
+                           batchnorm_stddivs[i].data(),
+                           nullptr, true, batch_size);
 
         output_channels = conv_biases[i + 1].size();
-        std::swap(conv_in, res);
-        std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in,
-                           conv_weights[i + 1], V, M, conv_out);
-        batchnorm<BOARD_SQUARES>(output_channels, conv_out,
-                                 batchnorm_means[i + 1].data(),
-                                 batchnorm_stddivs[i + 1].data(),
-                                 res.data());
-    }
-    convolve<1>(OUTPUTS_POLICY, conv_out, conv_pol_w, conv_pol_b, output_pol);
-    convolve<1>(OUTPUTS_VALUE, conv_out, conv_val_w, conv_val_b, output_val);
+        const auto last = i + 2 >= conv_U.size();
+        set_profile_layer(i + 1);
+        winograd_convolve3(output_channels, output_channels, conv_U[i + 1],
+                           V, M, conv_out,
+                           batchnorm_means[i + 1].data(),
+                           batchnorm_stddivs[i + 1].data(),
+                           res.data(), !last, batch_size);
+#ifdef USE_INT8
+        if (conv_max) {
+            update_max((*conv_max)[i + 1], conv_mid);
+            if (!last) {
+                update_max((*conv_max)[i + 2], conv_out);
+            }
+        }
+#endif
+    }
+    set_profile_layer(-1);
+    const auto tower_out = double(output_channels * BOARD_SQUARES
+                                  * batch_size);
+    profile_stage("policy conv1x1", 2.0 * OUTPUTS_POLICY * tower_out,
+                  sizeof(float) * (1 + OUTPUTS_POLICY) * tower_out, [&]() {
+        convolve<1>(OUTPUTS_POLICY, conv_out, conv_pol_w, conv_pol_b,
+                    output_pol, batch_size);
+    });
+    profile_stage("value conv1x1", 2.0 * OUTPUTS_VALUE * tower_out,
+                  sizeof(float) * (1 + OUTPUTS_VALUE) * tower_out, [&]() {
+        convolve<1>(OUTPUTS_VALUE, conv_out, conv_val_w, conv_val_b,
+                    output_val, batch_size);
+    });
 }
 
+#ifdef USE_INT8
+void Network::forward_int8(const std::vector<float>& input,
+                           std::vector<float>& output_pol,
+                           std::vector<float>& output_val,
+                           const int batch_size) {
+    auto& conv_out = workspace.conv_out;
+    int8_net.forward(input, conv_out, workspace.int8, batch_size);
+    convolve<1>(OUTPUTS_POLICY, conv_out, conv_pol_w, conv_pol_b, output_pol,
+                batch_size);
+    convolve<1>(OUTPUTS_VALUE, conv_out, conv_val_w, conv_val_b, output_val,
+                batch_size);
+}
+
+void Network::calibrate_int8() {
+    auto input_max = std::vector<float>(int8_net.get_layer_count(), 0.0f);
+    workspace.conv_max = &input_max;
+
+    // Play moves drawn from the policy, so the positions look like those
+    // of a game and get past the opening.
+    auto state = GameState{};
+    state.init_game(BOARD_SIZE, 7.5f);
+    auto& rng = Random::get_Rng();
+    for (auto i = 0; i < INT8_CALIBRATION_POSITIONS; i++) {
+        const auto result = get_scored_moves_internal(&state, i % 8);
+
+        const auto to_move = state.get_to_move();
+        auto moves = std::vector<int>{};
+        auto policy = std::vector<float>{};
+        for (auto idx = 0; idx < BOARD_SQUARES; idx++) {
+            const auto x = idx % BOARD_SIZE;
+            const auto y = idx / BOARD_SIZE;
+            const auto vertex = state.board.get_vertex(x, y);
+            if (state.is_move_legal(to_move, vertex)
+                && result.policy[idx] > 0.0f) {
+                moves.emplace_back(vertex);
+                policy.emplace_back(result.policy[idx]);
+            }
+        }
+        if (moves.empty()) {
+            state.init_game(BOARD_SIZE, 7.5f);
+            continue;
+        }
+        auto pick = std::discrete_distribution<size_t>(begin(policy),
+                                                       end(policy));
+        state.play_move(moves[pick(rng)]);
+    }
+
+    workspace.conv_max = nullptr;
+    int8_net.calibrate(input_max);
+}
+#endif
+
 template<typename T>
 T relative_difference(const T a, const T b) {
     // Handle NaN
@@ -847,27 +1615,120 @@ void compare_net_outputs(std::vector<float>& data,
         }
     }
 }
+
+#ifdef USE_INT8
+bool int8_outputs_close(const std::vector<float>& data,
+                        const std::vector<float>& ref) {
+    // Quantization adds some error to every value, so this compares the
+    // relative error of the whole output. A calibrated network stays well
+    // below 25%, a broken kernel does not.
+    constexpr auto relative_error = 0.25;
+    auto err = 0.0;
+    auto norm = 0.0;
+    for (auto idx = size_t{0}; idx < data.size(); ++idx) {
+        const auto diff = double{data[idx]} - double{ref[idx]};
+        err += diff * diff;
+        norm += double{ref[idx]} * double{ref[idx]};
+    }
+    if (err > relative_error * relative_error * norm) {
+        myprintf("Error in int8 calculation: relative error %f%%\n",
+                 std::sqrt(err / norm) * 100.0);
+        return false;
+    }
+    return true;
+}
+#endif
 #endif
 
-std::vector<float> softmax(const std::vector<float>& input,
-                           const float temperature = 1.0f) {
-    auto output = std::vector<float>{};
-    output.reserve(input.size());
+void softmax(const std::vector<float>& input,
+             std::vector<float>& output,
+             const float temperature = 1.0f) {
+    output.resize(input.size());
 
     const auto alpha = *std::max_element(cbegin(input), cend(input));
     auto denom = 0.0f;
 
-    for (const auto in_val : input) {
-        auto val = std::exp((in_val - alpha) / temperature);
+    for (auto i = size_t{0}; i < input.size(); i++) {
+        const auto val = std::exp((input[i] - alpha) / temperature);
         denom += val;
-        output.push_back(val);
+        output[i] = val;
     }
 
     for (auto& out : output) {
         out /= denom;
     }
+}
+
+// Index of the lowest set bit of bits, which must not be 0
+static int lowest_bit(const std::uint64_t bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return index;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// All 8 orientations of a position share this key, the smallest hash of
+// the position seen through each symmetry. Also returns the symmetry that
+// gives it, the cache keeps results in that orientation. The ko point is
+// not turned, so positions with a ko only match themselves.
+static std::pair<std::uint64_t, int> canonical_hash(const FullBoard& board) {
+    auto hashes = std::array<std::uint64_t, 8>{};
+    for (auto color : {FastBoard::BLACK, FastBoard::WHITE}) {
+        const auto& plane = board.get_stone_plane(color);
+        const auto& keys = symmetry_zobrist;
+        for (auto word = 0; word < FastBoard::PLANE_WORDS; word++) {
+            auto bits = plane[word];
+            while (bits) {
+                const auto idx = word * 64 + lowest_bit(bits);
+                for (auto s = 0; s < 8; s++) {
+                    hashes[s] ^= keys[s][color][idx];
+                }
+                bits &= bits - 1;
+            }
+        }
+    }
+    // Symmetry 0 is the identity. What is left of the hash (the empty
+    // board, side to move, ko, prisoners and passes) is the same for all.
+    const auto rest = board.get_hash() ^ hashes[0];
+    auto best = 0;
+    for (auto s = 1; s < 8; s++) {
+        if ((rest ^ hashes[s]) < (rest ^ hashes[best])) {
+            best = s;
+        }
+    }
+    return {rest ^ hashes[best], best};
+}
 
-    return output;
+static bool cache_lookup(const GameState* const state,
+                         Network::Netresult& result) {
+    const auto key = canonical_hash(state->board);
+    auto& stored = workspace.cached;
+    if (!NNCache::get_NNCache().lookup(key.first, stored)) {
+        return false;
+    }
+    const auto& sym_idx = symmetry_nn_idx_table[key.second];
+    for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
+        result.policy[idx] = stored.policy[sym_idx[idx]];
+    }
+    result.policy_pass = stored.policy_pass;
+    result.winrate = stored.winrate;
+    return true;
+}
+
+static void cache_insert(const GameState* const state,
+                         const Network::Netresult& result) {
+    const auto key = canonical_hash(state->board);
+    auto& stored = workspace.cached;
+    const auto& sym_idx = symmetry_nn_idx_table[key.second];
+    for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
+        stored.policy[sym_idx[idx]] = result.policy[idx];
+    }
+    stored.policy_pass = result.policy_pass;
+    stored.winrate = result.winrate;
+    NNCache::get_NNCache().insert(key.first, stored);
 }
 
 Network::Netresult Network::get_scored_moves(
@@ -880,7 +1741,7 @@ Network::Netresult Network::get_scored_moves(
 
     if (!skip_cache) {
         // See if we already have this in the cache.
-        if (NNCache::get_NNCache().lookup(state->board.get_hash(), result)) {
+        if (cache_lookup(state, result)) {
             return result;
         }
     }
@@ -889,15 +1750,7 @@ Network::Netresult Network::get_scored_moves(
         assert(symmetry >= 0 && symmetry <= 7);
         result = get_scored_moves_internal(state, symmetry);
     } else if (ensemble == AVERAGE) {
-        for (auto sym = 0; sym < 8; ++sym) {
-            auto tmpresult = get_scored_moves_internal(state, sym);
-            result.winrate += tmpresult.winrate / 8.0f;
-            result.policy_pass += tmpresult.policy_pass / 8.0f;
-
-            for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
-                result.policy[idx] += tmpresult.policy[idx] / 8.0f;
-            }
-        }
+        result = get_scored_moves_average(state);
     } else {
         assert(ensemble == RANDOM_SYMMETRY);
         assert(symmetry == -1);
@@ -913,34 +1766,200 @@ Network::Netresult Network::get_scored_moves(
     }
 
     // Insert result into cache.
-    NNCache::get_NNCache().insert(state->board.get_hash(), result);
+    cache_insert(state, result);
 
     return result;
 }
 
+std::vector<Network::Netresult> Network::get_scored_moves_batch(
+    const std::vector<const GameState*>& states, const Ensemble ensemble,
+    const int symmetry, const bool skip_cache) {
+    auto results = std::vector<Netresult>(states.size());
+    if (ensemble == AVERAGE) {
+        for (auto i = size_t{0}; i < states.size(); i++) {
+            results[i] = get_scored_moves(states[i], ensemble,
+                                          symmetry, skip_cache);
+        }
+        return results;
+    }
+
+    // Collect the positions that miss the cache and evaluate them
+    // together in a single forward pass.
+    auto pending = std::vector<const GameState*>{};
+    auto pending_idx = std::vector<size_t>{};
+    auto symmetries = std::vector<int>{};
+    for (auto i = size_t{0}; i < states.size(); i++) {
+        const auto state = states[i];
+        if (state->board.get_boardsize() != BOARD_SIZE) {
+            continue;
+        }
+        if (!skip_cache) {
+            if (cache_lookup(state, results[i])) {
+                continue;
+            }
+        }
+        if (ensemble == DIRECT) {
+            assert(symmetry >= 0 && symmetry <= 7);
+            symmetries.emplace_back(symmetry);
+        } else {
+            assert(ensemble == RANDOM_SYMMETRY);
+            assert(symmetry == -1);
+            symmetries.emplace_back(Random::get_Rng().randfix<8>());
+        }
+        pending.emplace_back(state);
+        pending_idx.emplace_back(i);
+    }
+    if (pending.empty()) {
+        return results;
+    }
+
+    auto evaluated = get_scored_moves_internal(pending, symmetries);
+    for (auto j = size_t{0}; j < pending.size(); j++) {
+        const auto state = pending[j];
+        auto& result = evaluated[j];
+
+        // v2 format (ELF Open Go) returns black value, not stm
+        if (value_head_not_stm) {
+            if (state->board.get_to_move() == FastBoard::WHITE) {
+                result.winrate = 1.0f - result.winrate;
+            }
+        }
+
+        // Insert result into cache.
+        cache_insert(state, result);
+        results[pending_idx[j]] = std::move(result);
+    }
+
+    return results;
+}
+
 Network::Netresult Network::get_scored_moves_internal(
     const GameState* const state, const int symmetry) {
-    assert(symmetry >= 0 && symmetry <= 7);
+    return get_scored_moves_internal(std::vector<const GameState*>{state},
+                                     std::vector<int>{symmetry})[0];
+}
+
+std::vector<Network::Netresult> Network::get_scored_moves_internal(
+    const std::vector<const GameState*>& states,
+    const std::vector<int>& symmetries) {
+    assert(states.size() == symmetries.size());
+    constexpr auto input_size = INPUT_CHANNELS * BOARD_SQUARES;
+
+    // Stack the input planes of all positions: [batch][channels][19x19].
+    auto& input_data = workspace.input;
+    input_data.resize(input_size * states.size());
+    for (auto i = size_t{0}; i < states.size(); i++) {
+        assert(symmetries[i] >= 0 && symmetries[i] <= 7);
+        gather_features(states[i], symmetries[i],
+                        begin(input_data) + i * input_size);
+    }
+    return forward_batch(symmetries);
+}
+
+Network::Netresult Network::get_scored_moves_average(
+    const GameState* const state) {
+    constexpr auto input_size = INPUT_CHANNELS * BOARD_SQUARES;
+
+    // The planes are gathered once, the other symmetries are permutations
+    // of them. All 8 are evaluated as one batch.
+    auto& input_data = workspace.input;
+    input_data.resize(8 * input_size);
+    gather_features(state, 0, begin(input_data));
+    for (auto sym = 1; sym < 8; sym++) {
+        const auto& sym_idx = symmetry_nn_idx_table[sym];
+        const auto out = begin(input_data) + sym * input_size;
+        for (auto c = 0; c < INPUT_CHANNELS; c++) {
+            const auto plane = begin(input_data) + c * BOARD_SQUARES;
+            for (auto idx = 0; idx < BOARD_SQUARES; idx++) {
+                out[c * BOARD_SQUARES + idx] = plane[sym_idx[idx]];
+            }
+        }
+    }
+    const auto results = forward_batch({0, 1, 2, 3, 4, 5, 6, 7});
+
+    auto result = Netresult{};
+    for (const auto& sym_result : results) {
+        result.winrate += sym_result.winrate / 8.0f;
+        result.policy_pass += sym_result.policy_pass / 8.0f;
+        for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
+            result.policy[idx] += sym_result.policy[idx] / 8.0f;
+        }
+    }
+    return result;
+}
+
+std::vector<Network::Netresult> Network::forward_batch(
+    const std::vector<int>& symmetries) {
     constexpr auto width = BOARD_SIZE;
     constexpr auto height = BOARD_SIZE;
+    constexpr auto policy_size = OUTPUTS_POLICY * width * height;
+    constexpr auto value_size = OUTPUTS_VALUE * width * height;
+    const auto batch_size = symmetries.size();
+    if (workspace.profile) {
+        workspace.profile->next = 0;
+    }
 
-    const auto input_data = gather_features(state, symmetry);
-    std::vector<float> policy_data(OUTPUTS_POLICY * width * height);
-    std::vector<float> value_data(OUTPUTS_VALUE * width * height);
-#ifdef USE_HALF
-    std::vector<net_t> policy_data_n(OUTPUTS_POLICY * width * height);
-    std::vector<net_t> value_data_n(OUTPUTS_VALUE * width * height);
-#endif
+    const auto& input_data = workspace.input;
+    auto& policy_data = workspace.policy_data;
+    auto& value_data = workspace.value_data;
+    policy_data.resize(policy_size * batch_size);
+    value_data.resize(value_size * batch_size);
 #ifdef USE_OPENCL
-#ifdef USE_HALF
-    opencl.forward(input_data, policy_data_n, value_data_n);
-    std::copy(begin(policy_data_n), end(policy_data_n), begin(policy_data));
-    std::copy(begin(value_data_n), end(value_data_n), begin(value_data));
-#else
-    opencl.forward(input_data, policy_data, value_data);
-#endif
+    // The OpenCL kernels work on one position at a time.
+    constexpr auto input_size = INPUT_CHANNELS * width * height;
+    auto& input_n = workspace.input_n;
+    auto& policy_data_n = workspace.policy_data_n;
+    auto& value_data_n = workspace.value_data_n;
+    input_n.resize(input_size);
+    policy_data_n.resize(policy_size);
+    value_data_n.resize(value_size);
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        std::copy(begin(input_data) + i * input_size,
+                  begin(input_data) + (i + 1) * input_size,
+                  begin(input_n));
+        profile_stage("opencl", 0.0, 0.0, [&]() {
+            opencl.forward(input_n, policy_data_n, value_data_n);
+        });
+        std::copy(begin(policy_data_n), end(policy_data_n),
+                  begin(policy_data) + i * policy_size);
+        std::copy(begin(value_data_n), end(value_data_n),
+                  begin(value_data) + i * value_size);
+    }
 #elif defined(USE_BLAS) && !defined(USE_OPENCL)
-    forward_cpu(input_data, policy_data, value_data);
+#ifdef USE_INT8
+    if (use_int8) {
+        profile_stage("int8 tower", 0.0, 0.0, [&]() {
+            forward_int8(input_data, policy_data, value_data, batch_size);
+        });
+        // Check the int8 tower against the float one with a probability
+        // of 1/2000. A position unlike those of the calibration can be
+        // off without anything being broken, so that evaluation just
+        // uses the float result. Only checks that keep failing turn the
+        // int8 tower off.
+        if (Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0) {
+            auto cpu_policy_data = std::vector<float>(policy_data.size());
+            auto cpu_value_data = std::vector<float>(value_data.size());
+            forward_cpu(input_data, cpu_policy_data, cpu_value_data,
+                        batch_size);
+            if (int8_outputs_close(policy_data, cpu_policy_data)
+                && int8_outputs_close(value_data, cpu_value_data)) {
+                int8_selfcheck_fails = 0;
+            } else {
+                policy_data.swap(cpu_policy_data);
+                value_data.swap(cpu_value_data);
+                if (++int8_selfcheck_fails == INT8_SELFCHECK_FAILS) {
+                    myprintf("int8 self-check failed %d times in a row, "
+                             "using the float network.\n",
+                             INT8_SELFCHECK_FAILS);
+                    use_int8 = false;
+                }
+            }
+        }
+    } else
+#endif
+    {
+        forward_cpu(input_data, policy_data, value_data, batch_size);
+    }
 #endif
 #ifdef USE_OPENCL_SELFCHECK
     // Both implementations are available, self-check the OpenCL driver by
@@ -948,42 +1967,70 @@ Network::Netresult Network::get_scored_moves_internal(
     if (Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0) {
         auto cpu_policy_data = std::vector<float>(policy_data.size());
         auto cpu_value_data = std::vector<float>(value_data.size());
-        forward_cpu(input_data, cpu_policy_data, cpu_value_data);
+        forward_cpu(input_data, cpu_policy_data, cpu_value_data, batch_size);
         compare_net_outputs(policy_data, cpu_policy_data);
         compare_net_outputs(value_data, cpu_value_data);
     }
 #endif
 
     // Get the moves
-    batchnorm<BOARD_SQUARES>(OUTPUTS_POLICY, policy_data,
-        bn_pol_w1.data(), bn_pol_w2.data());
-    const auto policy_out =
-        innerproduct<OUTPUTS_POLICY * BOARD_SQUARES, BOARD_SQUARES + 1, false>(
-            policy_data, ip_pol_w, ip_pol_b);
-    const auto outputs = softmax(policy_out, cfg_softmax_temp);
+    set_profile_layer(-1);
+    auto& policy_out = workspace.policy_out;
+    profile_stage("policy head",
+                  2.0 * ip_pol_w.size() * batch_size
+                  + 3.0 * policy_size * batch_size,
+                  sizeof(float) * (ip_pol_w.size() + (policy_size
+                                   + BOARD_SQUARES + 1) * batch_size),
+                  [&]() {
+        batchnorm<BOARD_SQUARES>(OUTPUTS_POLICY, policy_data,
+            bn_pol_w1.data(), bn_pol_w2.data(), nullptr, batch_size);
+        innerproduct<OUTPUTS_POLICY * BOARD_SQUARES, BOARD_SQUARES + 1,
+                     false>(policy_data, ip_pol_w, ip_pol_b, policy_out,
+                            batch_size);
+    });
 
     // Now get the score
-    batchnorm<BOARD_SQUARES>(OUTPUTS_VALUE, value_data,
-        bn_val_w1.data(), bn_val_w2.data());
-    const auto winrate_data =
-        innerproduct<BOARD_SQUARES, 256, true>(value_data, ip1_val_w, ip1_val_b);
-    const auto winrate_out =
-        innerproduct<256, 1, false>(winrate_data, ip2_val_w, ip2_val_b);
-
-    // Sigmoid
-    const auto winrate_sig = (1.0f + std::tanh(winrate_out[0])) / 2.0f;
-
-    Netresult result;
+    auto& winrate_data = workspace.winrate_data;
+    auto& winrate_out = workspace.winrate_out;
+    profile_stage("value head",
+                  2.0 * (ip1_val_w.size() + ip2_val_w.size()) * batch_size
+                  + 3.0 * value_size * batch_size,
+                  sizeof(float) * (ip1_val_w.size() + ip2_val_w.size()
+                                   + (value_size + 256 + 1) * batch_size),
+                  [&]() {
+        batchnorm<BOARD_SQUARES>(OUTPUTS_VALUE, value_data,
+            bn_val_w1.data(), bn_val_w2.data(), nullptr, batch_size);
+        innerproduct<BOARD_SQUARES, 256, true>(value_data, ip1_val_w,
+                                               ip1_val_b, winrate_data,
+                                               batch_size);
+        innerproduct<256, 1, false>(winrate_data, ip2_val_w, ip2_val_b,
+                                    winrate_out, batch_size);
+    });
+
+    auto results = std::vector<Netresult>(batch_size);
+    auto& policy_in = workspace.policy_in;
+    auto& outputs = workspace.policy_softmax;
+    policy_in.resize(BOARD_SQUARES + 1);
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        std::copy(begin(policy_out) + i * (BOARD_SQUARES + 1),
+                  begin(policy_out) + (i + 1) * (BOARD_SQUARES + 1),
+                  begin(policy_in));
+        softmax(policy_in, outputs, cfg_softmax_temp);
+
+        // Sigmoid
+        const auto winrate_sig = (1.0f + std::tanh(winrate_out[i])) / 2.0f;
+
+        auto& result = results[i];
+        for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
+            const auto sym_idx = symmetry_nn_idx_table[symmetries[i]][idx];
+            result.policy[sym_idx] = outputs[idx];
+        }
 
-    for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        result.policy[sym_idx] = outputs[idx];
+        result.policy_pass = outputs[BOARD_SQUARES];
+        result.winrate = winrate_sig;
     }
 
-    result.policy_pass = outputs[BOARD_SQUARES];
-    result.winrate = winrate_sig;
-
-    return result;
+    return results;
 }
 
 void Network::show_heatmap(const FastState* const state,
@@ -1041,40 +2088,58 @@ void Network::show_heatmap(const FastState* const state,
     }
 }
 
+// Sets the input of every stone in plane, so the work is in the number
+// of stones and not of points. The input must be zero.
+static void expand_stone_plane(const FastBoard::stone_plane_t& plane,
+                               std::vector<net_t>::iterator input,
+                               const std::array<int, BOARD_SQUARES>& sym_idx) {
+    for (auto word = 0; word < FastBoard::PLANE_WORDS; word++) {
+        auto bits = plane[word];
+        while (bits) {
+            input[sym_idx[word * 64 + lowest_bit(bits)]] = net_t(true);
+            bits &= bits - 1;
+        }
+    }
+}
+
 void Network::fill_input_plane_pair(const FullBoard& board,
                                     std::vector<net_t>::iterator black,
                                     std::vector<net_t>::iterator white,
                                     const int symmetry) {
-    for (auto idx = 0; idx < BOARD_SQUARES; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        const auto x = sym_idx % BOARD_SIZE;
-        const auto y = sym_idx / BOARD_SIZE;
-        const auto color = board.get_square(x, y);
-        if (color == FastBoard::BLACK) {
-            black[idx] = net_t(true);
-        } else if (color == FastBoard::WHITE) {
-            white[idx] = net_t(true);
-        }
-    }
+    // The board keeps its stones as bit planes as moves are played.
+    const auto& sym_idx = symmetry_nn_idx_inverse[symmetry];
+    expand_stone_plane(board.get_stone_plane(FastBoard::BLACK), black,
+                       sym_idx);
+    expand_stone_plane(board.get_stone_plane(FastBoard::WHITE), white,
+                       sym_idx);
 }
 
 std::vector<net_t> Network::gather_features(const GameState* const state,
                                             const int symmetry) {
-    assert(symmetry >= 0 && symmetry <= 7);
     auto input_data = std::vector<net_t>(INPUT_CHANNELS * BOARD_SQUARES);
+    gather_features(state, symmetry, begin(input_data));
+    return input_data;
+}
+
+void Network::gather_features(const GameState* const state,
+                              const int symmetry,
+                              const std::vector<net_t>::iterator input_data) {
+    assert(symmetry >= 0 && symmetry <= 7);
+    std::fill(input_data, input_data + INPUT_CHANNELS * BOARD_SQUARES,
+              net_t(false));
 
     const auto to_move = state->get_to_move();
     const auto blacks_move = to_move == FastBoard::BLACK;
 
     const auto black_it = blacks_move ?
-                          begin(input_data) :
-                          begin(input_data) + INPUT_MOVES * BOARD_SQUARES;
+                          input_data :
+                          input_data + INPUT_MOVES * BOARD_SQUARES;
     const auto white_it = blacks_move ?
-                          begin(input_data) + INPUT_MOVES * BOARD_SQUARES :
-                          begin(input_data);
+                          input_data + INPUT_MOVES * BOARD_SQUARES :
+                          input_data;
     const auto to_move_it = blacks_move ?
-        begin(input_data) + 2 * INPUT_MOVES * BOARD_SQUARES :
-        begin(input_data) + (2 * INPUT_MOVES + 1) * BOARD_SQUARES;
+        input_data + 2 * INPUT_MOVES * BOARD_SQUARES :
+        input_data + (2 * INPUT_MOVES + 1) * BOARD_SQUARES;
 
     const auto moves = std::min<size_t>(state->get_movenum() + 1, INPUT_MOVES);
     // Go back in time, fill history boards
@@ -1087,8 +2152,6 @@ std::vector<net_t> Network::gather_features(const GameState* const state,
     }
 
     std::fill(to_move_it, to_move_it + BOARD_SQUARES, net_t(true));
-
-    return input_data;
 }
 
 int Network::get_nn_idx_symmetry(const int vertex, int symmetry) {
@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <array>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
@@ -55,6 +56,11 @@ public:
                                       const Ensemble ensemble,
                                       const int symmetry = -1,
                                       const bool skip_cache = false);
+    static std::vector<Netresult> get_scored_moves_batch(
+        const std::vector<const GameState*>& states,
+        const Ensemble ensemble,
+        const int symmetry = -1,
+        const bool skip_cache = false);
 
     static constexpr auto INPUT_MOVES = 8;
     static constexpr auto INPUT_CHANNELS = 2 * INPUT_MOVES + 2;
@@ -66,39 +72,89 @@ public:
     static constexpr auto WINOGRAD_TILE = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
 
     static void initialize();
+    // Sets --inference-threads and starts the workers it needs. Only the
+    // Winograd convolutions of the float tower are split, not the int8
+    // tower.
+    static void set_inference_threads(int threads);
+    // Identifies the loaded weights, and the settings that change the
+    // results, across runs.
+    static std::uint64_t get_weights_hash();
+    // With profile set, the evaluations run on the calling thread and
+    // the time, GFLOPS and memory bandwidth of every stage are printed.
     static void benchmark(const GameState * const state,
-                          const int iterations = 1600);
+                          const int iterations = 1600,
+                          const bool profile = false);
     static void show_heatmap(const FastState * const state,
                              const Netresult & netres, const bool topmoves);
 
     static std::vector<net_t> gather_features(const GameState* const state,
                                               const int symmetry);
+    // Writes the planes to input_data instead, which must have room for
+    // INPUT_CHANNELS * BOARD_SQUARES values.
+    static void gather_features(const GameState* const state,
+                                const int symmetry,
+                                const std::vector<net_t>::iterator input_data);
 private:
     static std::pair<int, int> load_v1_network(std::istream& wtfile);
     static std::pair<int, int> load_network_file(const std::string& filename);
+    // Loads a file written by write_packed_network. The Winograd weights
+    // stay in the mapped file. weights_3x3 is only filled if given.
+    static std::pair<int, int> load_packed_network(
+        const std::string& filename,
+        std::vector<std::vector<float>>* const weights_3x3);
+    static bool write_packed_network(
+        const std::string& filename,
+        const size_t channels, const size_t residual_blocks,
+        const std::vector<std::vector<float>>& weights_3x3);
+    // Winograd transforms the convolutions and folds the biases into
+    // the batchnorm.
+    static void prepare_weights(const size_t channels,
+                                const size_t residual_blocks);
     static void process_bn_var(std::vector<float>& weights,
                                const float epsilon = 1e-5f);
 
     static std::vector<float> winograd_transform_f(const std::vector<float>& f,
         const int outputs, const int channels);
-    static std::vector<float> zeropad_U(const std::vector<float>& U,
+    static std::vector<float> zeropad_U(const float* const U,
         const int outputs, const int channels,
         const int outputs_pad, const int channels_pad);
+    // The transforms only do the planes first to last - 1 of the batch,
+    // so they can be split over the inference threads.
     static void winograd_transform_in(const std::vector<float>& in,
                                       std::vector<float>& V,
-                                      const int C);
+                                      const int C,
+                                      const int first, const int last,
+                                      const int batch_size = 1);
+    // Also applies batchnorm, adds eltwise if given and does ReLU. If
+    // V_next is given, the output is transformed into it as well.
     static void winograd_transform_out(const std::vector<float>& M,
                                        std::vector<float>& Y,
-                                       const int K);
+                                       const int K,
+                                       const float* const means,
+                                       const float* const stddivs,
+                                       const float* const eltwise,
+                                       std::vector<float>* const V_next,
+                                       const int first, const int last,
+                                       const int batch_size = 1);
+    // V holds the transformed input. With transform_next, it holds the
+    // transformed output afterwards.
     static void winograd_convolve3(const int outputs,
-                                   const std::vector<float>& input,
-                                   const std::vector<float>& U,
+                                   const int input_channels,
+                                   const float* const U,
                                    std::vector<float>& V,
                                    std::vector<float>& M,
-                                   std::vector<float>& output);
-    static void winograd_sgemm(const std::vector<float>& U,
+                                   std::vector<float>& output,
+                                   const float* const means,
+                                   const float* const stddivs,
+                                   const float* const eltwise,
+                                   const bool transform_next,
+                                   const int batch_size = 1);
+    // Only the outputs first to last - 1.
+    static void winograd_sgemm(const float* const U,
                                const std::vector<float>& V,
-                               std::vector<float>& M, const int C, const int K);
+                               std::vector<float>& M, const int C, const int K,
+                               const int first, const int last,
+                               const int batch_size = 1);
     static int get_nn_idx_symmetry(const int vertex, int symmetry);
     static void fill_input_plane_pair(const FullBoard& board,
                                       std::vector<net_t>::iterator black,
@@ -106,11 +162,29 @@ private:
                                       const int symmetry);
     static Netresult get_scored_moves_internal(const GameState* const state,
                                                const int symmetry);
+    static std::vector<Netresult> get_scored_moves_internal(
+        const std::vector<const GameState*>& states,
+        const std::vector<int>& symmetries);
+    // The average over all 8 symmetries
+    static Netresult get_scored_moves_average(const GameState* const state);
+    // Evaluates the input planes stacked in the workspace, one position
+    // for every entry of symmetries, which are turned back in the policy.
+    static std::vector<Netresult> forward_batch(
+        const std::vector<int>& symmetries);
 #if defined(USE_BLAS)
     static void forward_cpu(const std::vector<float>& input,
                             std::vector<float>& output_pol,
-                            std::vector<float>& output_val);
-
+                            std::vector<float>& output_val,
+                            const int batch_size = 1);
+#endif
+#ifdef USE_INT8
+    static void forward_int8(const std::vector<float>& input,
+                             std::vector<float>& output_pol,
+                             std::vector<float>& output_val,
+                             const int batch_size = 1);
+    // Runs positions through forward_cpu to find the input scales of
+    // the int8 tower.
+    static void calibrate_int8();
 #endif
 };
 
@@ -0,0 +1,195 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "NodePool.h"
+
+static size_t size_class(const size_t size, const size_t granularity) {
+    return size == 0 ? 0 : (size - 1) / granularity;
+}
+
+static void* aligned_alloc_bytes(const size_t size, const size_t alignment) {
+#ifdef _WIN32
+    const auto ptr = _aligned_malloc(size, alignment);
+#else
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, alignment, size) != 0) {
+        ptr = nullptr;
+    }
+#endif
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+static void aligned_free_bytes(void* const ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+NodePool::~NodePool() {
+    for (const auto slab : m_slabs) {
+        aligned_free_bytes(slab);
+    }
+    for (const auto slab : m_large) {
+        aligned_free_bytes(slab);
+    }
+}
+
+size_t NodePool::shard_index() {
+    // Threads are spread over the shards in the order they first
+    // allocate. This is only an index, there is nothing to clean up.
+    static std::atomic<size_t> next_index{0};
+    thread_local const auto index = next_index++ % NUM_SHARDS;
+    return index;
+}
+
+NodePool& NodePool::of(const void* const ptr) {
+    const auto slab = reinterpret_cast<std::uintptr_t>(ptr) & ~(SLAB_SIZE - 1);
+    return *reinterpret_cast<const SlabHeader*>(slab)->pool;
+}
+
+size_t NodePool::get_reserved_bytes() const {
+    return m_reserved_bytes.load();
+}
+
+size_t NodePool::get_used_bytes() const {
+    auto used = std::int64_t{0};
+    for (const auto& shard : m_shards) {
+        used += shard.used_bytes.load(std::memory_order_relaxed);
+    }
+    return static_cast<size_t>(std::max(used, std::int64_t{0}));
+}
+
+void* NodePool::allocate(const size_t size) {
+    if (size > MAX_POOLED_SIZE) {
+        return allocate_large(size);
+    }
+    const auto cls = size_class(size, GRANULARITY);
+    const auto index = shard_index();
+    auto& shard = m_shards[index];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.head[cls] == nullptr) {
+        shard.head[cls] = steal(cls, index);
+    }
+    if (shard.head[cls] == nullptr) {
+        shard.head[cls] = carve(cls);
+    }
+    const auto chunk = shard.head[cls];
+    shard.head[cls] = chunk->next;
+    shard.used_bytes.fetch_add((cls + 1) * GRANULARITY,
+                               std::memory_order_relaxed);
+    return chunk;
+}
+
+void NodePool::deallocate(void* const ptr, const size_t size) {
+    auto& pool = of(ptr);
+    if (size > MAX_POOLED_SIZE) {
+        pool.deallocate_large(ptr, size);
+        return;
+    }
+    const auto cls = size_class(size, GRANULARITY);
+    auto& shard = pool.m_shards[shard_index()];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const auto chunk = static_cast<FreeChunk*>(ptr);
+    chunk->next = shard.head[cls];
+    shard.head[cls] = chunk;
+    shard.used_bytes.fetch_sub((cls + 1) * GRANULARITY,
+                               std::memory_order_relaxed);
+}
+
+NodePool::FreeChunk* NodePool::steal(const size_t cls, const size_t own) {
+    // Take what other threads freed before carving new memory, e.g.
+    // when the thread that deleted part of the tree is gone. Shards that
+    // are busy are skipped, our own lock is held.
+    for (auto i = size_t{1}; i < NUM_SHARDS; i++) {
+        auto& shard = m_shards[(own + i) % NUM_SHARDS];
+        std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+        if (lock.owns_lock() && shard.head[cls] != nullptr) {
+            const auto head = shard.head[cls];
+            shard.head[cls] = nullptr;
+            return head;
+        }
+    }
+    return nullptr;
+}
+
+void* NodePool::new_slab(const size_t size) {
+    const auto slab = aligned_alloc_bytes(size, SLAB_SIZE);
+    static_cast<SlabHeader*>(slab)->pool = this;
+    m_reserved_bytes += size;
+    return slab;
+}
+
+NodePool::FreeChunk* NodePool::carve(const size_t cls) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const auto chunk_size = (cls + 1) * GRANULARITY;
+    const auto batch_size = std::max(size_t{1}, BATCH_BYTES / chunk_size);
+    const auto batch_bytes = chunk_size * batch_size;
+    if (m_slab_pos == nullptr
+        || static_cast<size_t>(m_slab_end - m_slab_pos) < batch_bytes) {
+        const auto slab = static_cast<char*>(new_slab(SLAB_SIZE));
+        m_slabs.emplace_back(slab);
+        m_slab_pos = slab + HEADER_SIZE;
+        m_slab_end = slab + SLAB_SIZE;
+    }
+
+    const auto head = reinterpret_cast<FreeChunk*>(m_slab_pos);
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        const auto chunk = reinterpret_cast<FreeChunk*>(m_slab_pos);
+        m_slab_pos += chunk_size;
+        chunk->next = (i + 1 < batch_size) ?
+            reinterpret_cast<FreeChunk*>(m_slab_pos) : nullptr;
+    }
+    return head;
+}
+
+void* NodePool::allocate_large(const size_t size) {
+    const auto slab_bytes =
+        (HEADER_SIZE + size + SLAB_SIZE - 1) / SLAB_SIZE * SLAB_SIZE;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto slab = static_cast<char*>(new_slab(slab_bytes));
+    m_large.emplace(slab);
+    m_shards[0].used_bytes += size;
+    return slab + HEADER_SIZE;
+}
+
+void NodePool::deallocate_large(void* const ptr, const size_t size) {
+    const auto slab = static_cast<char*>(ptr) - HEADER_SIZE;
+    const auto slab_bytes =
+        (HEADER_SIZE + size + SLAB_SIZE - 1) / SLAB_SIZE * SLAB_SIZE;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_large.erase(slab);
+    m_shards[0].used_bytes -= size;
+    m_reserved_bytes -= slab_bytes;
+    aligned_free_bytes(slab);
+}
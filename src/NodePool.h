@@ -0,0 +1,103 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NODEPOOL_H_INCLUDED
+#define NODEPOOL_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+// Slab allocator for a search tree. UCTNode instances and their edges
+// are carved out of large slabs and recycled through free lists, so
+// search threads don't contend on malloc and freeing part of a tree
+// costs a list push per node. Every search owns a pool: when its whole
+// tree goes, the pool is destroyed and the slabs are returned to the
+// system at once, without visiting the nodes. The free lists are sharded
+// by thread to keep contention low, but they belong to the pool, so
+// nothing is stranded when a thread exits.
+class NodePool {
+public:
+    NodePool() = default;
+    // Frees every slab, whether the nodes in it were released or not.
+    ~NodePool();
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    void* allocate(size_t size);
+    // Memory goes back to the pool it came from.
+    static void deallocate(void* ptr, size_t size);
+    // The pool ptr was allocated from.
+    static NodePool& of(const void* ptr);
+
+    // Bytes held in slabs, whether in use or on a free list.
+    size_t get_reserved_bytes() const;
+    // Bytes in use by the tree.
+    size_t get_used_bytes() const;
+
+private:
+    static constexpr size_t GRANULARITY = 16;
+    static constexpr size_t MAX_POOLED_SIZE = 16384;
+    static constexpr size_t NUM_CLASSES = MAX_POOLED_SIZE / GRANULARITY;
+    // Slabs are aligned to their size, so that a chunk can find its
+    // pool in the header at the start of its slab.
+    static constexpr size_t SLAB_SIZE = 1 << 20;
+    static constexpr size_t HEADER_SIZE = GRANULARITY;
+    static constexpr size_t NUM_SHARDS = 8;
+    // Fresh chunks are carved from a slab about this many bytes at once.
+    static constexpr size_t BATCH_BYTES = 16 * 1024;
+
+    struct FreeChunk {
+        FreeChunk* next;
+    };
+
+    struct SlabHeader {
+        NodePool* pool;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::array<FreeChunk*, NUM_CLASSES> head{};
+        // Can go negative, chunks may be freed by another shard's thread.
+        std::atomic<std::int64_t> used_bytes{0};
+    };
+
+    static size_t shard_index();
+    void* new_slab(size_t size);
+    FreeChunk* carve(size_t cls);
+    FreeChunk* steal(size_t cls, size_t own);
+    void* allocate_large(size_t size);
+    void deallocate_large(void* ptr, size_t size);
+
+    std::array<Shard, NUM_SHARDS> m_shards;
+    std::mutex m_mutex;
+    std::vector<void*> m_slabs;
+    // Allocations above MAX_POOLED_SIZE get slabs of their own.
+    std::unordered_set<void*> m_large;
+    char* m_slab_pos{nullptr};
+    char* m_slab_end{nullptr};
+    std::atomic<size_t> m_reserved_bytes{0};
+};
+
+#endif
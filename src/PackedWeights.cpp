@@ -0,0 +1,179 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "PackedWeights.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Utils.h"
+
+using namespace Utils;
+
+static constexpr char MAGIC[8] = {'L', 'Z', 'P', 'A', 'C', 'K', 'E', 'D'};
+
+static std::size_t align_up(const std::size_t offset) {
+    return (offset + PackedWeights::ALIGN - 1)
+           / PackedWeights::ALIGN * PackedWeights::ALIGN;
+}
+
+bool PackedWeights::is_packed(const std::string& filename) {
+    auto file = std::ifstream{filename, std::ios::binary};
+    char magic[sizeof(MAGIC)];
+    if (!file.read(magic, sizeof(magic))) {
+        return false;
+    }
+    return std::equal(magic, magic + sizeof(magic), MAGIC);
+}
+
+std::string PackedWeights::shared_filename(const std::string& dir,
+                                           const std::string& source) {
+    auto file = std::ifstream{source, std::ios::binary};
+    if (!file) {
+        return {};
+    }
+    // FNV-1a over 64-bit words, started from the format version so that
+    // a new format doesn't pick up old files.
+    auto hash = std::uint64_t{0xcbf29ce484222325};
+    const auto mix = [&hash](const std::uint64_t word) {
+        hash = (hash ^ word) * 0x100000001b3;
+    };
+    mix(VERSION);
+    auto buffer = std::vector<char>(1 << 20);
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        const auto size = static_cast<std::size_t>(file.gcount());
+        auto i = std::size_t{0};
+        for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+            auto word = std::uint64_t{};
+            std::memcpy(&word, &buffer[i], sizeof(word));
+            mix(word);
+        }
+        for (; i < size; i++) {
+            mix(static_cast<unsigned char>(buffer[i]));
+        }
+    }
+    if (!file.eof()) {
+        return {};
+    }
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx",
+                  static_cast<unsigned long long>(hash));
+    return dir + "/" + name + ".lzp";
+}
+
+bool PackedWeights::write(const std::string& filename, Header header,
+                          const std::vector<Tensor>& tensors) {
+    std::copy(MAGIC, MAGIC + sizeof(MAGIC), header.magic);
+    header.version = VERSION;
+    header.tensor_count = tensors.size();
+    header.reserved = 0;
+
+    auto entries = std::vector<TensorEntry>{};
+    auto offset = align_up(sizeof(Header)
+                           + tensors.size() * sizeof(TensorEntry));
+    for (const auto& tensor : tensors) {
+        entries.push_back({offset, tensor.second});
+        offset = align_up(offset + tensor.second * sizeof(float));
+    }
+
+    // Files can be mapped by other processes, so a new one is written
+    // next to it and then moved over it.
+#ifdef _WIN32
+    const auto pid = GetCurrentProcessId();
+#else
+    const auto pid = getpid();
+#endif
+    const auto tmpname = filename + "." + std::to_string(pid) + ".tmp";
+    auto file = std::ofstream{tmpname, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()),
+               entries.size() * sizeof(TensorEntry));
+    const auto padding = std::vector<char>(ALIGN);
+    for (auto i = size_t{0}; i < tensors.size(); i++) {
+        file.write(padding.data(), entries[i].offset - file.tellp());
+        file.write(reinterpret_cast<const char*>(tensors[i].first),
+                   tensors[i].second * sizeof(float));
+    }
+    file.write(padding.data(), offset - file.tellp());
+    file.close();
+#ifdef _WIN32
+    // Windows can't rename over an existing file.
+    std::remove(filename.c_str());
+#endif
+    if (file.fail() || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+        myprintf("Could not write packed weights: %s\n", filename.c_str());
+        std::remove(tmpname.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool PackedWeights::open(const std::string& filename) {
+    if (!m_file.open(filename)) {
+        myprintf("Could not map weights file: %s\n", filename.c_str());
+        return false;
+    }
+    const auto size = m_file.size();
+    const auto data = m_file.data();
+
+    // Check that everything the header points to is in the file.
+    auto valid = size >= sizeof(Header)
+                 && std::equal(MAGIC, MAGIC + sizeof(MAGIC), header().magic);
+    if (valid && header().version != VERSION) {
+        myprintf("Packed weights file is version %u, expected %u.\n",
+                 header().version, VERSION);
+        m_file.close();
+        return false;
+    }
+    valid = valid && size >= sizeof(Header)
+                             + header().tensor_count * sizeof(TensorEntry);
+    const auto entries = reinterpret_cast<const TensorEntry*>(
+        data + sizeof(Header));
+    for (auto i = size_t{0}; valid && i < header().tensor_count; i++) {
+        valid = entries[i].offset % ALIGN == 0
+                && entries[i].offset <= size
+                && entries[i].size <= (size - entries[i].offset)
+                                      / sizeof(float);
+    }
+    if (!valid) {
+        myprintf("Packed weights file is damaged: %s\n", filename.c_str());
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+PackedWeights::Tensor PackedWeights::tensor(const std::size_t index) const {
+    assert(index < header().tensor_count);
+    const auto entries = reinterpret_cast<const TensorEntry*>(
+        m_file.data() + sizeof(Header));
+    return {reinterpret_cast<const float*>(m_file.data()
+                                           + entries[index].offset),
+            entries[index].size};
+}
@@ -0,0 +1,96 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PACKEDWEIGHTS_H_INCLUDED
+#define PACKEDWEIGHTS_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "MappedFile.h"
+
+/*
+    Binary weights file holding the tensors as the network uses them,
+    so loading it needs no parsing or preprocessing. It is read through
+    a read-only memory map.
+
+    Layout, in the byte order of the machine that wrote it:
+        Header
+        TensorEntry[tensor_count]
+        the tensors as float32, each starting on an ALIGN byte boundary
+    Which tensor is which is up to the network, this only stores them.
+*/
+class PackedWeights {
+public:
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::size_t ALIGN = 64;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t board_size;
+        std::uint32_t input_channels;
+        std::uint32_t channels;
+        std::uint32_t residual_blocks;
+        std::uint32_t value_head_not_stm;
+        std::uint32_t tensor_count;
+        std::uint32_t reserved;
+    };
+    struct TensorEntry {
+        // Offset in bytes from the start of the file
+        std::uint64_t offset;
+        // Number of floats
+        std::uint64_t size;
+    };
+    using Tensor = std::pair<const float*, std::size_t>;
+
+    PackedWeights() = default;
+    PackedWeights(const PackedWeights&) = delete;
+    PackedWeights& operator=(const PackedWeights&) = delete;
+
+    // Whether filename starts like a packed weights file.
+    static bool is_packed(const std::string& filename);
+    // Where the packed copy of the weights file source goes in dir. The
+    // name is a hash of the contents of source, so a changed file gets a
+    // new copy whatever its name and time. Empty if source can't be read.
+    static std::string shared_filename(const std::string& dir,
+                                       const std::string& source);
+    // Writes the tensors in order. magic, version and tensor_count of
+    // header are filled in here.
+    static bool write(const std::string& filename, Header header,
+                      const std::vector<Tensor>& tensors);
+
+    // Maps filename and checks its layout. Prints the reason and returns
+    // false if it can't be used.
+    bool open(const std::string& filename);
+    const Header& header() const {
+        return *reinterpret_cast<const Header*>(m_file.data());
+    }
+    // Points into the mapping, valid until this is destroyed.
+    Tensor tensor(const std::size_t index) const;
+
+private:
+    MappedFile m_file;
+};
+
+#endif
@@ -0,0 +1,228 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <utility>
+
+#include "QuantizedNetwork.h"
+
+constexpr auto WIDTH = BOARD_SIZE;
+constexpr auto HEIGHT = BOARD_SIZE;
+// Activations are quantized to 0..127, see Int8Simd.h.
+constexpr auto ACTIVATION_MAX = 127;
+constexpr auto WEIGHT_MAX = 127;
+
+template <typename T>
+static T round_up(const T value, const T multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+// Rows of the dot products, padded to what the kernels work on.
+constexpr auto PIXELS = (BOARD_SQUARES + Int8Simd::COLUMNS - 1)
+                        / Int8Simd::COLUMNS * Int8Simd::COLUMNS;
+
+void Int8Simd::dot_scalar(const std::int8_t* weights,
+                          const std::uint8_t* columns,
+                          std::int32_t* out,
+                          const int outputs, const int pixels,
+                          const int length) {
+    for (auto o = 0; o < outputs; o++) {
+        const auto w = &weights[o * length];
+        for (auto p = 0; p < pixels; p++) {
+            const auto x = &columns[p * length];
+            auto acc = std::int32_t{0};
+            for (auto i = 0; i < length; i++) {
+                acc += std::int32_t{w[i]} * std::int32_t{x[i]};
+            }
+            out[o * pixels + p] = acc;
+        }
+    }
+}
+
+void QuantizedNetwork::push_convolution(const int channels, const int outputs,
+                                        const std::vector<float>& weights,
+                                        const std::vector<float>& means,
+                                        const std::vector<float>& stddivs) {
+    constexpr auto filter_len = 9;
+    assert(weights.size() == size_t(outputs * channels * filter_len));
+
+    auto layer = Layer{};
+    layer.channels = channels;
+    layer.outputs = outputs;
+    layer.length = round_up(channels * filter_len, Int8Simd::ALIGN);
+    layer.weights.resize(
+        round_up(outputs, Int8Simd::ROWS) * layer.length);
+    layer.weight_scales.resize(outputs);
+    layer.means = means;
+    layer.stddivs = stddivs;
+
+    // The weights of an output are laid out as the columns,
+    // [channels][3][3], so they are copied as they are.
+    for (auto o = 0; o < outputs; o++) {
+        const auto w = &weights[o * channels * filter_len];
+        auto w_max = 0.0f;
+        for (auto i = 0; i < channels * filter_len; i++) {
+            w_max = std::max(w_max, std::abs(w[i]));
+        }
+        const auto scale = w_max > 0.0f ? w_max / WEIGHT_MAX : 1.0f;
+        for (auto i = 0; i < channels * filter_len; i++) {
+            layer.weights[o * layer.length + i] =
+                static_cast<std::int8_t>(std::lround(w[i] / scale));
+        }
+        layer.weight_scales[o] = scale;
+    }
+
+    // Until calibrate, as for the input planes, which are 0 or 1
+    set_input_scale(layer, 1.0f);
+    m_layers.emplace_back(std::move(layer));
+}
+
+void QuantizedNetwork::set_input_scale(Layer& layer, const float input_max) {
+    layer.input_scale = input_max > 0.0f ? input_max / ACTIVATION_MAX : 1.0f;
+    layer.alpha.resize(layer.outputs);
+    layer.beta.resize(layer.outputs);
+    for (auto o = 0; o < layer.outputs; o++) {
+        // stddiv * (input_scale * weight_scale * sum - mean)
+        layer.alpha[o] =
+            layer.stddivs[o] * layer.input_scale * layer.weight_scales[o];
+        layer.beta[o] = -layer.stddivs[o] * layer.means[o];
+    }
+}
+
+void QuantizedNetwork::calibrate(const std::vector<float>& input_max) {
+    assert(input_max.size() == m_layers.size());
+    for (auto i = size_t{0}; i < m_layers.size(); i++) {
+        set_input_scale(m_layers[i], input_max[i]);
+    }
+}
+
+void QuantizedNetwork::convolve(const Layer& layer, const float* input,
+                                const float* eltwise, float* output,
+                                Buffers& buffers) const {
+    const auto channels = layer.channels;
+    const auto outputs = round_up(layer.outputs, Int8Simd::ROWS);
+    const auto length = layer.length;
+
+    // The inputs are ReLU outputs or the 0/1 input planes.
+    auto& planes = buffers.planes;
+    planes.resize(channels * BOARD_SQUARES);
+    const auto inv_scale = 1.0f / layer.input_scale;
+    for (auto i = 0; i < channels * BOARD_SQUARES; i++) {
+        const auto q = input[i] * inv_scale + 0.5f;
+        planes[i] = static_cast<std::uint8_t>(
+            q <= 0.0f ? 0 : std::min(q, float(ACTIVATION_MAX)));
+    }
+
+    // A row for every pixel with the 3x3 neighbourhood of every channel,
+    // zero outside the board. Those values are never written, so they
+    // only have to be cleared when the size changes. What is after the
+    // last channel meets zero weights.
+    auto& columns = buffers.columns;
+    if (columns.size() != size_t(PIXELS * length)) {
+        columns.assign(PIXELS * length, 0);
+    }
+    for (auto y = 0; y < HEIGHT; y++) {
+        for (auto x = 0; x < WIDTH; x++) {
+            const auto row = &columns[(y * WIDTH + x) * length];
+            for (auto c = 0; c < channels; c++) {
+                const auto plane = &planes[c * BOARD_SQUARES];
+                for (auto ky = 0; ky < 3; ky++) {
+                    const auto yin = y + ky - 1;
+                    if (yin < 0 || yin >= HEIGHT) {
+                        continue;
+                    }
+                    for (auto kx = 0; kx < 3; kx++) {
+                        const auto xin = x + kx - 1;
+                        if (xin >= 0 && xin < WIDTH) {
+                            row[c * 9 + ky * 3 + kx] = plane[yin * WIDTH + xin];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    auto& dot = buffers.dot;
+    dot.resize(outputs * PIXELS);
+#ifdef USE_INT8_SIMD
+    if (m_isa == Int8Simd::Isa::AVX512_VNNI) {
+        Int8Simd::dot_avx512_vnni(layer.weights.data(), columns.data(),
+                                  dot.data(), outputs, PIXELS, length);
+    } else if (m_isa == Int8Simd::Isa::AVX2) {
+        Int8Simd::dot_avx2(layer.weights.data(), columns.data(),
+                           dot.data(), outputs, PIXELS, length);
+    } else
+#endif
+    {
+        Int8Simd::dot_scalar(layer.weights.data(), columns.data(),
+                             dot.data(), outputs, PIXELS, length);
+    }
+
+    // Batchnorm, the residual if any, and ReLU
+    for (auto o = 0; o < layer.outputs; o++) {
+        const auto alpha = layer.alpha[o];
+        const auto beta = layer.beta[o];
+        const auto sums = &dot[o * PIXELS];
+        const auto out = &output[o * BOARD_SQUARES];
+        const auto res = eltwise ? &eltwise[o * BOARD_SQUARES] : nullptr;
+        for (auto p = 0; p < BOARD_SQUARES; p++) {
+            auto val = alpha * sums[p] + beta;
+            if (res) {
+                val += res[p];
+            }
+            out[p] = val > 0.0f ? val : 0.0f;
+        }
+    }
+}
+
+void QuantizedNetwork::forward(const std::vector<float>& input,
+                               std::vector<float>& output,
+                               Buffers& buffers,
+                               const int batch_size) const {
+    assert(!m_layers.empty());
+    const auto input_channels = m_layers[0].channels;
+    const auto channels = m_layers[0].outputs;
+    const auto planes = size_t(channels * BOARD_SQUARES);
+    output.resize(planes * batch_size);
+    buffers.conv_mid.resize(planes * batch_size);
+    buffers.res.resize(planes * batch_size);
+
+    for (auto batch = 0; batch < batch_size; batch++) {
+        convolve(m_layers[0],
+                 &input[batch * input_channels * BOARD_SQUARES],
+                 nullptr, &output[batch * planes], buffers);
+    }
+
+    // Residual tower
+    for (auto i = size_t{1}; i < m_layers.size(); i += 2) {
+        // The input of the block is added back at its end.
+        std::swap(output, buffers.res);
+        for (auto batch = 0; batch < batch_size; batch++) {
+            const auto offset = batch * planes;
+            convolve(m_layers[i], &buffers.res[offset], nullptr,
+                     &buffers.conv_mid[offset], buffers);
+            convolve(m_layers[i + 1], &buffers.conv_mid[offset],
+                     &buffers.res[offset], &output[offset], buffers);
+        }
+    }
+}
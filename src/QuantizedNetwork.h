@@ -0,0 +1,99 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef QUANTIZEDNETWORK_H_INCLUDED
+#define QUANTIZEDNETWORK_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "Int8Simd.h"
+
+/*
+    The input convolution and residual tower with 8-bit weights and
+    activations, for CPUs.
+
+    Weights are quantized per output channel. The inputs of every
+    convolution are quantized with a scale found by calibrate, from the
+    largest value seen in the float version. The products are summed in
+    32 bits and the scales are folded into the batchnorm, which is
+    applied together with the residual and ReLU in float.
+*/
+class QuantizedNetwork {
+public:
+    // Scratch space of forward. Callers keep one per thread.
+    struct Buffers {
+        std::vector<std::uint8_t> planes;
+        std::vector<std::uint8_t> columns;
+        std::vector<std::int32_t> dot;
+        std::vector<float> conv_mid;
+        std::vector<float> res;
+    };
+
+    void set_isa(const Int8Simd::Isa isa) {
+        m_isa = isa;
+    }
+    // weights are [outputs][channels][3][3], means and stddivs are those
+    // of the batchnorm after the convolution.
+    void push_convolution(const int channels, const int outputs,
+                          const std::vector<float>& weights,
+                          const std::vector<float>& means,
+                          const std::vector<float>& stddivs);
+    size_t get_layer_count() const {
+        return m_layers.size();
+    }
+    // Sets the scale of every convolution's input from the largest
+    // value it got in the float version.
+    void calibrate(const std::vector<float>& input_max);
+
+    // input is [batch][channels][19x19], output gets the output of the
+    // tower in the same layout.
+    void forward(const std::vector<float>& input,
+                 std::vector<float>& output,
+                 Buffers& buffers,
+                 const int batch_size = 1) const;
+
+private:
+    struct Layer {
+        int channels;
+        int outputs;
+        // Length of a row of weights or columns
+        int length;
+        std::vector<std::int8_t> weights;
+        // Per output, turns the sums into the batchnorm output.
+        std::vector<float> weight_scales;
+        std::vector<float> alpha;
+        std::vector<float> beta;
+        std::vector<float> means;
+        std::vector<float> stddivs;
+        float input_scale{1.0f};
+    };
+
+    void convolve(const Layer& layer, const float* input,
+                  const float* eltwise, float* output,
+                  Buffers& buffers) const;
+    static void set_input_scale(Layer& layer, float input_max);
+
+    std::vector<Layer> m_layers;
+    Int8Simd::Isa m_isa{Int8Simd::Isa::SCALAR};
+};
+
+#endif
@@ -162,7 +162,7 @@ void Training::record(GameState& state, UCTNode& root) {
         Network::get_scored_moves(&state, Network::Ensemble::DIRECT, 0);
     step.net_winrate = result.winrate;
 
-    const auto& best_node = root.get_best_root_child(step.to_move);
+    const auto best_node = root.get_best_root_child(step.to_move);
     step.root_uct_winrate = root.get_eval(step.to_move);
     step.child_uct_winrate = best_node.get_eval(step.to_move);
     step.bestmove_visits = best_node.get_visits();
@@ -172,8 +172,8 @@ void Training::record(GameState& state, UCTNode& root) {
     // Get total visit amount. We count rather
     // than trust the root to avoid ttable issues.
     auto sum_visits = 0.0;
-    for (const auto& child : root.get_children()) {
-        sum_visits += child->get_visits();
+    for (const auto& child : root.get_edges()) {
+        sum_visits += child.get_visits();
     }
 
     // In a terminal position (with 2 passes), we can have children, but we
@@ -184,9 +184,9 @@ void Training::record(GameState& state, UCTNode& root) {
         return;
     }
 
-    for (const auto& child : root.get_children()) {
-        auto prob = static_cast<float>(child->get_visits() / sum_visits);
-        auto move = child->get_move();
+    for (const auto& child : root.get_edges()) {
+        auto prob = static_cast<float>(child.get_visits() / sum_visits);
+        auto move = child.get_move();
         if (move != FastBoard::PASS) {
             auto xy = state.board.get_xy(move);
             step.probabilities[xy.second * BOARD_SIZE + xy.first] = prob;
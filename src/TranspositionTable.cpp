@@ -0,0 +1,109 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "TranspositionTable.h"
+#include "Network.h"
+#include "UCTNode.h"
+
+TranspositionTable::~TranspositionTable() {
+    clear()();
+}
+
+std::uint64_t TranspositionTable::get_key(const GameState& state) {
+    // The positions the network sees, in order, and all positions of
+    // the game for superko, in any order. The board hashes cover the
+    // side to move, the ko square, prisoners and passes.
+    auto key = state.get_ko_hash_sum();
+    const auto history =
+        std::min(size_t{Network::INPUT_MOVES}, state.get_movenum() + 1);
+    for (auto i = size_t{0}; i < history; i++) {
+        key = (key ^ state.get_past_board(i).get_hash())
+              * 0x9e3779b97f4a7c15ULL;
+    }
+    return key;
+}
+
+UCTNode* TranspositionTable::find_or_insert(const std::uint64_t key,
+                                            UCTNode* const node) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_nodes.find(key);
+    if (it != end(m_nodes)) {
+        // The caller gets its own reference while the table still holds
+        // one, so that recycling cannot free the node under it.
+        if (it->second != node && !it->second->add_reference()) {
+            return nullptr;
+        }
+        return it->second;
+    }
+    if (!node->add_reference()) {
+        return node;
+    }
+    m_nodes.emplace(key, node);
+    return node;
+}
+
+void TranspositionTable::retire(UCTNode* const node) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_retired.emplace_back(node);
+}
+
+void TranspositionTable::abandon() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_nodes.clear();
+    m_retired.clear();
+}
+
+std::function<void()> TranspositionTable::release_positions() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto nodes = std::vector<UCTNode*>{};
+    nodes.reserve(m_nodes.size());
+    for (const auto& entry : m_nodes) {
+        nodes.emplace_back(entry.second);
+    }
+    m_nodes.clear();
+
+    return [nodes = std::move(nodes)]() {
+        for (const auto node : nodes) {
+            UCTNode::drop_reference(node);
+        }
+    };
+}
+
+std::function<void()> TranspositionTable::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto nodes = std::vector<UCTNode*>{};
+    nodes.reserve(m_nodes.size() + m_retired.size());
+    for (const auto& entry : m_nodes) {
+        nodes.emplace_back(entry.second);
+    }
+    nodes.insert(end(nodes), begin(m_retired), end(m_retired));
+    m_nodes.clear();
+    m_retired.clear();
+
+    // Releasing may delete whole subtrees that are no longer reachable.
+    return [nodes = std::move(nodes)]() {
+        for (const auto node : nodes) {
+            UCTNode::drop_reference(node);
+        }
+    };
+}
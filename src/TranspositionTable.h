@@ -0,0 +1,78 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRANSPOSITIONTABLE_H_INCLUDED
+#define TRANSPOSITIONTABLE_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "GameState.h"
+
+class UCTNode;
+
+// Maps positions to the node that represents them in the search, so
+// that transposed positions share a single node (and its statistics)
+// and the search tree becomes a DAG. The table holds a reference on
+// every node it knows about, until clear() is called between searches.
+class TranspositionTable {
+public:
+    TranspositionTable() = default;
+    TranspositionTable(const TranspositionTable&) = delete;
+    TranspositionTable& operator=(const TranspositionTable&) = delete;
+    ~TranspositionTable();
+
+    // The position and its history. Nodes with the same key see the
+    // same network inputs and the same superko restrictions, so they
+    // can stand in for each other.
+    static std::uint64_t get_key(const GameState& state);
+
+    // Return the node registered for key, or register node and return it.
+    // A registered node other than node is returned with a reference for
+    // the caller to drop, or as nullptr if it cannot take one more.
+    UCTNode* find_or_insert(std::uint64_t key, UCTNode* node);
+
+    // Keep a node that was replaced by a shared one until the next
+    // clear(), as other threads may still be reading it.
+    void retire(UCTNode* node);
+
+    // Drop all references held by the table. Returns a function that
+    // does the actual releasing, which can be sent to another thread.
+    std::function<void()> clear();
+
+    // Drop the references held for positions while a search goes on,
+    // so that subtrees cut off from the tree can be freed. Retired nodes
+    // are kept until clear().
+    std::function<void()> release_positions();
+
+    // Forget all nodes without releasing them, for when the tree is
+    // freed as a whole with its pool.
+    void abandon();
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<std::uint64_t, UCTNode*> m_nodes;
+    std::vector<UCTNode*> m_retired;
+};
+
+#endif
@@ -0,0 +1,247 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "TreeSnapshot.h"
+
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <queue>
+#include <vector>
+
+#include "FastBoard.h"
+#include "GTP.h"
+#include "MappedFile.h"
+#include "Network.h"
+#include "TranspositionTable.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+constexpr std::uint32_t TreeSnapshot::MAGIC;
+constexpr std::uint32_t TreeSnapshot::VERSION;
+constexpr std::uint32_t TreeSnapshot::NO_NODE;
+
+bool TreeSnapshot::has_record(const UCTNode::Edge& edge,
+                              std::unordered_set<const UCTNode*>* seen) {
+    const auto child = edge.get();
+    if (!child || !child->has_children()) {
+        return false;
+    }
+    return !seen || seen->insert(child).second;
+}
+
+bool TreeSnapshot::save(const std::string& filename,
+                        const GameState& state, const UCTNode& root) {
+    auto out = std::ofstream{filename,
+                             std::ofstream::out | std::ofstream::binary};
+    if (!out) {
+        return false;
+    }
+
+    auto header = Header{};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.node_size = sizeof(NodeRecord);
+    header.edge_size = sizeof(EdgeRecord);
+    header.hash = state.board.get_hash();
+    header.history = TranspositionTable::get_key(state);
+    header.network = Network::get_weights_hash();
+    header.komi = state.get_komi();
+    header.boardsize = state.board.get_boardsize();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // With transpositions, only the first parent to reach a node gets it.
+    auto seen_nodes = std::unordered_set<const UCTNode*>{};
+    const auto seen = cfg_transpositions ? &seen_nodes : nullptr;
+    auto queue = std::queue<const UCTNode*>{};
+
+    // The nodes, breadth first.
+    seen_nodes.insert(&root);
+    queue.push(&root);
+    while (!queue.empty()) {
+        const auto node = queue.front();
+        queue.pop();
+
+        auto record = NodeRecord{};
+        record.first_edge = header.num_edges;
+        record.net_eval = node->m_net_eval;
+        record.min_psa_ratio_children = node->m_min_psa_ratio_children;
+        record.num_edges = node->get_num_children();
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+
+        header.num_nodes++;
+        header.num_edges += node->get_num_children();
+        for (const auto& edge : node->get_edges()) {
+            if (has_record(edge, seen)) {
+                queue.push(edge.get());
+            }
+        }
+    }
+
+    // The edges, in the same order. Nodes are numbered as they are queued.
+    auto next_node = std::uint32_t{1};
+    seen_nodes.clear();
+    seen_nodes.insert(&root);
+    queue.push(&root);
+    while (!queue.empty()) {
+        const auto node = queue.front();
+        queue.pop();
+
+        for (const auto& edge : node->get_edges()) {
+            auto record = EdgeRecord{};
+            record.blackevals = edge.get_blackevals();
+            record.visits = edge.get_visits();
+            record.prior = edge.get_prior();
+            record.node = NO_NODE;
+            record.move = edge.get_move();
+            record.status = edge.m_block->status()[edge.m_slot];
+            if (has_record(edge, seen)) {
+                record.node = next_node++;
+                queue.push(edge.get());
+            }
+            out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        }
+    }
+    assert(next_node == header.num_nodes);
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+
+    if (out.fail()) {
+        return false;
+    }
+    myprintf("Saved %d nodes and %d edges.\n",
+             static_cast<int>(header.num_nodes),
+             static_cast<int>(header.num_edges));
+    return true;
+}
+
+UCTNodeHandle TreeSnapshot::load(const std::string& filename,
+                                 const GameState& state,
+                                 NodePool& pool) {
+    MappedFile file;
+    if (!file.open(filename) || file.size() < sizeof(Header)) {
+        myprintf("Could not read search tree from %s.\n", filename.c_str());
+        return nullptr;
+    }
+    const auto& header = *reinterpret_cast<const Header*>(file.data());
+    if (header.magic != MAGIC || header.version != VERSION
+        || header.node_size != sizeof(NodeRecord)
+        || header.edge_size != sizeof(EdgeRecord)
+        || header.num_nodes == 0 || header.num_nodes >= NO_NODE
+        || header.num_edges > header.num_nodes * (FastBoard::MAXSQ + 1)) {
+        myprintf("%s is not a search tree file.\n", filename.c_str());
+        return nullptr;
+    }
+    if (header.hash != state.board.get_hash()
+        || header.history != TranspositionTable::get_key(state)
+        || header.komi != state.get_komi()
+        || header.boardsize != std::uint32_t(state.board.get_boardsize())) {
+        myprintf("Search tree in %s is for another position.\n",
+                 filename.c_str());
+        return nullptr;
+    }
+    if (header.network != Network::get_weights_hash()) {
+        myprintf("Search tree in %s is for another network.\n",
+                 filename.c_str());
+        return nullptr;
+    }
+
+    const auto corrupt = [&filename]() {
+        myprintf("Search tree in %s is damaged.\n", filename.c_str());
+        return nullptr;
+    };
+
+    // The records are used in place, they must stay aligned.
+    static_assert(sizeof(Header) % alignof(NodeRecord) == 0
+                  && sizeof(NodeRecord) % alignof(EdgeRecord) == 0,
+                  "Misaligned tree records");
+    const auto nodes_size = header.num_nodes * sizeof(NodeRecord);
+    const auto edges_size = header.num_edges * sizeof(EdgeRecord);
+    if (file.size() < sizeof(Header) + nodes_size + edges_size) {
+        return corrupt();
+    }
+    const auto node_records =
+        reinterpret_cast<const NodeRecord*>(file.data() + sizeof(Header));
+    const auto edge_records = reinterpret_cast<const EdgeRecord*>(
+        file.data() + sizeof(Header) + nodes_size);
+
+    auto root = UCTNodeHandle(new (pool) UCTNode(state.get_last_move()));
+    auto nodes = std::vector<UCTNode*>(header.num_nodes, nullptr);
+    nodes[0] = root.get();
+
+    auto num_edges = std::uint64_t{0};
+    for (auto i = size_t{0}; i < nodes.size(); i++) {
+        const auto& record = node_records[i];
+        const auto node = nodes[i];
+        if (node == nullptr
+            || record.first_edge != num_edges
+            || record.num_edges > FastBoard::MAXSQ + 1
+            || record.num_edges > header.num_edges - num_edges) {
+            return corrupt();
+        }
+        node->m_net_eval = record.net_eval;
+        node->m_min_psa_ratio_children = record.min_psa_ratio_children;
+        num_edges += record.num_edges;
+        if (record.num_edges == 0) {
+            continue;
+        }
+
+        node->reserve_edges(record.num_edges);
+        for (auto j = size_t{0}; j < record.num_edges; j++) {
+            const auto& edge = edge_records[record.first_edge + j];
+            // Only moves on the board, the search would play them.
+            const auto valid_move = edge.move == FastBoard::PASS
+                || (edge.move >= 0 && edge.move < FastBoard::MAXSQ
+                    && state.board.get_square(edge.move) != FastBoard::INVAL);
+            const auto valid_node = edge.node == NO_NODE
+                || (edge.node > i && edge.node < nodes.size()
+                    && nodes[edge.node] == nullptr);
+            const auto valid_stats = edge.visits >= 0
+                && std::isfinite(edge.blackevals);
+            if (!valid_move || !valid_node || !valid_stats
+                || edge.status > UCTNode::ACTIVE) {
+                return corrupt();
+            }
+            const auto status = static_cast<UCTNode::Status>(edge.status);
+
+            const auto block = node->m_edges;
+            block->init(j, edge.move, edge.prior);
+            block->blackevals()[j] = edge.blackevals;
+            block->visits()[j] = edge.visits;
+            block->status()[j] = status;
+            if (edge.node != NO_NODE) {
+                const auto child = new (pool) UCTNode(edge.move);
+                block->children()[j] = UCTNodePointer(child);
+                nodes[edge.node] = child;
+            }
+        }
+        node->m_num_children = static_cast<std::uint16_t>(record.num_edges);
+    }
+    if (num_edges != header.num_edges) {
+        return corrupt();
+    }
+
+    myprintf("Loaded %d nodes and %d edges.\n",
+             static_cast<int>(header.num_nodes),
+             static_cast<int>(header.num_edges));
+    return root;
+}
@@ -0,0 +1,105 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TREESNAPSHOT_H_INCLUDED
+#define TREESNAPSHOT_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+#include "GameState.h"
+#include "UCTNode.h"
+
+/*
+    Search tree saved to disk, so that the analysis of a position can be
+    resumed by another process.
+
+    The file is a Header followed by two arrays of fixed size records in
+    host byte order: the expanded nodes in breadth-first order, then the
+    edges of every node. The edges of a node are contiguous and in node
+    order, and every edge refers to the node record of its child, if it
+    has one. So the file can be used memory-mapped, which is how load
+    reads it.
+
+    A tree is only loaded for the same position with the same history,
+    as far as the network and superko can tell, and for the same network.
+
+    In a search graph with transpositions a shared node is written below
+    the first parent that reaches it. Other parents keep the edge
+    statistics but will have to expand the child again.
+*/
+class TreeSnapshot {
+public:
+    static bool save(const std::string& filename,
+                     const GameState& state, const UCTNode& root);
+    // Returns nullptr if the file can't be read or belongs to another
+    // position than state or another network. The nodes are allocated
+    // from pool.
+    static UCTNodeHandle load(const std::string& filename,
+                              const GameState& state,
+                              NodePool& pool);
+
+private:
+    // "LZTR" when read in little endian
+    static constexpr std::uint32_t MAGIC = 0x52545a4c;
+    static constexpr std::uint32_t VERSION = 3;
+    static constexpr std::uint32_t NO_NODE = 0xffffffff;
+
+    struct Header {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t node_size;
+        std::uint32_t edge_size;
+        std::uint64_t hash;
+        // TranspositionTable::get_key of the position.
+        std::uint64_t history;
+        std::uint64_t network;
+        float komi;
+        std::uint32_t boardsize;
+        std::uint64_t num_nodes;
+        std::uint64_t num_edges;
+    };
+
+    // The visits of a node follow from its edges.
+    struct NodeRecord {
+        std::uint64_t first_edge;
+        float net_eval;
+        float min_psa_ratio_children;
+        std::uint32_t num_edges;
+        std::uint32_t padding;
+    };
+
+    struct EdgeRecord {
+        double blackevals;
+        std::int32_t visits;
+        float prior;
+        std::uint32_t node;
+        std::int16_t move;
+        std::uint8_t status;
+        std::uint8_t padding;
+    };
+
+    static bool has_record(const UCTNode::Edge& edge,
+                           std::unordered_set<const UCTNode*>* seen);
+};
+
+#endif
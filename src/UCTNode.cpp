@@ -22,10 +22,12 @@
 #include <cstdio>
 #include <cstdint>
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <functional>
 #include <iterator>
 #include <limits>
+#include <new>
 #include <numeric>
 #include <utility>
 #include <vector>
@@ -40,11 +42,125 @@
 
 using namespace Utils;
 
-UCTNode::UCTNode(int vertex, float score) : m_move(vertex), m_score(score) {
+UCTNode::UCTNode(int vertex) : m_move(vertex) {
+}
+
+UCTNode::~UCTNode() {
+    auto block = m_edges;
+    while (block) {
+        const auto next = block->next;
+        EdgeBlock::destroy(block);
+        block = next;
+    }
+}
+
+size_t UCTNode::EdgeBlock::bytes(const size_t capacity) {
+    return sizeof(EdgeBlock)
+        + capacity * (sizeof(std::atomic<double>) + sizeof(UCTNodePointer)
+                      + sizeof(std::atomic<int>) + sizeof(float)
+                      + sizeof(std::atomic<std::int16_t>)
+                      + sizeof(std::atomic<Status>));
+}
+
+UCTNode::EdgeBlock* UCTNode::EdgeBlock::create(const size_t capacity,
+                                               NodePool& pool) {
+    static_assert(sizeof(std::atomic<Status>) == sizeof(std::atomic<char>),
+                  "Status is expected to be a single byte");
+    static_assert(sizeof(EdgeBlock) % alignof(std::atomic<double>) == 0,
+                  "Edge arrays are expected to be aligned");
+    const auto block = new (pool.allocate(bytes(capacity))) EdgeBlock;
+    block->capacity = capacity;
+    for (auto i = size_t{0}; i < capacity; i++) {
+        new (&block->children()[i]) UCTNodePointer(std::int16_t{0});
+        block->init(i, FastBoard::PASS, 0.0f);
+    }
+    return block;
+}
+
+void UCTNode::EdgeBlock::destroy(EdgeBlock* const block) {
+    const auto capacity = block->capacity;
+    for (auto i = size_t{0}; i < capacity; i++) {
+        block->children()[i].~UCTNodePointer();
+    }
+    block->~EdgeBlock();
+    NodePool::deallocate(block, bytes(capacity));
+}
+
+void UCTNode::EdgeBlock::init(const size_t slot,
+                              const int move, const float prior) {
+    assert(slot < capacity);
+    children()[slot] = UCTNodePointer(static_cast<std::int16_t>(move));
+    new (&blackevals()[slot]) std::atomic<double>(0.0);
+    new (&visits()[slot]) std::atomic<int>(0);
+    priors()[slot] = prior;
+    new (&virtual_loss()[slot]) std::atomic<std::int16_t>(0);
+    new (&status()[slot]) std::atomic<Status>(ACTIVE);
+}
+
+int UCTNode::Edge::get_move() const {
+    return m_block->children()[m_slot].get_move();
+}
+
+float UCTNode::Edge::get_prior() const {
+    return m_block->priors()[m_slot];
+}
+
+int UCTNode::Edge::get_visits() const {
+    return m_block->visits()[m_slot];
+}
+
+double UCTNode::Edge::get_blackevals() const {
+    return m_block->blackevals()[m_slot];
+}
+
+float UCTNode::Edge::get_eval(int tomove) const {
+    // Due to the use of atomic updates and virtual losses, it is
+    // possible for the visit count to change underneath us. Make sure
+    // to return a consistent result to the caller by caching the values.
+    auto virtual_loss = int{m_block->virtual_loss()[m_slot]};
+    auto visits = get_visits() + virtual_loss;
+    assert(visits > 0);
+    auto blackeval = get_blackevals();
+    if (tomove == FastBoard::WHITE) {
+        blackeval += static_cast<double>(virtual_loss);
+    }
+    auto score = static_cast<float>(blackeval / double(visits));
+    if (tomove == FastBoard::WHITE) {
+        score = 1.0f - score;
+    }
+    return score;
+}
+
+bool UCTNode::Edge::valid() const {
+    return m_block->status()[m_slot] != INVALID;
+}
+
+bool UCTNode::Edge::active() const {
+    return m_block->status()[m_slot] == ACTIVE;
+}
+
+UCTNode* UCTNode::Edge::get() const {
+    const auto& child = m_block->children()[m_slot];
+    return child.is_inflated() ? child.get() : nullptr;
+}
+
+UCTNode* UCTNode::Edge::inflate() const {
+    const auto& child = m_block->children()[m_slot];
+    child.inflate();
+    return child.get();
+}
+
+UCTNode::EdgeRange::iterator& UCTNode::EdgeRange::iterator::operator++() {
+    if (++m_slot == m_block->capacity) {
+        m_block = m_block->next;
+        m_slot = 0;
+    }
+    --m_left;
+    return *this;
 }
 
 bool UCTNode::first_visit() const {
-    return m_visits == 0;
+    return !has_children();
 }
 
 SMP::Mutex& UCTNode::get_mutex() {
@@ -55,6 +171,19 @@ bool UCTNode::create_children(std::atomic<int>& nodecount,
                               GameState& state,
                               float& eval,
                               float min_psa_ratio) {
+    if (!acquire_expansion(state, min_psa_ratio)) {
+        return false;
+    }
+
+    const auto raw_netlist = Network::get_scored_moves(
+        &state, Network::Ensemble::RANDOM_SYMMETRY);
+
+    eval = expand_children(nodecount, state, raw_netlist, min_psa_ratio);
+    return true;
+}
+
+bool UCTNode::acquire_expansion(const GameState& state,
+                                float min_psa_ratio) {
     // check whether somebody beat us to it (atomic)
     if (!expandable(min_psa_ratio)) {
         return false;
@@ -75,10 +204,14 @@ bool UCTNode::create_children(std::atomic<int>& nodecount,
     }
     // We'll be the one queueing this node for expansion, stop others
     m_is_expanding = true;
-    lock.unlock();
+    return true;
+}
 
-    const auto raw_netlist = Network::get_scored_moves(
-        &state, Network::Ensemble::RANDOM_SYMMETRY);
+float UCTNode::expand_children(std::atomic<int>& nodecount,
+                               GameState& state,
+                               const Network::Netresult& raw_netlist,
+                               float min_psa_ratio) {
+    assert(m_is_expanding);
 
     // DCNN returns winrate as side to move
     m_net_eval = raw_netlist.winrate;
@@ -87,7 +220,6 @@ bool UCTNode::create_children(std::atomic<int>& nodecount,
     if (state.board.white_to_move()) {
         m_net_eval = 1.0f - m_net_eval;
     }
-    eval = m_net_eval;
 
     std::vector<Network::ScoreVertexPair> nodelist;
 
@@ -118,7 +250,7 @@ bool UCTNode::create_children(std::atomic<int>& nodecount,
     }
 
     link_nodelist(nodecount, nodelist, min_psa_ratio);
-    return true;
+    return m_net_eval;
 }
 
 void UCTNode::link_nodelist(std::atomic<int>& nodecount,
@@ -138,84 +270,212 @@ void UCTNode::link_nodelist(std::atomic<int>& nodecount,
     const auto max_psa = nodelist[0].first;
     const auto old_min_psa = max_psa * m_min_psa_ratio_children;
     const auto new_min_psa = max_psa * min_psa_ratio;
-    if (new_min_psa > 0.0f) {
-        m_children.reserve(
-            std::count_if(cbegin(nodelist), cend(nodelist),
-                [=](const auto& node) { return node.first >= new_min_psa; }
-            )
-        );
-    } else {
-        m_children.reserve(nodelist.size());
-    }
+    const auto linked = std::count_if(cbegin(nodelist), cend(nodelist),
+        [=](const auto& node) {
+            return node.first >= new_min_psa && node.first < old_min_psa;
+        }
+    );
+    reserve_edges(linked);
 
-    auto skipped_children = false;
+    auto num_children = size_t{m_num_children};
     for (const auto& node : nodelist) {
-        if (node.first < new_min_psa) {
-            skipped_children = true;
-        } else if (node.first < old_min_psa) {
-            m_children.emplace_back(node.second, node.first);
+        if (node.first >= new_min_psa && node.first < old_min_psa) {
+            const auto edge = get_edge(num_children++);
+            edge.m_block->init(edge.m_slot, node.second, node.first);
             ++nodecount;
         }
     }
+    // Searches read the edges without the lock, publish them last.
+    m_num_children = static_cast<std::uint16_t>(num_children);
 
+    const auto skipped_children =
+        std::any_of(cbegin(nodelist), cend(nodelist),
+            [=](const auto& node) { return node.first < new_min_psa; });
     m_min_psa_ratio_children = skipped_children ? min_psa_ratio : 0.0f;
     m_is_expanding = false;
 }
 
-const std::vector<UCTNodePointer>& UCTNode::get_children() const {
-    return m_children;
+void UCTNode::reserve_edges(const size_t count) {
+    auto last = m_edges;
+    auto capacity = size_t{0};
+    for (auto block = m_edges; block; block = block->next) {
+        capacity += block->capacity;
+        last = block;
+    }
+    // Slots freed by kill_superkos are used first.
+    const auto spare = capacity - m_num_children;
+    if (count <= spare) {
+        return;
+    }
+    const auto block = EdgeBlock::create(count - spare, NodePool::of(this));
+    if (last) {
+        last->next = block;
+    } else {
+        m_edges = block;
+    }
+}
+
+void UCTNode::reorder_edges(const std::vector<size_t>& order) {
+    auto copies = std::vector<EdgeCopy>{};
+    copies.reserve(order.size());
+    for (const auto i : order) {
+        const auto edge = get_edge(i);
+        const auto block = edge.m_block;
+        const auto slot = edge.m_slot;
+        copies.push_back(EdgeCopy{
+            std::move(block->children()[slot]),
+            block->blackevals()[slot],
+            block->visits()[slot],
+            block->priors()[slot],
+            block->virtual_loss()[slot],
+            block->status()[slot]
+        });
+    }
+    const auto old_size = size_t{m_num_children};
+    for (auto i = size_t{0}; i < old_size; i++) {
+        const auto edge = get_edge(i);
+        const auto block = edge.m_block;
+        const auto slot = edge.m_slot;
+        if (i >= copies.size()) {
+            // Drops the children that are not kept.
+            block->init(slot, FastBoard::PASS, 0.0f);
+            continue;
+        }
+        auto& copy = copies[i];
+        block->children()[slot] = std::move(copy.child);
+        block->blackevals()[slot] = copy.blackevals;
+        block->visits()[slot] = copy.visits;
+        block->priors()[slot] = copy.prior;
+        block->virtual_loss()[slot] = copy.virtual_loss;
+        block->status()[slot] = copy.status;
+    }
+    m_num_children = static_cast<std::uint16_t>(copies.size());
+}
+
+size_t UCTNode::get_num_children() const {
+    return m_num_children;
+}
+
+UCTNode::Edge UCTNode::get_edge(size_t edge) const {
+    // Also used on the edges reserved but not yet published.
+    auto block = m_edges;
+    assert(block != nullptr);
+    while (edge >= block->capacity) {
+        edge -= block->capacity;
+        block = block->next;
+        assert(block != nullptr);
+    }
+    return Edge(block, edge);
 }
 
+UCTNode::EdgeRange UCTNode::get_edges() const {
+    // The count first, the edges it covers are initialized before it.
+    const auto num_children = size_t{m_num_children};
+    return EdgeRange(num_children ? m_edges : nullptr, num_children);
+}
 
 int UCTNode::get_move() const {
     return m_move;
 }
 
-void UCTNode::virtual_loss() {
-    m_virtual_loss += VIRTUAL_LOSS_COUNT;
+void UCTNode::update_edge(size_t edge, float eval) {
+    const auto e = get_edge(edge);
+    e.m_block->visits()[e.m_slot]++;
+    atomic_add(e.m_block->blackevals()[e.m_slot], double(eval));
 }
 
-void UCTNode::virtual_loss_undo() {
-    m_virtual_loss -= VIRTUAL_LOSS_COUNT;
+void UCTNode::add_child_visits(size_t edge, int visits, double blackevals) {
+    const auto e = get_edge(edge);
+    e.m_block->visits()[e.m_slot] += visits;
+    atomic_add(e.m_block->blackevals()[e.m_slot], blackevals);
 }
 
-void UCTNode::update(float eval) {
-    m_visits++;
-    accumulate_eval(eval);
+void UCTNode::virtual_loss_undo_edge(size_t edge) {
+    const auto e = get_edge(edge);
+    e.m_block->virtual_loss()[e.m_slot] -= VIRTUAL_LOSS_COUNT;
 }
 
-bool UCTNode::has_children() const {
-    return m_min_psa_ratio_children <= 1.0f;
+bool UCTNode::add_reference() {
+    auto refs = m_refs.load();
+    do {
+        if (refs == std::numeric_limits<std::uint8_t>::max()) {
+            return false;
+        }
+    } while (!m_refs.compare_exchange_weak(refs, refs + 1));
+    return true;
 }
 
-bool UCTNode::expandable(const float min_psa_ratio) const {
-    return min_psa_ratio < m_min_psa_ratio_children;
+void UCTNode::drop_reference(UCTNode* node) {
+    if (--node->m_refs == 0) {
+        delete node;
+    }
 }
 
-float UCTNode::get_score() const {
-    return m_score;
+void UCTNodeRelease::operator()(UCTNode* node) const {
+    UCTNode::drop_reference(node);
 }
 
-void UCTNode::set_score(float score) {
-    m_score = score;
+bool UCTNode::share_child(size_t edge, UCTNode* expected, UCTNode* shared) {
+    LOCK(get_mutex(), lock);
+    const auto e = get_edge(edge);
+    auto& child = e.m_block->children()[e.m_slot];
+    if (!child.is_inflated() || child.get() != expected
+        || shared->get_move() != expected->get_move()) {
+        return false;
+    }
+    // Our virtual loss is the only one on the edge, so no other thread
+    // is below it, and nobody got to expand the child yet.
+    if (e.m_block->virtual_loss()[e.m_slot] != VIRTUAL_LOSS_COUNT
+        || expected->has_children() || expected->m_is_expanding) {
+        return false;
+    }
+    if (!shared->add_reference()) {
+        return false;
+    }
+    child.release();
+    child = UCTNodePointer(shared);
+    return true;
+}
+
+void UCTNode::invalidate_child(size_t edge) {
+    // Only the edge, with transpositions the child may be legal when
+    // reached from another parent.
+    const auto e = get_edge(edge);
+    e.m_block->status()[e.m_slot] = INVALID;
+}
+
+void UCTNode::set_child_active(size_t edge, bool active) {
+    LOCK(get_mutex(), lock);
+    const auto e = get_edge(edge);
+    if (e.valid()) {
+        e.m_block->status()[e.m_slot] = active ? ACTIVE : PRUNED;
+    }
+}
+
+bool UCTNode::has_children() const {
+    return m_min_psa_ratio_children <= 1.0f;
+}
+
+bool UCTNode::expandable(const float min_psa_ratio) const {
+    return min_psa_ratio < m_min_psa_ratio_children;
 }
 
 int UCTNode::get_visits() const {
-    return m_visits;
+    if (!has_children()) {
+        return 0;
+    }
+    // The node's own eval counts as its first visit.
+    auto visits = 1;
+    for (const auto& edge : get_edges()) {
+        visits += edge.get_visits();
+    }
+    return visits;
 }
 
 float UCTNode::get_eval(int tomove) const {
-    // Due to the use of atomic updates and virtual losses, it is
-    // possible for the visit count to change underneath us. Make sure
-    // to return a consistent result to the caller by caching the values.
-    auto virtual_loss = int{m_virtual_loss};
-    auto visits = get_visits() + virtual_loss;
+    auto visits = get_visits();
     assert(visits > 0);
-    auto blackeval = get_blackevals();
-    if (tomove == FastBoard::WHITE) {
-        blackeval += static_cast<double>(virtual_loss);
-    }
-    auto score = static_cast<float>(blackeval / double(visits));
+    auto score = static_cast<float>(get_blackevals() / double(visits));
     if (tomove == FastBoard::WHITE) {
         score = 1.0f - score;
     }
@@ -230,26 +490,37 @@ float UCTNode::get_net_eval(int tomove) const {
 }
 
 double UCTNode::get_blackevals() const {
-    return m_blackevals;
-}
-
-void UCTNode::accumulate_eval(float eval) {
-    atomic_add(m_blackevals, double(eval));
+    if (!has_children()) {
+        return 0.0;
+    }
+    auto blackevals = double{m_net_eval};
+    for (const auto& edge : get_edges()) {
+        blackevals += edge.get_blackevals();
+    }
+    return blackevals;
 }
 
-UCTNode* UCTNode::uct_select_child(int color, bool is_root) {
+UCTNode* UCTNode::uct_select_child(int color, bool is_root, size_t& edge) {
     LOCK(get_mutex(), lock);
 
+    const auto num_children = size_t{m_num_children};
+
     // Count parentvisits manually to avoid issues with transpositions.
     auto total_visited_policy = 0.0f;
     auto parentvisits = size_t{0};
-    for (const auto& child : m_children) {
-        if (child.valid()) {
-            parentvisits += child.get_visits();
-            if (child.get_visits() > 0) {
-                total_visited_policy += child.get_score();
+    auto left = num_children;
+    for (auto block = m_edges; left > 0; block = block->next) {
+        const auto size = std::min(left, block->capacity);
+        for (auto i = size_t{0}; i < size; i++) {
+            if (block->status()[i] != INVALID) {
+                const auto visits = block->visits()[i].load();
+                parentvisits += visits;
+                if (visits > 0) {
+                    total_visited_policy += block->priors()[i];
+                }
             }
         }
+        left -= size;
     }
 
     auto numerator = std::sqrt(double(parentvisits));
@@ -263,41 +534,51 @@ UCTNode* UCTNode::uct_select_child(int color, bool is_root) {
     // Estimated eval for unknown nodes = original parent NN eval - reduction
     auto fpu_eval = get_net_eval(color) - fpu_reduction;
 
-    auto best = static_cast<UCTNodePointer*>(nullptr);
+    auto best = Edge{};
+    auto best_index = num_children;
     auto best_value = std::numeric_limits<double>::lowest();
 
-    for (auto& child : m_children) {
-        if (!child.active()) {
-            continue;
-        }
+    auto index = size_t{0};
+    left = num_children;
+    for (auto block = m_edges; left > 0; block = block->next) {
+        const auto size = std::min(left, block->capacity);
+        for (auto i = size_t{0}; i < size; i++, index++) {
+            if (block->status()[i] != ACTIVE) {
+                continue;
+            }
 
-        auto winrate = fpu_eval;
-        if (child.get_visits() > 0) {
-            winrate = child.get_eval(color);
-        }
-        auto psa = child.get_score();
-        auto denom = 1.0 + child.get_visits();
-        auto puct = cfg_puct * psa * (numerator / denom);
-        auto value = winrate + puct;
-        assert(value > std::numeric_limits<double>::lowest());
-
-        if (value > best_value) {
-            best_value = value;
-            best = &child;
+            const auto visits = block->visits()[i].load();
+            auto winrate = fpu_eval;
+            if (visits > 0) {
+                winrate = Edge(block, i).get_eval(color);
+            }
+            auto psa = block->priors()[i];
+            auto denom = 1.0 + visits;
+            auto puct = cfg_puct * psa * (numerator / denom);
+            auto value = winrate + puct;
+            assert(value > std::numeric_limits<double>::lowest());
+
+            if (value > best_value) {
+                best_value = value;
+                best = Edge(block, i);
+                best_index = index;
+            }
         }
+        left -= size;
     }
 
-    assert(best != nullptr);
-    best->inflate();
-    return best->get();
+    assert(best_index < num_children);
+    best.m_block->virtual_loss()[best.m_slot] += VIRTUAL_LOSS_COUNT;
+    edge = best_index;
+    return best.inflate();
 }
 
-class NodeComp : public std::binary_function<UCTNodePointer&,
-                                             UCTNodePointer&, bool> {
+class NodeComp : public std::binary_function<UCTNode::Edge,
+                                             UCTNode::Edge, bool> {
 public:
     NodeComp(int color) : m_color(color) {};
-    bool operator()(const UCTNodePointer& a,
-                    const UCTNodePointer& b) {
+    bool operator()(const UCTNode::Edge& a,
+                    const UCTNode::Edge& b) {
         // if visits are not same, sort on visits
         if (a.get_visits() != b.get_visits()) {
             return a.get_visits() < b.get_visits();
@@ -305,7 +586,7 @@ public:
 
         // neither has visits, sort on prior score
         if (a.get_visits() == 0) {
-            return a.get_score() < b.get_score();
+            return a.get_prior() < b.get_prior();
         }
 
         // both have same non-zero number of visits
@@ -317,44 +598,96 @@ private:
 
 void UCTNode::sort_children(int color) {
     LOCK(get_mutex(), lock);
-    std::stable_sort(rbegin(m_children), rend(m_children), NodeComp(color));
+    auto edges = std::vector<Edge>{};
+    for (const auto& edge : get_edges()) {
+        edges.emplace_back(edge);
+    }
+    auto order = std::vector<size_t>(edges.size());
+    std::iota(begin(order), end(order), size_t{0});
+    auto comp = NodeComp(color);
+    std::stable_sort(rbegin(order), rend(order),
+                     [&](const size_t a, const size_t b) {
+                         return comp(edges[a], edges[b]);
+                     });
+    reorder_edges(order);
 }
 
-UCTNode& UCTNode::get_best_root_child(int color) {
+UCTNode::Edge UCTNode::get_best_root_child(int color) {
     LOCK(get_mutex(), lock);
-    assert(!m_children.empty());
+    assert(m_num_children > 0);
 
-    auto ret = std::max_element(begin(m_children), end(m_children),
-                                NodeComp(color));
-    ret->inflate();
-    return *(ret->get());
+    auto comp = NodeComp(color);
+    auto best = get_edge(0);
+    for (const auto& edge : get_edges()) {
+        if (comp(best, edge)) {
+            best = edge;
+        }
+    }
+    best.inflate();
+    return best;
 }
 
 size_t UCTNode::count_nodes() const {
+    // With transpositions the tree is a DAG, count shared nodes once.
+    if (cfg_transpositions) {
+        auto seen = std::unordered_set<const UCTNode*>{};
+        return count_nodes(&seen);
+    }
+    return count_nodes(nullptr);
+}
+
+size_t UCTNode::count_nodes(std::unordered_set<const UCTNode*>* seen) const {
     auto nodecount = size_t{0};
-    nodecount += m_children.size();
-    for (auto& child : m_children) {
-        if (child.get_visits() > 0) {
-            nodecount += child->count_nodes();
+    nodecount += m_num_children;
+    for (const auto& edge : get_edges()) {
+        const auto child = edge.get();
+        if (child && child->has_children()) {
+            if (seen && !seen->insert(child).second) {
+                continue;
+            }
+            nodecount += child->count_nodes(seen);
         }
     }
     return nodecount;
 }
 
-void UCTNode::invalidate() {
-    m_status = INVALID;
-}
-
-void UCTNode::set_active(const bool active) {
-    if (valid()) {
-        m_status = active ? ACTIVE : PRUNED;
+void UCTNode::recycle_subtrees(const int min_visits,
+                               std::vector<UCTNode*>& garbage) {
+    auto keep = std::vector<UCTNode*>{};
+    {
+        LOCK(get_mutex(), lock);
+        if (m_num_children == 0) {
+            return;
+        }
+        auto best = get_edge(0);
+        for (const auto& edge : get_edges()) {
+            if (edge.get_visits() > best.get_visits()) {
+                best = edge;
+            }
+        }
+        for (const auto& edge : get_edges()) {
+            const auto child = edge.get();
+            if (!child) {
+                continue;
+            }
+            const auto is_best = edge.m_block == best.m_block
+                                 && edge.m_slot == best.m_slot;
+            if (is_best || edge.get_visits() >= min_visits) {
+                keep.emplace_back(child);
+            } else if (edge.m_block->virtual_loss()[edge.m_slot] == 0
+                       && child->m_refs == 1
+                       && child->has_children()) {
+                // Threads only enter a child after adding a virtual loss
+                // to its edge under our lock, so nobody is below it. A
+                // child with other references is still used elsewhere.
+                auto& pointer = edge.m_block->children()[edge.m_slot];
+                garbage.emplace_back(pointer.release());
+                pointer = UCTNodePointer(
+                    static_cast<std::int16_t>(child->get_move()));
+            }
+        }
+    }
+    for (const auto node : keep) {
+        node->recycle_subtrees(min_visits, garbage);
     }
-}
-
-bool UCTNode::valid() const {
-    return m_status != INVALID;
-}
-
-bool UCTNode::active() const {
-    return m_status == ACTIVE;
 }
@@ -23,63 +23,190 @@
 
 #include <atomic>
 #include <memory>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 
 #include "GameState.h"
 #include "Network.h"
+#include "NodePool.h"
 #include "SMP.h"
 #include "UCTNodePointer.h"
 
+// Nodes may be shared between several owners, so an owning pointer to a
+// node gives up its reference instead of deleting the node outright.
+struct UCTNodeRelease {
+    void operator()(UCTNode* node) const;
+};
+using UCTNodeHandle = std::unique_ptr<UCTNode, UCTNodeRelease>;
+
 class UCTNode {
+    friend class TreeSnapshot;
+    struct EdgeBlock;
 public:
     // When we visit a node, add this amount of virtual losses
     // to it to encourage other CPUs to explore other parts of the
     // search tree.
     static constexpr auto VIRTUAL_LOSS_COUNT = 3;
+
+    // Nodes come from the slab allocator of their tree, their children
+    // and edges are allocated from the same one.
+    static void* operator new(size_t size, NodePool& pool) {
+        return pool.allocate(size);
+    }
+    static void operator delete(void* ptr, NodePool&) {
+        NodePool::deallocate(ptr, sizeof(UCTNode));
+    }
+    static void operator delete(void* ptr, size_t size) {
+        NodePool::deallocate(ptr, size);
+    }
+
+    // The edge to a child. The move, prior and search statistics of a
+    // child are only kept here, in the parent, so with transpositions
+    // every parent selects on the visits that went through its own edge.
+    class Edge {
+    public:
+        Edge() = default;
+        explicit operator bool() const { return m_block != nullptr; }
+        int get_move() const;
+        float get_prior() const;
+        int get_visits() const;
+        double get_blackevals() const;
+        // Winrate for tomove of the visits through the edge, virtual
+        // losses included. The edge must have been visited.
+        float get_eval(int tomove) const;
+        bool valid() const;
+        bool active() const;
+        // The child, nullptr if it was never inflated.
+        UCTNode* get() const;
+        UCTNode* inflate() const;
+
+    private:
+        friend class UCTNode;
+        friend class TreeSnapshot;
+        Edge(EdgeBlock* block, size_t slot) : m_block(block), m_slot(slot) {}
+        EdgeBlock* m_block{nullptr};
+        size_t m_slot{0};
+    };
+
+    // The edges of a node in order, for range-based for loops.
+    class EdgeRange {
+    public:
+        class iterator {
+        public:
+            Edge operator*() const { return Edge(m_block, m_slot); }
+            iterator& operator++();
+            bool operator!=(const iterator& other) const {
+                return m_left != other.m_left;
+            }
+
+        private:
+            friend class EdgeRange;
+            iterator(EdgeBlock* block, size_t left)
+                : m_block(block), m_left(left) {}
+            EdgeBlock* m_block;
+            size_t m_slot{0};
+            size_t m_left;
+        };
+        iterator begin() const { return iterator(m_first, m_size); }
+        iterator end() const { return iterator(nullptr, 0); }
+        size_t size() const { return m_size; }
+
+    private:
+        friend class UCTNode;
+        EdgeRange(EdgeBlock* first, size_t size)
+            : m_first(first), m_size(size) {}
+        EdgeBlock* m_first;
+        size_t m_size;
+    };
+
     // Defined in UCTNode.cpp
-    explicit UCTNode(int vertex, float score);
+    explicit UCTNode(int vertex);
     UCTNode() = delete;
-    ~UCTNode() = default;
+    ~UCTNode();
 
     bool create_children(std::atomic<int>& nodecount,
                          GameState& state, float& eval,
                          float min_psa_ratio = 0.0f);
+    // create_children split in two, for callers that evaluate the
+    // position themselves (batched search). A successful
+    // acquire_expansion must always be followed by expand_children.
+    bool acquire_expansion(const GameState& state,
+                           float min_psa_ratio = 0.0f);
+    float expand_children(std::atomic<int>& nodecount,
+                          GameState& state,
+                          const Network::Netresult& raw_netlist,
+                          float min_psa_ratio = 0.0f);
 
-    const std::vector<UCTNodePointer>& get_children() const;
+    size_t get_num_children() const;
+    Edge get_edge(size_t edge) const;
+    EdgeRange get_edges() const;
+    // Reordering moves the edges in place, no search may be running on
+    // the node.
     void sort_children(int color);
-    UCTNode& get_best_root_child(int color);
-    UCTNode* uct_select_child(int color, bool is_root);
+    Edge get_best_root_child(int color);
+    // Picks the child to descend into and adds a virtual loss to the
+    // edge leading to it. edge receives the index of that child, for
+    // the edge functions below.
+    UCTNode* uct_select_child(int color, bool is_root, size_t& edge);
+    void update_edge(size_t edge, float eval);
+    // Account for visits made below the child at edge while it was
+    // searched as the root, as if they had passed through this node.
+    void add_child_visits(size_t edge, int visits, double blackevals);
+    void virtual_loss_undo_edge(size_t edge);
+    // Invalid and pruned are properties of the edge, not of the child.
+    void invalidate_child(size_t edge);
+    void set_child_active(size_t edge, bool active);
+
+    // Nodes are reference counted so that transposed positions can share
+    // them. Every parent holds a reference, as does the transposition
+    // table. add_reference fails when the count is saturated.
+    bool add_reference();
+    static void drop_reference(UCTNode* node);
+    // Replace the fresh child expected at edge by shared, if no other
+    // thread is using it. Returns whether it did.
+    bool share_child(size_t edge, UCTNode* expected, UCTNode* shared);
 
     size_t count_nodes() const;
+    // Turn children with fewer than min_visits visits back into leaves,
+    // except the most visited one, those a search thread is below and
+    // those another parent shares. Edge statistics are kept. The cut off
+    // nodes are appended to garbage for the caller to free. Recurses into
+    // the kept children.
+    void recycle_subtrees(int min_visits, std::vector<UCTNode*>& garbage);
     SMP::Mutex& get_mutex();
     bool first_visit() const;
     bool has_children() const;
     bool expandable(const float min_psa_ratio = 0.0f) const;
-    void invalidate();
-    void set_active(const bool active);
-    bool valid() const;
-    bool active() const;
     int get_move() const;
+    // A node's statistics are its own network eval, once it has been
+    // expanded, plus whatever went through its edges.
     int get_visits() const;
-    float get_score() const;
-    void set_score(float score);
     float get_eval(int tomove) const;
     float get_net_eval(int tomove) const;
-    void virtual_loss(void);
-    void virtual_loss_undo(void);
-    void update(float eval);
+    double get_blackevals() const;
+
+    // The priors of the children, by move.
+    using PriorList = std::vector<std::pair<int, float>>;
 
     // Defined in UCTNodeRoot.cpp, only to be called on m_root in UCTSearch
     void randomize_first_proportionally();
-    void prepare_root_node(int color,
-                           std::atomic<int>& nodecount,
-                           GameState& state);
+    // Returns the priors from before the root noise was mixed in, empty
+    // without noise, for strip_noise once the search is over.
+    PriorList prepare_root_node(int color,
+                                std::atomic<int>& nodecount,
+                                GameState& state);
+    void strip_noise(const PriorList& priors);
 
-    UCTNode* get_first_child() const;
-    UCTNode* get_nopass_child(FastState& state) const;
-    std::unique_ptr<UCTNode> find_child(const int move);
+    Edge get_nopass_child(FastState& state) const;
+    UCTNodeHandle find_child(const int move);
+    UCTNode* get_child(const int move, size_t& edge);
+    // Hang a subtree below the edge for its move, in place of whatever
+    // was there. No search may be running on the node.
+    void set_child(size_t edge, UCTNodeHandle child);
     void inflate_all_children();
 
 private:
@@ -88,13 +215,65 @@ private:
         PRUNED,
         ACTIVE
     };
+
+    // The edges linked by one expansion, as parallel arrays so that
+    // uct_select_child scans contiguous memory instead of dereferencing
+    // every child. A block is sized to the children it was created for
+    // and widening the node appends another one. Blocks never move while
+    // the node lives, as search threads update them without the lock.
+    struct EdgeBlock {
+        static size_t bytes(size_t capacity);
+        static EdgeBlock* create(size_t capacity, NodePool& pool);
+        static void destroy(EdgeBlock* block);
+
+        void init(size_t slot, int move, float prior);
+        // The arrays follow the block, widest type first.
+        std::atomic<double>* blackevals() {
+            return reinterpret_cast<std::atomic<double>*>(this + 1);
+        }
+        UCTNodePointer* children() {
+            return reinterpret_cast<UCTNodePointer*>(blackevals() + capacity);
+        }
+        std::atomic<int>* visits() {
+            return reinterpret_cast<std::atomic<int>*>(children() + capacity);
+        }
+        float* priors() {
+            return reinterpret_cast<float*>(visits() + capacity);
+        }
+        std::atomic<std::int16_t>* virtual_loss() {
+            return reinterpret_cast<std::atomic<std::int16_t>*>(
+                priors() + capacity);
+        }
+        std::atomic<Status>* status() {
+            return reinterpret_cast<std::atomic<Status>*>(
+                virtual_loss() + capacity);
+        }
+
+        EdgeBlock* next{nullptr};
+        size_t capacity;
+    };
+
+    // The statistics of one edge moved out of its block, for reordering.
+    struct EdgeCopy {
+        UCTNodePointer child;
+        double blackevals;
+        int visits;
+        float prior;
+        std::int16_t virtual_loss;
+        Status status;
+    };
+
     void link_nodelist(std::atomic<int>& nodecount,
                        std::vector<Network::ScoreVertexPair>& nodelist,
                        float min_psa_ratio);
-    double get_blackevals() const;
-    void accumulate_eval(float eval);
+    // Makes room for count more edges, to be initialized before
+    // m_num_children is raised.
+    void reserve_edges(size_t count);
+    // Keep the edges at the given indices, in that order.
+    void reorder_edges(const std::vector<size_t>& order);
     void kill_superkos(const KoState& state);
     void dirichlet_noise(float epsilon, float alpha);
+    size_t count_nodes(std::unordered_set<const UCTNode*>* seen) const;
 
     // Note : This class is very size-sensitive as we are going to create
     // tens of millions of instances of these.  Please put extra caution
@@ -102,22 +281,18 @@ private:
 
     // Move
     std::int16_t m_move;
-    // UCT
-    std::atomic<std::int16_t> m_virtual_loss{0};
-    std::atomic<int> m_visits{0};
-    // UCT eval
-    float m_score;
+    // Number of edges in use, published once they are initialized.
+    std::atomic<std::uint16_t> m_num_children{0};
     // Original net eval for this node (not children).
     float m_net_eval{0.0f};
-    std::atomic<double> m_blackevals{0.0};
-    std::atomic<Status> m_status{ACTIVE};
     // Is someone adding scores to this node?
     bool m_is_expanding{false};
     SMP::Mutex m_nodemutex;
+    std::atomic<std::uint8_t> m_refs{1};
 
     // Tree data
     std::atomic<float> m_min_psa_ratio_children{2.0f};
-    std::vector<UCTNodePointer> m_children;
+    EdgeBlock* m_edges{nullptr};
 };
 
 #endif
@@ -27,30 +27,31 @@
 
 UCTNodePointer::~UCTNodePointer() {
     if (is_inflated()) {
-        delete read_ptr();
+        UCTNode::drop_reference(read_ptr());
     }
 }
 
 UCTNodePointer::UCTNodePointer(UCTNodePointer&& n) {
     if (is_inflated()) {
-        delete read_ptr();
+        UCTNode::drop_reference(read_ptr());
     }
     m_data = n.m_data;
     n.m_data = 1; // non-inflated garbage
 }
 
-UCTNodePointer::UCTNodePointer(std::int16_t vertex, float score) {
-    std::uint32_t i_score;
+UCTNodePointer::UCTNodePointer(std::int16_t vertex) {
     auto i_vertex = static_cast<std::uint16_t>(vertex);
-    std::memcpy(&i_score, &score, sizeof(i_score));
+    m_data = (static_cast<std::uint64_t>(i_vertex) << 16) | 1ULL;
+}
 
-    m_data =  (static_cast<std::uint64_t>(i_score)  << 32)
-            | (static_cast<std::uint64_t>(i_vertex) << 16) | 1ULL;
+UCTNodePointer::UCTNodePointer(UCTNode* node) {
+    m_data = reinterpret_cast<std::uint64_t>(node);
+    assert(is_inflated());
 }
 
 UCTNodePointer& UCTNodePointer::operator=(UCTNodePointer&& n) {
     if (is_inflated()) {
-        delete read_ptr();
+        UCTNode::drop_reference(read_ptr());
     }
     m_data = n.m_data;
     n.m_data = 1;
@@ -61,33 +62,7 @@ UCTNodePointer& UCTNodePointer::operator=(UCTNodePointer&& n) {
 void UCTNodePointer::inflate() const {
     if (is_inflated()) return;
     m_data = reinterpret_cast<std::uint64_t>(
-        new UCTNode(read_vertex(), read_score()));
-}
-
-bool UCTNodePointer::valid() const {
-    if (is_inflated()) return read_ptr()->valid();
-    return true;
-}
-
-int UCTNodePointer::get_visits() const {
-    if (is_inflated()) return read_ptr()->get_visits();
-    return 0;
-}
-
-float UCTNodePointer::get_score() const {
-    if (is_inflated()) return read_ptr()->get_score();
-    return read_score();
-}
-
-bool UCTNodePointer::active() const {
-    if (is_inflated()) return read_ptr()->active();
-    return true;
-}
-
-float UCTNodePointer::get_eval(int tomove) const {
-    // this can only be called if it is an inflated pointer
-    assert(is_inflated());
-    return read_ptr()->get_eval(tomove);
+        new (NodePool::of(this)) UCTNode(read_vertex()));
 }
 
 int UCTNodePointer::get_move() const {
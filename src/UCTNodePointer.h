@@ -30,14 +30,15 @@
 
 class UCTNode;
 
-// 'lazy-initializable' version of std::unique_ptr<UCTNode>.
+// 'lazy-initializable' version of UCTNodeHandle.
 // When a UCTNodePointer is constructed, the constructor arguments
 // are stored instead of constructing the actual UCTNode instance.
 // Later when the UCTNode is needed, the external code calls inflate()
 // which actually constructs the UCTNode. Basically, this is a 'tagged union'
 // of:
-//  - std::unique_ptr<UCTNode> pointer;
-//  - std::pair<float, std::int16_t> args;
+//  - UCTNodeHandle pointer;
+//  - std::int16_t vertex;
+// The prior and statistics of the child are kept by the parent's edges.
 
 // WARNING : inflate() is not thread-safe and hence has to be protected
 // by an external lock.
@@ -46,7 +47,7 @@ class UCTNodePointer {
 private:
     // the raw storage used here.
     // if bit 0 is 0, m_data is the actual pointer.
-    // if bit 0 is 1, bit [31:16] is the vertex value, bit [63:32] is the score.
+    // if bit 0 is 1, bit [31:16] is the vertex value.
     // (C-style bit fields and unions are not portable)
     mutable uint64_t m_data = 1;
 
@@ -60,28 +61,19 @@ private:
         return static_cast<std::int16_t>(m_data >> 16);
     }
 
-    float read_score() const {
-        static_assert(sizeof(float) == 4,
-            "This code assumes floats are 32-bit");
-        assert(!is_inflated());
-
-        auto x = static_cast<std::uint32_t>(m_data >> 32);
-        float ret;
-        std::memcpy(&ret, &x, sizeof(ret));
-        return ret;
-    }
-
 public:
     ~UCTNodePointer();
     UCTNodePointer(UCTNodePointer&& n);
-    UCTNodePointer(std::int16_t vertex, float score);
+    explicit UCTNodePointer(std::int16_t vertex);
+    // Takes over a reference to an existing node.
+    explicit UCTNodePointer(UCTNode* node);
     UCTNodePointer(const UCTNodePointer&) = delete;
 
     bool is_inflated() const {
         return (m_data & 1ULL) == 0;
     }
 
-    // methods from std::unique_ptr<UCTNode>
+    // methods from UCTNodeHandle
     typename std::add_lvalue_reference<UCTNode>::type operator*() const{
         return *read_ptr();
     }
@@ -98,18 +90,13 @@ public:
         return ret;
     }
 
-    // construct UCTNode instance from the vertex/score pair
+    // construct UCTNode instance from the vertex, in the pool
+    // this pointer was allocated from
     void inflate() const;
 
     // proxy of UCTNode methods which can be called without
     // constructing UCTNode
-    bool valid() const;
-    int get_visits() const;
-    float get_score() const;
-    bool active() const;
     int get_move() const;
-    // this can only be called if it is an inflated pointer
-    float get_eval(int tomove) const;
 };
 
 #endif
@@ -40,38 +40,29 @@
  * of UCTSearch and have been seperated to increase code clarity.
  */
 
-UCTNode* UCTNode::get_first_child() const {
-    if (m_children.empty()) {
-        return nullptr;
-    }
-
-    return m_children.front().get();
-}
-
 void UCTNode::kill_superkos(const KoState& state) {
-    for (auto& child : m_children) {
-        auto move = child->get_move();
+    auto legal = std::vector<size_t>{};
+    auto index = size_t{0};
+    for (const auto& edge : get_edges()) {
+        auto move = edge.get_move();
+        auto is_legal = true;
         if (move != FastBoard::PASS) {
             KoState mystate = state;
             mystate.play_move(move);
-
-            if (mystate.superko()) {
-                // Don't delete nodes for now, just mark them invalid.
-                child->invalidate();
-            }
+            is_legal = !mystate.superko();
+        }
+        if (is_legal) {
+            legal.emplace_back(index);
         }
+        index++;
     }
 
-    // Now do the actual deletion.
-    m_children.erase(
-        std::remove_if(begin(m_children), end(m_children),
-                       [](const auto &child) { return !child->valid(); }),
-        end(m_children)
-    );
+    LOCK(get_mutex(), lock);
+    reorder_edges(legal);
 }
 
 void UCTNode::dirichlet_noise(float epsilon, float alpha) {
-    auto child_cnt = m_children.size();
+    auto child_cnt = get_num_children();
 
     auto dirichlet_vector = std::vector<float>{};
     std::gamma_distribution<float> gamma(alpha, 1.0f);
@@ -93,11 +84,11 @@ void UCTNode::dirichlet_noise(float epsilon, float alpha) {
     }
 
     child_cnt = 0;
-    for (auto& child : m_children) {
-        auto score = child->get_score();
+    for (const auto& edge : get_edges()) {
+        auto score = edge.get_prior();
         auto eta_a = dirichlet_vector[child_cnt++];
         score = score * (1 - epsilon) + epsilon * eta_a;
-        child->set_score(score);
+        edge.m_block->priors()[edge.m_slot] = score;
     }
 }
 
@@ -106,8 +97,8 @@ void UCTNode::randomize_first_proportionally() {
     auto norm_factor = 0.0;
     auto accum_vector = std::vector<double>{};
 
-    for (const auto& child : m_children) {
-        auto visits = child->get_visits();
+    for (const auto& edge : get_edges()) {
+        auto visits = edge.get_visits();
         if (norm_factor == 0.0) {
             norm_factor = visits;
             // Nonsensical options? End of game?
@@ -137,33 +128,39 @@ void UCTNode::randomize_first_proportionally() {
         return;
     }
 
-    assert(m_children.size() > index);
+    assert(get_num_children() > index);
 
     // Now swap the child at index with the first child
-    std::iter_swap(begin(m_children), begin(m_children) + index);
+    auto order = std::vector<size_t>(get_num_children());
+    std::iota(begin(order), end(order), size_t{0});
+    std::swap(order[0], order[index]);
+    LOCK(get_mutex(), lock);
+    reorder_edges(order);
 }
 
-UCTNode* UCTNode::get_nopass_child(FastState& state) const {
-    for (const auto& child : m_children) {
+UCTNode::Edge UCTNode::get_nopass_child(FastState& state) const {
+    for (const auto& edge : get_edges()) {
         /* If we prevent the engine from passing, we must bail out when
            we only have unreasonable moves to pick, like filling eyes.
            Note that this knowledge isn't required by the engine,
            we require it because we're overruling its moves. */
-        if (child->m_move != FastBoard::PASS
-            && !state.board.is_eye(state.get_to_move(), child->m_move)) {
-            return child.get();
+        const auto move = edge.get_move();
+        if (move != FastBoard::PASS
+            && !state.board.is_eye(state.get_to_move(), move)) {
+            return edge;
         }
     }
-    return nullptr;
+    return Edge{};
 }
 
 // Used to find new root in UCTSearch.
-std::unique_ptr<UCTNode> UCTNode::find_child(const int move) {
-    for (auto& child : m_children) {
-        if (child.get_move() == move) {
+UCTNodeHandle UCTNode::find_child(const int move) {
+    for (const auto& edge : get_edges()) {
+        if (edge.get_move() == move) {
              // no guarantee that this is a non-inflated node
-            child.inflate();
-            return std::unique_ptr<UCTNode>(child.release());
+            edge.inflate();
+            return UCTNodeHandle(
+                edge.m_block->children()[edge.m_slot].release());
         }
     }
 
@@ -171,16 +168,36 @@ std::unique_ptr<UCTNode> UCTNode::find_child(const int move) {
     return nullptr;
 }
 
+// Used to find new root in UCTSearch, when the tree above it is kept.
+UCTNode* UCTNode::get_child(const int move, size_t& edge) {
+    auto index = size_t{0};
+    for (const auto& child : get_edges()) {
+        if (child.get_move() == move) {
+            edge = index;
+            return child.inflate();
+        }
+        index++;
+    }
+    return nullptr;
+}
+
+// Used to keep the tree when the root goes back before the anchor.
+void UCTNode::set_child(const size_t edge, UCTNodeHandle child) {
+    const auto e = get_edge(edge);
+    assert(e.get_move() == child->get_move());
+    e.m_block->children()[e.m_slot] = UCTNodePointer(child.release());
+}
+
 void UCTNode::inflate_all_children() {
-    for (const auto& node : get_children()) {
-        node.inflate();
+    for (const auto& edge : get_edges()) {
+        edge.inflate();
     }
 }
 
-void UCTNode::prepare_root_node(int color,
-                                std::atomic<int>& nodes,
-                                GameState& root_state) {
-    float root_eval;
+UCTNode::PriorList UCTNode::prepare_root_node(int color,
+                                              std::atomic<int>& nodes,
+                                              GameState& root_state) {
+    auto root_eval = 0.5f;
     const auto had_children = has_children();
     if (expandable()) {
         create_children(nodes, root_state, root_eval);
@@ -188,7 +205,6 @@ void UCTNode::prepare_root_node(int color,
     if (had_children) {
         root_eval = get_eval(color);
     } else {
-        update(root_eval);
         root_eval = (color == FastBoard::BLACK ? root_eval : 1.0f - root_eval);
     }
     Utils::myprintf("NN eval=%f\n", root_eval);
@@ -201,9 +217,28 @@ void UCTNode::prepare_root_node(int color,
     // This also removes a lot of special cases.
     kill_superkos(root_state);
 
+    auto priors = PriorList{};
     if (cfg_noise) {
+        for (const auto& edge : get_edges()) {
+            priors.emplace_back(edge.get_move(), edge.get_prior());
+        }
         // Adjust the Dirichlet noise's alpha constant to the board size
         auto alpha = 0.03f * 361.0f / BOARD_SQUARES;
         dirichlet_noise(0.25f, alpha);
     }
+    return priors;
+}
+
+void UCTNode::strip_noise(const PriorList& priors) {
+    // Children may have been removed or reordered since, and more may
+    // have been added without noise, so match them by move.
+    for (const auto& edge : get_edges()) {
+        const auto prior = std::find_if(begin(priors), end(priors),
+            [&edge](const std::pair<int, float>& p) {
+                return p.first == edge.get_move();
+            });
+        if (prior != end(priors)) {
+            edge.m_block->priors()[edge.m_slot] = prior->second;
+        }
+    }
 }
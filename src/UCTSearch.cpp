@@ -19,21 +19,29 @@
 #include "config.h"
 #include "UCTSearch.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
+#include <iterator>
 #include <limits>
 #include <memory>
 #include <type_traits>
+#include <unordered_set>
+#include <vector>
 
 #include "FastBoard.h"
 #include "FastState.h"
 #include "FullBoard.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "Network.h"
+#include "NodePool.h"
 #include "TimeControl.h"
 #include "Timing.h"
 #include "Training.h"
+#include "TreeSnapshot.h"
 #include "Utils.h"
 
 using namespace Utils;
@@ -41,99 +49,279 @@ using namespace Utils;
 constexpr int UCTSearch::UNLIMITED_PLAYOUTS;
 
 UCTSearch::UCTSearch(GameState& g)
-    : m_rootstate(g) {
+    : m_rootstate(g), m_pool(std::make_unique<NodePool>()) {
     set_playout_limit(cfg_max_playouts);
     set_visit_limit(cfg_max_visits);
-    m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    set_memory_limit(cfg_max_tree_memory);
+    m_anchor.reset(new (*m_pool) UCTNode(FastBoard::PASS));
+    m_root = m_anchor.get();
 }
 
-bool UCTSearch::advance_to_new_rootstate() {
-    if (!m_root || !m_last_rootstate) {
-        // No current state
-        return false;
-    }
+UCTSearch::~UCTSearch() {
+    // The tree goes with its pool, without visiting the nodes.
+    finish_deletes();
+    m_transpositions.abandon();
+    m_anchor.release();
+}
 
-    if (m_rootstate.get_komi() != m_last_rootstate->get_komi()) {
-        return false;
+void UCTSearch::drop_tree(UCTNode* node) {
+    // Lazy tree destruction.  Instead of calling the destructor of the
+    // old root node on the main thread, send the old root to a separate
+    // thread and destroy it from the child thread.  This will save a
+    // bit of time when dealing with large trees.
+    ThreadGroup tg(thread_pool);
+    tg.add_task([node]() { UCTNode::drop_reference(node); });
+    m_delete_futures.push_back(std::move(tg));
+}
+
+void UCTSearch::finish_deletes() {
+    while (!m_delete_futures.empty()) {
+        m_delete_futures.front().wait_all();
+        m_delete_futures.pop_front();
     }
+    if (m_recycled.valid()) {
+        m_recycled.get();
+    }
+}
 
-    auto depth =
-        int(m_rootstate.get_movenum() - m_last_rootstate->get_movenum());
+void UCTSearch::replace_tree(std::unique_ptr<NodePool> pool,
+                             UCTNodeHandle anchor) {
+    // Nothing of the old tree is kept, so instead of releasing it node
+    // by node its pool is freed at once. Nothing may refer to the old
+    // nodes anymore, so the background deletes must be done first.
+    finish_deletes();
+    m_transpositions.abandon();
+    m_anchor.release();
+    const auto old_pool = m_pool.release();
+    ThreadGroup tg(thread_pool);
+    tg.add_task([old_pool]() { delete old_pool; });
+    m_delete_futures.push_back(std::move(tg));
+
+    m_pool = std::move(pool);
+    m_anchor = std::move(anchor);
+    m_root_priors.clear();
+    m_anchor_state = std::make_unique<GameState>(m_rootstate);
+    m_root = m_anchor.get();
+    m_root_path.clear();
+    m_root_visits = m_root->get_visits();
+    m_root_blackevals = m_root->get_blackevals();
+}
 
-    if (depth < 0) {
+bool UCTSearch::advance_to_new_rootstate() {
+    if (!m_anchor || !m_anchor_state || !m_last_rootstate) {
+        // No current state
         return false;
     }
 
+    if (m_rootstate.get_komi() != m_anchor_state->get_komi()) {
+        return false;
+    }
 
+    // Find the last position the game and the tree have in common, by
+    // taking back moves from both. If that is before the anchor, the
+    // anchor has to go back to it.
     auto test = std::make_unique<GameState>(m_rootstate);
-    for (auto i = 0; i < depth; i++) {
+    auto common = std::make_unique<GameState>(*m_anchor_state);
+    while (test->get_movenum() > common->get_movenum()) {
         test->undo_move();
     }
-
-    if (m_last_rootstate->board.get_hash() != test->board.get_hash()) {
-        // m_rootstate and m_last_rootstate don't match
-        return false;
+    while (common->get_movenum() > test->get_movenum()) {
+        common->undo_move();
     }
+    while (common->board.get_hash() != test->board.get_hash()) {
+        if (!common->undo_move() || !test->undo_move()) {
+            // m_rootstate isn't reachable from the anchor
+            return false;
+        }
+    }
+    const auto retreat =
+        int(m_anchor_state->get_movenum() - common->get_movenum());
+    const auto depth = int(m_rootstate.get_movenum() - common->get_movenum());
 
     // Make sure that the nodes we destroyed the previous move are
     // in fact destroyed.
-    while (!m_delete_futures.empty()) {
-        m_delete_futures.front().wait_all();
-        m_delete_futures.pop_front();
+    finish_deletes();
+
+    // The visits of the last searches are only in the old root, pass
+    // them up so the positions above it are up to date when revisited.
+    const auto new_visits = m_root->get_visits() - m_root_visits;
+    const auto new_blackevals = m_root->get_blackevals() - m_root_blackevals;
+    if (new_visits > 0) {
+        for (const auto& step : m_root_path) {
+            step.node->add_child_visits(step.edge, new_visits,
+                                        new_blackevals);
+        }
     }
 
-    // Try to replay moves advancing m_root
-    for (auto i = 0; i < depth; i++) {
-        ThreadGroup tg(thread_pool);
+    m_root_path.clear();
+    if (retreat > 0 && !retreat_anchor(*common, retreat)) {
+        return false;
+    }
 
+    // Replay the moves from the anchor to find the new root. Whatever
+    // was searched along other branches stays in the tree.
+    auto walk = std::make_unique<GameState>(*m_anchor_state);
+    auto node = m_anchor.get();
+    for (auto i = 0; i < depth; i++) {
         test->forward_move();
         const auto move = test->get_last_move();
 
-        auto oldroot = std::move(m_root);
-        m_root = oldroot->find_child(move);
-
-        // Lazy tree destruction.  Instead of calling the destructor of the
-        // old root node on the main thread, send the old root to a separate
-        // thread and destroy it from the child thread.  This will save a
-        // bit of time when dealing with large trees.
-        auto p = oldroot.release();
-        tg.add_task([p]() { delete p; });
-        m_delete_futures.push_back(std::move(tg));
-
-        if (!m_root) {
-            // Tree hasn't been expanded this far
+        auto edge = size_t{0};
+        const auto child = get_or_expand_child(*walk, node, move, edge);
+        if (!child) {
+            // Not a legal move in the tree
             return false;
         }
-        m_last_rootstate->play_move(move);
+        m_root_path.push_back({node, edge});
+        node = child;
+        walk->play_move(move);
     }
 
-    assert(m_rootstate.get_movenum() == m_last_rootstate->get_movenum());
+    assert(m_rootstate.get_movenum() == walk->get_movenum());
 
-    if (m_last_rootstate->board.get_hash() != test->board.get_hash()) {
+    if (walk->board.get_hash() != test->board.get_hash()) {
         // Can happen if user plays multiple moves in a row by same player
         return false;
     }
 
+    m_root = node;
+    m_root_visits = m_root->get_visits();
+    m_root_blackevals = m_root->get_blackevals();
+
+    trim_anchor();
+    return true;
+}
+
+UCTNode* UCTSearch::get_or_expand_child(GameState& state, UCTNode* node,
+                                        const int move, size_t& edge) {
+    auto child = node->get_child(move, edge);
+    if (!child && node->expandable()) {
+        // The search didn't get this far. Expand the node, so that the
+        // new root stays connected to the rest of the tree.
+        float eval;
+        node->create_children(m_nodes, state, eval);
+        child = node->get_child(move, edge);
+    }
+    return child;
+}
+
+bool UCTSearch::retreat_anchor(const GameState& state, const int moves) {
+    // The moves from state, an earlier position of the game, to the
+    // anchor.
+    auto path = std::vector<int>{};
+    auto back = std::make_unique<GameState>(*m_anchor_state);
+    for (auto i = 0; i < moves; i++) {
+        path.emplace_back(back->get_last_move());
+        back->undo_move();
+    }
+    std::reverse(begin(path), end(path));
+    if (m_anchor->get_move() != path.back()) {
+        return false;
+    }
+
+    // Build the positions from state down to the anchor, and hang the
+    // tree below the last of them.
+    auto anchor =
+        UCTNodeHandle(new (*m_pool) UCTNode(state.get_last_move()));
+    auto walk = std::make_unique<GameState>(state);
+    auto steps = std::vector<PathStep>{};
+    auto node = anchor.get();
+    for (const auto move : path) {
+        auto edge = size_t{0};
+        const auto child = get_or_expand_child(*walk, node, move, edge);
+        if (!child) {
+            return false;
+        }
+        steps.push_back({node, edge});
+        node = child;
+        walk->play_move(move);
+    }
+    const auto& last = steps.back();
+    last.node->set_child(last.edge, std::move(m_anchor));
+    // Bottom-up, every edge on the way takes over the statistics of the
+    // node below it, which include the evals of the nodes that were
+    // expanded to get there.
+    for (auto step = rbegin(steps); step != rend(steps); ++step) {
+        const auto edge = step->node->get_edge(step->edge);
+        const auto child = edge.get();
+        step->node->add_child_visits(step->edge,
+            child->get_visits() - edge.get_visits(),
+            child->get_blackevals() - edge.get_blackevals());
+    }
+
+    m_anchor = std::move(anchor);
+    m_anchor_state = std::make_unique<GameState>(state);
     return true;
 }
 
+void UCTSearch::trim_anchor() {
+    // Every node above the root keeps the branches that were searched
+    // from it. Give them up from the oldest position on if the whole
+    // tree would take too much of the room the search needs.
+    auto tree_nodes = m_anchor->count_nodes();
+    auto node_fullness = 1.0f / MAX_TREE_SIZE;
+    if (m_max_tree_memory > 0 && tree_nodes > 0) {
+        const auto node_bytes =
+            m_pool->get_used_bytes() / static_cast<float>(tree_nodes);
+        node_fullness = std::max(node_fullness,
+                                 node_bytes / m_max_tree_memory);
+    }
+    while (!m_root_path.empty()
+           && tree_nodes * node_fullness > KEPT_TREE_FULLNESS) {
+        const auto& step = m_root_path.front();
+        const auto move = step.node->get_edge(step.edge).get_move();
+        auto anchor = m_anchor->find_child(move);
+        drop_tree(m_anchor.release());
+        m_anchor = std::move(anchor);
+        m_anchor_state->play_move(move);
+        m_root_path.erase(begin(m_root_path));
+        tree_nodes = m_anchor->count_nodes();
+    }
+}
+
 void UCTSearch::update_root() {
     // Definition of m_playouts is playouts per search call.
     // So reset this count now.
     m_playouts = 0;
 
+    // The root noise is drawn for one search, take it out before the
+    // node is searched as anything else.
+    m_root->strip_noise(m_root_priors);
+    m_root_priors.clear();
+
 #ifndef NDEBUG
     auto start_nodes = m_root->count_nodes();
 #endif
 
-    if (!advance_to_new_rootstate() || !m_root) {
-        m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    if (!advance_to_new_rootstate()) {
+        auto pool = std::make_unique<NodePool>();
+        auto anchor = UCTNodeHandle(
+            new (*pool) UCTNode(m_rootstate.get_last_move()));
+        replace_tree(std::move(pool), std::move(anchor));
     }
     // Clear last_rootstate to prevent accidental use.
     m_last_rootstate.reset(nullptr);
 
+    // Transpositions are only tracked within a search. Parts of the old
+    // tree may only be held by the table, release them in the background.
+    {
+        ThreadGroup tg(thread_pool);
+        tg.add_task(m_transpositions.clear());
+        m_delete_futures.push_back(std::move(tg));
+    }
+
+    // Subtrees recycled during the last search are not part of the
+    // tree anymore, just make sure they are gone.
+    finish_recycling();
+    m_recycle_visits = 2;
+    m_can_recycle = true;
+
     // Check how big our search tree (reused or new) is.
     m_nodes = m_root->count_nodes();
+    m_kept_nodes = 0;
+    if (m_root != m_anchor.get()) {
+        m_kept_nodes = static_cast<int>(m_anchor->count_nodes()) - m_nodes;
+    }
 
 #ifndef NDEBUG
     if (m_nodes > 0) {
@@ -143,8 +331,95 @@ void UCTSearch::update_root() {
 #endif
 }
 
+float UCTSearch::get_tree_fullness() const {
+    auto fullness =
+        (m_nodes + m_kept_nodes) / static_cast<float>(MAX_TREE_SIZE);
+    if (m_max_tree_memory > 0) {
+        fullness = std::max(fullness,
+            m_pool->get_used_bytes() / static_cast<float>(m_max_tree_memory));
+    }
+    return fullness;
+}
+
+bool UCTSearch::tree_is_full() const {
+    return get_tree_fullness() >= 1.0f;
+}
+
+void UCTSearch::recycle_tree() {
+    if (m_recycled.valid()) {
+        if (m_recycled.wait_for(std::chrono::seconds(0))
+            != std::future_status::ready) {
+            return;
+        }
+        m_nodes -= static_cast<int>(m_recycled.get());
+        // The last pass didn't make enough room, cut deeper.
+        if (get_tree_fullness() >= RECYCLE_FULLNESS) {
+            m_recycle_visits *= 2;
+        }
+    }
+    if (!m_can_recycle || get_tree_fullness() < RECYCLE_FULLNESS) {
+        return;
+    }
+    // The search goes on while the pass runs, leaves that can't be
+    // expanded meanwhile are evaluated without keeping their children.
+    m_recycled = thread_pool.add_task([this]() { return free_subtrees(); });
+}
+
+void UCTSearch::finish_recycling() {
+    if (m_recycled.valid()) {
+        m_nodes -= static_cast<int>(m_recycled.get());
+    }
+}
+
+size_t UCTSearch::free_subtrees() {
+    // The transposition table holds on to every node it registered, let
+    // go of them so that the subtrees cut off below can be freed.
+    if (cfg_transpositions) {
+        m_transpositions.release_positions()();
+    }
+
+    // Cut off subtrees below children that are neither on the principal
+    // variation nor have many visits. Their edge statistics stay, so
+    // the search carries on as if they were never expanded.
+    auto garbage = std::vector<UCTNode*>{};
+    while (garbage.empty() && m_recycle_visits <= m_root->get_visits()) {
+        m_root->recycle_subtrees(m_recycle_visits, garbage);
+        if (garbage.empty()) {
+            m_recycle_visits *= 2;
+        }
+    }
+    if (garbage.empty()) {
+        m_can_recycle = false;
+        return 0;
+    }
+
+    myprintf("Tree is %.0f%% full, recycling %d subtrees below %d visits.\n",
+             100.0f * get_tree_fullness(), static_cast<int>(garbage.size()),
+             m_recycle_visits);
+    // With transpositions, nodes further down may still be shared with
+    // the rest of the tree. They are counted all the same, m_nodes is
+    // only a limit and is counted again at the next search.
+    auto nodes = size_t{0};
+    for (const auto node : garbage) {
+        nodes += node->count_nodes();
+        UCTNode::drop_reference(node);
+    }
+    return nodes;
+}
+
+float UCTSearch::evaluate_leaf(const GameState& state) const {
+    const auto raw_netlist = Network::get_scored_moves(
+        &state, Network::Ensemble::RANDOM_SYMMETRY);
+    // DCNN returns winrate as side to move, the search is from black's
+    // point of view.
+    if (state.board.white_to_move()) {
+        return 1.0f - raw_netlist.winrate;
+    }
+    return raw_netlist.winrate;
+}
+
 float UCTSearch::get_min_psa_ratio() const {
-    const auto mem_full = m_nodes / static_cast<float>(MAX_TREE_SIZE);
+    const auto mem_full = get_tree_fullness();
     // If we are halfway through our memory budget, start trimming
     // moves with very low policy priors.
     if (mem_full > 0.5f) {
@@ -162,13 +437,11 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
     const auto color = currstate.get_to_move();
     auto result = SearchResult{};
 
-    node->virtual_loss();
-
     if (node->expandable()) {
         if (currstate.get_passes() >= 2) {
             auto score = currstate.final_score();
             result = SearchResult::from_score(score);
-        } else if (m_nodes < MAX_TREE_SIZE) {
+        } else if (!tree_is_full()) {
             float eval;
             const auto had_children = node->has_children();
             const auto success =
@@ -177,27 +450,177 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
             if (!had_children && success) {
                 result = SearchResult::from_eval(eval);
             }
+        } else if (!node->has_children()) {
+            result = SearchResult::from_eval(evaluate_leaf(currstate));
         }
     }
 
     if (node->has_children() && !result.valid()) {
-        auto next = node->uct_select_child(color, node == m_root.get());
+        auto edge = size_t{0};
+        auto next = node->uct_select_child(color, node == m_root, edge);
         auto move = next->get_move();
 
-        currstate.play_move(move);
+        currstate.push_move(move);
         if (move != FastBoard::PASS && currstate.superko()) {
-            next->invalidate();
+            node->invalidate_child(edge);
         } else {
+            if (cfg_transpositions && next->first_visit()) {
+                next = find_transposition(node, edge, next, currstate);
+            }
             result = play_simulation(currstate, next);
+            if (result.valid()) {
+                node->update_edge(edge, result.eval());
+            }
         }
+        currstate.pop_move();
+        node->virtual_loss_undo_edge(edge);
     }
 
-    if (result.valid()) {
-        node->update(result.eval());
+    return result;
+}
+
+SearchResult UCTSearch::select_leaf(GameState& currstate, UCTNode* node,
+                                    std::vector<PathStep>& path,
+                                    bool& needs_eval) {
+    // Same descent as play_simulation, but instead of evaluating the
+    // leaf it is claimed for expansion and left with its virtual losses
+    // applied, so other descents in the same batch go elsewhere.
+    needs_eval = false;
+    for (;;) {
+        const auto color = currstate.get_to_move();
+
+        path.push_back({node, NO_EDGE});
+
+        if (node->expandable()) {
+            if (currstate.get_passes() >= 2) {
+                auto score = currstate.final_score();
+                return SearchResult::from_score(score);
+            } else if (!tree_is_full()) {
+                if (!node->has_children()) {
+                    needs_eval =
+                        node->acquire_expansion(currstate,
+                                                get_min_psa_ratio());
+                    return SearchResult{};
+                }
+                // Widening a node we already have children for, the
+                // network result is in the cache so do it in place.
+                float eval;
+                node->create_children(m_nodes, currstate, eval,
+                                      get_min_psa_ratio());
+            } else if (!node->has_children()) {
+                // No room to expand it, so nothing to batch for.
+                return SearchResult::from_eval(evaluate_leaf(currstate));
+            }
+        }
+
+        if (!node->has_children()) {
+            return SearchResult{};
+        }
+
+        auto edge = size_t{0};
+        auto next = node->uct_select_child(color, node == m_root, edge);
+        auto move = next->get_move();
+        path.back().edge = edge;
+
+        currstate.push_move(move);
+        if (move != FastBoard::PASS && currstate.superko()) {
+            node->invalidate_child(edge);
+            return SearchResult{};
+        }
+        if (cfg_transpositions && next->first_visit()) {
+            next = find_transposition(node, edge, next, currstate);
+        }
+        node = next;
     }
-    node->virtual_loss_undo();
+}
 
-    return result;
+void UCTSearch::backup(const std::vector<PathStep>& path,
+                       const SearchResult& result) {
+    for (auto step = rbegin(path); step != rend(path); ++step) {
+        const auto node = step->node;
+        if (step->edge != NO_EDGE) {
+            if (result.valid()) {
+                node->update_edge(step->edge, result.eval());
+            }
+            node->virtual_loss_undo_edge(step->edge);
+        }
+    }
+}
+
+UCTNode* UCTSearch::find_transposition(UCTNode* const parent,
+                                       const size_t edge,
+                                       UCTNode* const child,
+                                       const GameState& state) {
+    const auto key = TranspositionTable::get_key(state);
+    const auto shared = m_transpositions.find_or_insert(key, child);
+    if (!shared || shared == child) {
+        return child;
+    }
+    const auto is_shared = parent->share_child(edge, child, shared);
+    UCTNode::drop_reference(shared);
+    if (!is_shared) {
+        return child;
+    }
+    // The parent now points to the shared node. Nodes and edges keep
+    // separate statistics, so every parent still selects on the visits
+    // that went through its own edge.
+    m_transpositions.retire(child);
+    return shared;
+}
+
+int UCTSearch::play_simulation_batch(PlayoutScratch& scratch,
+                                     UCTNode* const root,
+                                     int batch_size) {
+    assert(size_t(batch_size) <= scratch.states.size());
+    const auto min_psa_ratio = get_min_psa_ratio();
+    auto& pending = scratch.pending;
+    auto playouts = 0;
+
+    pending.clear();
+    for (auto i = 0; i < batch_size; i++) {
+        auto& state = scratch.states[i];
+        auto& path = scratch.paths[i];
+        path.clear();
+        auto needs_eval = false;
+        auto result = select_leaf(state, root, path, needs_eval);
+        if (needs_eval) {
+            pending.emplace_back(i);
+        } else {
+            // Terminal position or nothing to do, no need to wait.
+            backup(path, result);
+            state.pop_all_moves();
+            if (result.valid()) {
+                playouts++;
+            }
+        }
+        if (!m_run) {
+            break;
+        }
+    }
+
+    if (pending.empty()) {
+        return playouts;
+    }
+
+    auto& states = scratch.eval_states;
+    states.clear();
+    for (const auto i : pending) {
+        states.emplace_back(&scratch.states[i]);
+    }
+    const auto netresults = Network::get_scored_moves_batch(
+        states, Network::Ensemble::RANDOM_SYMMETRY);
+
+    for (auto j = size_t{0}; j < pending.size(); j++) {
+        auto& state = scratch.states[pending[j]];
+        const auto& path = scratch.paths[pending[j]];
+        const auto eval = path.back().node->expand_children(
+            m_nodes, state, netresults[j], min_psa_ratio);
+        backup(path, SearchResult::from_eval(eval));
+        state.pop_all_moves();
+        playouts++;
+    }
+
+    return playouts;
 }
 
 void UCTSearch::dump_stats(FastState & state, UCTNode & parent) {
@@ -210,26 +633,27 @@ void UCTSearch::dump_stats(FastState & state, UCTNode & parent) {
     // sort children, put best move on top
     parent.sort_children(color);
 
-    if (parent.get_first_child()->first_visit()) {
+    if (parent.get_edge(0).get_visits() == 0) {
         return;
     }
 
     int movecount = 0;
-    for (const auto& node : parent.get_children()) {
+    for (const auto& edge : parent.get_edges()) {
         // Always display at least two moves. In the case there is
         // only one move searched the user could get an idea why.
-        if (++movecount > 2 && !node->get_visits()) break;
+        if (++movecount > 2 && !edge.get_visits()) break;
 
-        std::string move = state.move_to_text(node->get_move());
+        std::string move = state.move_to_text(edge.get_move());
         FastState tmpstate = state;
-        tmpstate.play_move(node->get_move());
-        std::string pv = move + " " + get_pv(tmpstate, *node);
+        tmpstate.play_move(edge.get_move());
+        std::string pv = move + " "
+                         + (edge.get() ? get_pv(tmpstate, *edge.get()) : "");
 
         myprintf("%4s -> %7d (V: %5.2f%%) (N: %5.2f%%) PV: %s\n",
             move.c_str(),
-            node->get_visits(),
-            node->get_visits() ? node->get_eval(color)*100.0f : 0.0f,
-            node->get_score() * 100.0f,
+            edge.get_visits(),
+            edge.get_visits() ? edge.get_eval(color)*100.0f : 0.0f,
+            edge.get_prior() * 100.0f,
             pv.c_str());
     }
     tree_stats(parent);
@@ -238,18 +662,23 @@ void UCTSearch::dump_stats(FastState & state, UCTNode & parent) {
 void tree_stats_helper(const UCTNode& node, size_t depth,
                        size_t& nodes, size_t& non_leaf_nodes,
                        size_t& depth_sum, size_t& max_depth,
-                       size_t& children_count) {
+                       size_t& children_count,
+                       std::unordered_set<const UCTNode*>* seen) {
     nodes += 1;
     non_leaf_nodes += node.get_visits() > 1;
     depth_sum += depth;
     if (depth > max_depth) max_depth = depth;
 
-    for (const auto& child : node.get_children()) {
-        if (child.get_visits() > 0) {
+    for (const auto& edge : node.get_edges()) {
+        const auto child = edge.get();
+        if (child && child->has_children()) {
+            if (seen && !seen->insert(child).second) {
+                continue;
+            }
             children_count += 1;
-            tree_stats_helper(*(child.get()), depth+1,
+            tree_stats_helper(*child, depth+1,
                               nodes, non_leaf_nodes, depth_sum,
-                              max_depth, children_count);
+                              max_depth, children_count, seen);
         } else {
             nodes += 1;
             depth_sum += depth+1;
@@ -264,9 +693,12 @@ void UCTSearch::tree_stats(const UCTNode& node) {
     size_t depth_sum = 0;
     size_t max_depth = 0;
     size_t children_count = 0;
+    // With transpositions the tree is a DAG, visit shared nodes once.
+    auto seen = std::unordered_set<const UCTNode*>{};
     tree_stats_helper(node, 0,
                       nodes, non_leaf_nodes, depth_sum,
-                      max_depth, children_count);
+                      max_depth, children_count,
+                      cfg_transpositions ? &seen : nullptr);
 
     if (nodes > 0) {
         myprintf("%.1f average depth, %d max depth\n",
@@ -339,25 +771,25 @@ int UCTSearch::get_best_move(passflag_t passflag) {
         m_root->randomize_first_proportionally();
     }
 
-    auto first_child = m_root->get_first_child();
-    assert(first_child != nullptr);
+    assert(m_root->get_num_children() > 0);
+    const auto first_child = m_root->get_edge(0);
 
-    auto bestmove = first_child->get_move();
-    auto bestscore = first_child->get_eval(color);
+    auto bestmove = first_child.get_move();
+    auto bestscore = first_child.get_eval(color);
 
     // do we want to fiddle with the best move because of the rule set?
     if (passflag & UCTSearch::NOPASS) {
         // were we going to pass?
         if (bestmove == FastBoard::PASS) {
-            UCTNode * nopass = m_root->get_nopass_child(m_rootstate);
+            const auto nopass = m_root->get_nopass_child(m_rootstate);
 
-            if (nopass != nullptr) {
+            if (nopass) {
                 myprintf("Preferring not to pass.\n");
-                bestmove = nopass->get_move();
-                if (nopass->first_visit()) {
+                bestmove = nopass.get_move();
+                if (nopass.get_visits() == 0) {
                     bestscore = 1.0f;
                 } else {
-                    bestscore = nopass->get_eval(color);
+                    bestscore = nopass.get_eval(color);
                 }
             } else {
                 myprintf("Pass is the only acceptable move.\n");
@@ -390,14 +822,14 @@ int UCTSearch::get_best_move(passflag_t passflag) {
                 (score < 0.0f && color == FastBoard::BLACK)) {
                 myprintf("Passing loses :-(\n");
                 // Find a valid non-pass move.
-                UCTNode * nopass = m_root->get_nopass_child(m_rootstate);
-                if (nopass != nullptr) {
+                const auto nopass = m_root->get_nopass_child(m_rootstate);
+                if (nopass) {
                     myprintf("Avoiding pass because it loses.\n");
-                    bestmove = nopass->get_move();
-                    if (nopass->first_visit()) {
+                    bestmove = nopass.get_move();
+                    if (nopass.get_visits() == 0) {
                         bestscore = 1.0f;
                     } else {
-                        bestscore = nopass->get_eval(color);
+                        bestscore = nopass.get_eval(color);
                     }
                 } else {
                     myprintf("No alternative to passing.\n");
@@ -440,8 +872,8 @@ std::string UCTSearch::get_pv(FastState & state, UCTNode& parent) {
         return std::string();
     }
 
-    auto& best_child = parent.get_best_root_child(state.get_to_move());
-    if (best_child.first_visit()) {
+    const auto best_child = parent.get_best_root_child(state.get_to_move());
+    if (best_child.get_visits() == 0) {
         return std::string();
     }
     auto best_move = best_child.get_move();
@@ -449,7 +881,7 @@ std::string UCTSearch::get_pv(FastState & state, UCTNode& parent) {
 
     state.play_move(best_move);
 
-    auto next = get_pv(state, best_child);
+    auto next = get_pv(state, *best_child.get());
     if (!next.empty()) {
         res.append(" ").append(next);
     }
@@ -461,6 +893,14 @@ void UCTSearch::dump_analysis(int playouts) {
         return;
     }
 
+    // The PV follows the best child by NodeComp, which on a tie in
+    // visits need not be the one recycling spares. Let the pass that
+    // is running finish first, no other starts from this thread, and
+    // recycle_tree picks up its result as usual.
+    if (m_recycled.valid()) {
+        m_recycled.wait();
+    }
+
     FastState tempstate = m_rootstate;
     int color = tempstate.board.get_to_move();
 
@@ -471,7 +911,8 @@ void UCTSearch::dump_analysis(int playouts) {
 }
 
 bool UCTSearch::is_running() const {
-    return m_run && m_nodes < MAX_TREE_SIZE;
+    // A full tree only ends the search if no room can be recycled.
+    return m_run && (m_can_recycle || !tree_is_full());
 }
 
 int UCTSearch::est_playouts_left(int elapsed_centis, int time_for_move) const {
@@ -493,30 +934,31 @@ int UCTSearch::est_playouts_left(int elapsed_centis, int time_for_move) const {
 
 size_t UCTSearch::prune_noncontenders(int elapsed_centis, int time_for_move) {
     auto Nfirst = 0;
-    // There are no cases where the root's children vector gets modified
-    // during a multithreaded search, so it is safe to walk it here without
-    // taking the (root) node lock.
-    for (const auto& node : m_root->get_children()) {
-        if (node->valid()) {
-            Nfirst = std::max(Nfirst, node->get_visits());
+    // The root's edges are only reordered while no search runs on it,
+    // so it is safe to walk them here without taking the (root) node lock.
+    for (const auto& edge : m_root->get_edges()) {
+        if (edge.valid()) {
+            Nfirst = std::max(Nfirst, edge.get_visits());
         }
     }
     const auto min_required_visits =
         Nfirst - est_playouts_left(elapsed_centis, time_for_move);
     auto pruned_nodes = size_t{0};
-    for (const auto& node : m_root->get_children()) {
-        if (node->valid()) {
+    auto index = size_t{0};
+    for (const auto& edge : m_root->get_edges()) {
+        if (edge.valid()) {
             const auto has_enough_visits =
-                node->get_visits() >= min_required_visits;
+                edge.get_visits() >= min_required_visits;
 
-            node->set_active(has_enough_visits);
+            m_root->set_child_active(index, has_enough_visits);
             if (!has_enough_visits) {
                 ++pruned_nodes;
             }
         }
+        index++;
     }
 
-    assert(pruned_nodes < m_root->get_children().size());
+    assert(pruned_nodes < m_root->get_num_children());
     return pruned_nodes;
 }
 
@@ -525,7 +967,7 @@ bool UCTSearch::have_alternate_moves(int elapsed_centis, int time_for_move) {
         return true;
     }
     auto pruned = prune_noncontenders(elapsed_centis, time_for_move);
-    if (pruned < m_root->get_children().size() - 1) {
+    if (pruned < m_root->get_num_children() - 1) {
         return true;
     }
     // If we cannot save up time anyway, use all of it. This
@@ -558,13 +1000,17 @@ bool UCTSearch::stop_thinking(int elapsed_centis, int time_for_move) const {
            || elapsed_centis >= time_for_move;
 }
 
+UCTSearch::PlayoutScratch::PlayoutScratch(const GameState& rootstate)
+    : states(std::max(1, cfg_batch_size), rootstate),
+      paths(states.size()) {
+    pending.reserve(states.size());
+    eval_states.reserve(states.size());
+}
+
 void UCTWorker::operator()() {
+    auto scratch = UCTSearch::PlayoutScratch{m_rootstate};
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
-        auto result = m_search->play_simulation(*currstate, m_root);
-        if (result.valid()) {
-            m_search->increment_playouts();
-        }
+        m_search->simulate(scratch, m_root);
     } while (m_search->is_running());
 }
 
@@ -572,6 +1018,28 @@ void UCTSearch::increment_playouts() {
     m_playouts++;
 }
 
+void UCTSearch::simulate(PlayoutScratch& scratch, UCTNode* const root) {
+    if (cfg_batch_size > 1) {
+        // Don't collect more leaves than we are still allowed to search.
+        const auto playouts_left =
+            std::min(m_maxplayouts - m_playouts.load(),
+                     m_maxvisits - root->get_visits());
+        const auto batch_size =
+            std::max(1, std::min(cfg_batch_size, playouts_left));
+        const auto playouts =
+            play_simulation_batch(scratch, root, batch_size);
+        for (auto i = 0; i < playouts; i++) {
+            increment_playouts();
+        }
+        return;
+    }
+
+    auto result = play_simulation(scratch.states[0], root);
+    if (result.valid()) {
+        increment_playouts();
+    }
+}
+
 int UCTSearch::think(int color, passflag_t passflag) {
     // Start counting time for us
     m_rootstate.start_clock(color);
@@ -591,24 +1059,21 @@ int UCTSearch::think(int color, passflag_t passflag) {
 
     // create a sorted list of legal moves (make sure we
     // play something legal and decent even in time trouble)
-    m_root->prepare_root_node(color, m_nodes, m_rootstate);
+    m_root_priors = m_root->prepare_root_node(color, m_nodes, m_rootstate);
 
     m_run = true;
     int cpus = cfg_num_threads;
     ThreadGroup tg(thread_pool);
     for (int i = 1; i < cpus; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
 
+    auto scratch = PlayoutScratch{m_rootstate};
     bool keeprunning = true;
     int last_update = 0;
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
-
-        auto result = play_simulation(*currstate, m_root.get());
-        if (result.valid()) {
-            increment_playouts();
-        }
+        simulate(scratch, m_root);
+        recycle_tree();
 
         Time elapsed;
         int elapsed_centis = Time::timediff_centis(start, elapsed);
@@ -627,10 +1092,14 @@ int UCTSearch::think(int color, passflag_t passflag) {
     // stop the search
     m_run = false;
     tg.wait_all();
+    finish_recycling();
+    if (tree_is_full()) {
+        myprintf("Search tree is full, stopped searching.\n");
+    }
 
     // reactivate all pruned root children
-    for (const auto& node : m_root->get_children()) {
-        node->set_active(true);
+    for (auto i = size_t{0}; i < m_root->get_num_children(); i++) {
+        m_root->set_child_active(i, true);
     }
 
     m_rootstate.stop_clock(color);
@@ -660,31 +1129,52 @@ int UCTSearch::think(int color, passflag_t passflag) {
 }
 
 void UCTSearch::ponder() {
-    update_root();
-
-    m_root->prepare_root_node(m_rootstate.board.get_to_move(),
-                              m_nodes, m_rootstate);
+    start_search();
 
-    m_run = true;
     ThreadGroup tg(thread_pool);
     for (int i = 1; i < cfg_num_threads; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
+    auto scratch = PlayoutScratch{m_rootstate};
     auto keeprunning = true;
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
-        auto result = play_simulation(*currstate, m_root.get());
-        if (result.valid()) {
-            increment_playouts();
-        }
-        keeprunning  = is_running();
-        keeprunning &= !stop_thinking(0, 1);
+        keeprunning = search_step(scratch, true);
     } while (!Utils::input_pending() && keeprunning);
 
     // stop the search
     m_run = false;
     tg.wait_all();
 
+    end_search();
+}
+
+void UCTSearch::start_search() {
+    update_root();
+
+    m_root_priors =
+        m_root->prepare_root_node(m_rootstate.board.get_to_move(),
+                                  m_nodes, m_rootstate);
+
+    m_run = true;
+}
+
+bool UCTSearch::search_step(PlayoutScratch& scratch, bool is_main) {
+    simulate(scratch, m_root);
+    if (is_main) {
+        recycle_tree();
+    }
+    if (stop_thinking(0, 1)) {
+        m_run = false;
+    }
+    return is_running();
+}
+
+void UCTSearch::end_search() {
+    finish_recycling();
+    if (tree_is_full()) {
+        myprintf("Search tree is full, stopped searching.\n");
+    }
+
     // display search info
     myprintf("\n");
     dump_stats(m_rootstate, *m_root);
@@ -695,6 +1185,53 @@ void UCTSearch::ponder() {
     m_last_rootstate = std::make_unique<GameState>(m_rootstate);
 }
 
+void UCTSearch::stop_search() {
+    m_run = false;
+}
+
+std::pair<int, float> UCTSearch::get_best_root_move() {
+    const auto color = m_rootstate.get_to_move();
+    if (!m_root->has_children()) {
+        return {FastBoard::PASS, 0.5f};
+    }
+    const auto best_child = m_root->get_best_root_child(color);
+    if (best_child.get_visits() == 0) {
+        return {best_child.get_move(), 0.5f};
+    }
+    return {best_child.get_move(), best_child.get_eval(color)};
+}
+
+bool UCTSearch::save_tree(const std::string& filename) {
+    // Bring the tree up to date with the game first.
+    update_root();
+    const auto saved = TreeSnapshot::save(filename, m_rootstate, *m_root);
+
+    // Keep the tree for the next search.
+    m_last_rootstate = std::make_unique<GameState>(m_rootstate);
+    return saved;
+}
+
+bool UCTSearch::load_tree(const std::string& filename) {
+    auto pool = std::make_unique<NodePool>();
+    auto root = TreeSnapshot::load(filename, m_rootstate, *pool);
+    if (!root) {
+        return false;
+    }
+
+    // The loaded tree replaces the old one entirely.
+    replace_tree(std::move(pool), std::move(root));
+    m_nodes = m_root->count_nodes();
+    m_kept_nodes = 0;
+
+    // The next search starts from the loaded tree.
+    m_last_rootstate = std::make_unique<GameState>(m_rootstate);
+    return true;
+}
+
+size_t UCTSearch::get_tree_bytes() const {
+    return m_pool->get_used_bytes();
+}
+
 void UCTSearch::set_playout_limit(int playouts) {
     static_assert(std::is_convertible<decltype(playouts),
                                       decltype(m_maxplayouts)>::value,
@@ -709,3 +1246,193 @@ void UCTSearch::set_visit_limit(int visits) {
     // Limit to type max / 2 to prevent overflow when multithreading.
     m_maxvisits = std::min(visits, UNLIMITED_PLAYOUTS);
 }
+
+void UCTSearch::set_memory_limit(size_t bytes) {
+    m_max_tree_memory = bytes;
+}
+
+struct UCTSearchService::Entry {
+    Entry(Id id, const GameState& state)
+        : id(id), state(std::make_unique<GameState>(state)),
+          search(std::make_unique<UCTSearch>(*this->state)) {}
+
+    // The last slice is over, so the search can be ended.
+    bool idle() const { return stopped && slices == 0; }
+
+    Id id;
+    std::unique_ptr<GameState> state;
+    std::unique_ptr<UCTSearch> search;
+    // Positions to descend from, for the next slices to take.
+    std::vector<std::unique_ptr<UCTSearch::PlayoutScratch>> scratch;
+    // Slices running on the search, and whether one of them is the main
+    // one, which does the upkeep of the tree.
+    int slices{0};
+    bool has_main{false};
+    // The search takes no more slices once it stopped, it is done once
+    // end_search has run.
+    bool stopped{false};
+    bool ending{false};
+    bool done{false};
+};
+
+UCTSearchService::UCTSearchService() = default;
+
+UCTSearchService::~UCTSearchService() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (auto& entry : m_entries) {
+        entry->stopped = true;
+        entry->search->stop_search();
+    }
+    m_changed.wait(lock, [this]() { return m_workers == 0; });
+    for (auto& entry : m_entries) {
+        finish(*entry, lock);
+    }
+}
+
+UCTSearchService::Entry& UCTSearchService::find(Id id) {
+    const auto entry = std::find_if(begin(m_entries), end(m_entries),
+        [id](const std::unique_ptr<Entry>& entry) { return entry->id == id; });
+    assert(entry != end(m_entries));
+    return **entry;
+}
+
+UCTSearchService::Id UCTSearchService::start(const GameState& state,
+                                             int visits,
+                                             size_t max_tree_memory) {
+    auto entry = std::make_unique<Entry>(m_next_id++, state);
+    entry->search->set_playout_limit(UCTSearch::UNLIMITED_PLAYOUTS);
+    entry->search->set_visit_limit(visits);
+    entry->search->set_memory_limit(max_tree_memory);
+    entry->search->start_search();
+    const auto id = entry->id;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.emplace_back(std::move(entry));
+    while (m_workers < cfg_num_threads) {
+        m_workers++;
+        thread_pool.add_task([this]() { work(); });
+    }
+    return id;
+}
+
+bool UCTSearchService::has_search(Id id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::any_of(begin(m_entries), end(m_entries),
+        [id](const std::unique_ptr<Entry>& entry) { return entry->id == id; });
+}
+
+GameState UCTSearchService::get_state(Id id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return *find(id).state;
+}
+
+UCTSearchService::Status UCTSearchService::get_status(Id id) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto& entry = find(id);
+    // The root is sorted while the search ends.
+    m_changed.wait(lock, [&entry]() { return !entry.ending; });
+    const auto best = entry.search->get_best_root_move();
+    return {!entry.idle(), entry.search->get_root().get_visits(),
+            best.first, best.second, entry.search->get_tree_bytes()};
+}
+
+void UCTSearchService::wait(Id id) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto& entry = find(id);
+    m_changed.wait(lock, [&entry]() { return entry.idle(); });
+    finish(entry, lock);
+}
+
+void UCTSearchService::stop(Id id) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& entry = find(id);
+        entry.stopped = true;
+        entry.search->stop_search();
+    }
+    wait(id);
+}
+
+void UCTSearchService::remove(Id id) {
+    stop(id);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = std::find_if(begin(m_entries), end(m_entries),
+        [id](const std::unique_ptr<Entry>& entry) { return entry->id == id; });
+    auto removed = std::move(*it);
+    m_entries.erase(it);
+    // Freeing the search waits for its tasks on the pool, which may be
+    // queued behind slices that need the lock.
+    lock.unlock();
+    removed.reset();
+}
+
+void UCTSearchService::finish(Entry& entry,
+                              std::unique_lock<std::mutex>& lock) {
+    // Ending the search waits for its recycling to run on the pool. That
+    // is why it is left to the callers instead of the slices, and done
+    // without the lock.
+    if (entry.ending) {
+        m_changed.wait(lock, [&entry]() { return entry.done; });
+    }
+    if (entry.done) {
+        return;
+    }
+    entry.ending = true;
+    lock.unlock();
+    entry.search->end_search();
+    lock.lock();
+    entry.ending = false;
+    entry.done = true;
+    m_changed.notify_all();
+}
+
+void UCTSearchService::work() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // Take the next search in turn that is still running.
+    Entry* entry = nullptr;
+    for (auto tries = size_t{0}; tries < m_entries.size(); tries++) {
+        auto& next = *m_entries[m_next++ % m_entries.size()];
+        if (!next.stopped) {
+            entry = &next;
+            break;
+        }
+    }
+    if (!entry) {
+        m_workers--;
+        m_changed.notify_all();
+        return;
+    }
+
+    entry->slices++;
+    const auto is_main = !entry->has_main;
+    entry->has_main = true;
+    auto scratch = std::unique_ptr<UCTSearch::PlayoutScratch>{};
+    if (entry->scratch.empty()) {
+        scratch = std::make_unique<UCTSearch::PlayoutScratch>(*entry->state);
+    } else {
+        scratch = std::move(entry->scratch.back());
+        entry->scratch.pop_back();
+    }
+    lock.unlock();
+
+    auto running = true;
+    for (auto i = 0; running && i < SLICE_PLAYOUTS; i++) {
+        running = entry->search->search_step(*scratch, is_main);
+    }
+
+    lock.lock();
+    entry->scratch.emplace_back(std::move(scratch));
+    if (is_main) {
+        entry->has_main = false;
+    }
+    entry->slices--;
+    if (!running) {
+        entry->stopped = true;
+    }
+    if (entry->idle()) {
+        m_changed.notify_all();
+    }
+    // Queue up again behind whatever else is waiting for the pool.
+    thread_pool.add_task([this]() { work(); });
+}
@@ -21,15 +21,21 @@
 
 #include <list>
 #include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
+#include <utility>
 #include <future>
+#include <vector>
 
 #include "ThreadPool.h"
 #include "FastBoard.h"
 #include "FastState.h"
 #include "GameState.h"
+#include "NodePool.h"
+#include "TranspositionTable.h"
 #include "UCTNode.h"
 
 
@@ -83,6 +89,19 @@ public:
     static constexpr auto MAX_TREE_SIZE =
         (sizeof(void*) == 4 ? 25'000'000 : 100'000'000);
 
+    /*
+        When the tree reaches this fraction of MAX_TREE_SIZE or of the
+        memory budget, subtrees with few visits are freed to make room.
+    */
+    static constexpr auto RECYCLE_FULLNESS = 0.9f;
+
+    /*
+        Searched positions before the current root are kept as long
+        as the whole tree stays below this fraction of the limits, so
+        that undoing or switching variations can reuse them.
+    */
+    static constexpr auto KEPT_TREE_FULLNESS = 0.5f;
+
     /*
         Value representing unlimited visits or playouts. Due to
         concurrent updates while multithreading, we need some
@@ -92,15 +111,60 @@ public:
         std::numeric_limits<int>::max() / 2;
 
     UCTSearch(GameState& g);
+    ~UCTSearch();
     int think(int color, passflag_t passflag = NORMAL);
     void set_playout_limit(int playouts);
     void set_visit_limit(int visits);
+    // Tree memory budget in bytes, 0 for none.
+    void set_memory_limit(size_t bytes);
+    struct PlayoutScratch;
     void ponder();
+    // A search split up for callers that run it on their own threads.
+    // Between start_search and end_search, search_step can be called
+    // from any number of threads, but only one of them may be is_main.
+    void start_search();
+    bool search_step(PlayoutScratch& scratch, bool is_main);
+    void end_search();
+    // Makes search_step return false, from any thread.
+    void stop_search();
+    // Best move at the root and its winrate for the side to move.
+    std::pair<int, float> get_best_root_move();
+    // Save the tree for the current position, or replace it by a saved one.
+    bool save_tree(const std::string& filename);
+    bool load_tree(const std::string& filename);
+    // Memory taken by the search tree.
+    size_t get_tree_bytes() const;
+    // The node searched from, to inspect the tree.
+    const UCTNode& get_root() const { return *m_root; }
     bool is_running() const;
     void increment_playouts();
+    void simulate(PlayoutScratch& scratch, UCTNode* const root);
     SearchResult play_simulation(GameState& currstate, UCTNode* const node);
 
 private:
+    // A node on the path of a descent and the index of the child taken
+    // from it, NO_EDGE at the leaf.
+    struct PathStep {
+        UCTNode* node;
+        size_t edge;
+    };
+    static constexpr auto NO_EDGE = std::numeric_limits<size_t>::max();
+
+    int play_simulation_batch(PlayoutScratch& scratch,
+                              UCTNode* const root, int batch_size);
+    SearchResult select_leaf(GameState& currstate, UCTNode* node,
+                             std::vector<PathStep>& path,
+                             bool& needs_eval);
+    void backup(const std::vector<PathStep>& path,
+                const SearchResult& result);
+    UCTNode* find_transposition(UCTNode* parent, size_t edge,
+                                UCTNode* child, const GameState& state);
+    float get_tree_fullness() const;
+    bool tree_is_full() const;
+    void recycle_tree();
+    void finish_recycling();
+    size_t free_subtrees();
+    float evaluate_leaf(const GameState& state) const;
     float get_min_psa_ratio() const;
     void dump_stats(FastState& state, UCTNode& parent);
     void tree_stats(const UCTNode& node);
@@ -114,17 +178,117 @@ private:
     int get_best_move(passflag_t passflag);
     void update_root();
     bool advance_to_new_rootstate();
+    UCTNode* get_or_expand_child(GameState& state, UCTNode* node,
+                                 int move, size_t& edge);
+    bool retreat_anchor(const GameState& state, int moves);
+    void trim_anchor();
+    void replace_tree(std::unique_ptr<NodePool> pool,
+                      UCTNodeHandle anchor);
+    void drop_tree(UCTNode* node);
+    void finish_deletes();
 
     GameState & m_rootstate;
     std::unique_ptr<GameState> m_last_rootstate;
-    std::unique_ptr<UCTNode> m_root;
+    // The tree is kept from an earlier position, the anchor, so that
+    // the root can move to any position below it, not only forward.
+    std::unique_ptr<GameState> m_anchor_state;
+    // Every node of the tree comes from this pool.
+    std::unique_ptr<NodePool> m_pool;
+    UCTNodeHandle m_anchor;
+    // Where the search is rooted, and the edges leading there.
+    UCTNode* m_root;
+    std::vector<PathStep> m_root_path;
+    // Visits of m_root when it became the root.
+    int m_root_visits{0};
+    double m_root_blackevals{0.0};
+    // Priors of m_root from before the root noise.
+    UCTNode::PriorList m_root_priors;
+    TranspositionTable m_transpositions;
     std::atomic<int> m_nodes{0};
+    // Nodes in the tree outside of the subtree of m_root.
+    int m_kept_nodes{0};
     std::atomic<int> m_playouts{0};
     std::atomic<bool> m_run{false};
     int m_maxplayouts;
     int m_maxvisits;
+    size_t m_max_tree_memory;
 
     std::list<Utils::ThreadGroup> m_delete_futures;
+
+    // Subtrees are cut off and freed by a pass in the background, the
+    // task returns the number of nodes that went with them.
+    std::future<size_t> m_recycled;
+    int m_recycle_visits{2};
+    std::atomic<bool> m_can_recycle{true};
+};
+
+// Positions and paths one thread descends with. They are copied from the
+// root once per search, after that moves are pushed and popped in place,
+// so a playout neither copies the game history nor allocates.
+struct UCTSearch::PlayoutScratch {
+    explicit PlayoutScratch(const GameState& rootstate);
+
+    std::vector<GameState> states;
+    std::vector<std::vector<PathStep>> paths;
+    std::vector<size_t> pending;
+    std::vector<const GameState*> eval_states;
+};
+
+/*
+    A service that runs independent searches of several positions at the
+    same time, sharing the thread pool and through it the network and the
+    NNCache. Searches are started, queried and stopped while the others
+    go on. The workers take the running searches in turns, a slice of
+    playouts at a time, and give their pool thread back between slices,
+    so other tasks on the pool get their turn as well. Every search has
+    its own visit limit and tree memory budget.
+*/
+class UCTSearchService {
+public:
+    using Id = int;
+    struct Status {
+        bool running;
+        int visits;
+        // Best move at the root and its winrate for the side to move.
+        int move;
+        float winrate;
+        size_t tree_bytes;
+    };
+
+    UCTSearchService();
+    // Stops the searches that are still running.
+    ~UCTSearchService();
+
+    // Searches a copy of state until its root has visits visits.
+    // max_tree_memory is the budget of its tree, 0 for none.
+    Id start(const GameState& state, int visits, size_t max_tree_memory);
+    bool has_search(Id id);
+    // A copy of the position searched.
+    GameState get_state(Id id);
+    // The state of a search, also while it is running.
+    Status get_status(Id id);
+    // Waits until the search reaches its limit.
+    void wait(Id id);
+    // Stops the search before its limit, and waits until it ends.
+    void stop(Id id);
+    // Stops the search if it is running and frees it.
+    void remove(Id id);
+
+private:
+    // Playouts a worker runs on one search before it moves on.
+    static constexpr auto SLICE_PLAYOUTS = 32;
+
+    struct Entry;
+    Entry& find(Id id);
+    void work();
+    void finish(Entry& entry, std::unique_lock<std::mutex>& lock);
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::vector<std::unique_ptr<Entry>> m_entries;
+    Id m_next_id{0};
+    size_t m_next{0};
+    int m_workers{0};
 };
 
 class UCTWorker {
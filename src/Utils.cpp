@@ -28,6 +28,9 @@
 #else
 #include <sys/select.h>
 #endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "GTP.h"
 
@@ -144,3 +147,29 @@ size_t Utils::ceilMultiple(size_t a, size_t b) {
     auto ret = a + (b - a % b);
     return ret;
 }
+
+Utils::CpuFeatures Utils::detect_cpu_features() {
+    auto features = CpuFeatures{};
+#if defined(_MSC_VER) && defined(_M_X64)
+    // The CPU has to support the instructions and the OS has to save
+    // the registers they use.
+    int info[4];
+    __cpuid(info, 1);
+    const auto osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave) {
+        return features;
+    }
+    const auto xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    features.avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x06) == 0x06;
+    features.avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+    features.avx512_vnni = features.avx512 && (info[2] & (1 << 11)) != 0;
+#elif defined(__x86_64__)
+    __builtin_cpu_init();
+    features.avx2 = __builtin_cpu_supports("avx2");
+    features.avx512 = __builtin_cpu_supports("avx512f");
+    features.avx512_vnni = features.avx512
+                           && __builtin_cpu_supports("avx512vnni");
+#endif
+    return features;
+}
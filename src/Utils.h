@@ -52,6 +52,15 @@ namespace Utils {
     }
 
     size_t ceilMultiple(size_t a, size_t b);
+
+    // Vector instruction sets that the CPU has and the OS saves the
+    // registers of. All false on other architectures than x86-64.
+    struct CpuFeatures {
+        bool avx2{false};
+        bool avx512{false};
+        bool avx512_vnni{false};
+    };
+    CpuFeatures detect_cpu_features();
 }
 
 #endif
@@ -0,0 +1,86 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "WinogradSimd.h"
+
+#ifdef USE_WINOGRAD_SIMD
+
+#include <immintrin.h>
+
+#include "WinogradKernels.h"
+
+namespace {
+    struct Avx2 {
+        using type = __m256;
+        static constexpr auto WIDTH = 8;
+
+        static __m256 mask(const int n) {
+            const auto lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            return _mm256_castsi256_ps(
+                _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lanes));
+        }
+        static __m256 load(const float* p) {
+            return _mm256_loadu_ps(p);
+        }
+        static __m256 load(const float* p, const int n) {
+            if (n == WIDTH) {
+                return _mm256_loadu_ps(p);
+            }
+            return _mm256_maskload_ps(p, _mm256_castps_si256(mask(n)));
+        }
+        static void store(float* p, const __m256 v, const int n) {
+            if (n == WIDTH) {
+                _mm256_storeu_ps(p, v);
+            } else {
+                _mm256_maskstore_ps(p, _mm256_castps_si256(mask(n)), v);
+            }
+        }
+        static __m256 add(const __m256 a, const __m256 b) {
+            return _mm256_add_ps(a, b);
+        }
+        static __m256 sub(const __m256 a, const __m256 b) {
+            return _mm256_sub_ps(a, b);
+        }
+        // p = a0 b0 a1 b1 ... a7 b7
+        static void interleave(float* p, const __m256 a, const __m256 b) {
+            const auto lo = _mm256_unpacklo_ps(a, b);
+            const auto hi = _mm256_unpackhi_ps(a, b);
+            _mm256_storeu_ps(p, _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_storeu_ps(p + WIDTH, _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+    };
+}
+
+void WinogradSimd::transform_in_avx2(const float* in, float* V,
+                                     const int C, const int batch_size,
+                                     const int first, const int last) {
+    WinogradKernels::transform_in<Avx2>(in, V, C, batch_size, first, last);
+}
+
+void WinogradSimd::transform_out_avx2(const float* M, float* Y,
+                                      const int K, const int batch_size,
+                                      const int first, const int last,
+                                      const float* means,
+                                      const float* stddivs,
+                                      const float* eltwise, float* V_next) {
+    WinogradKernels::transform_out<Avx2>(M, Y, K, batch_size, first, last,
+                                         means, stddivs, eltwise, V_next);
+}
+
+#endif
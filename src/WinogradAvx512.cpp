@@ -0,0 +1,81 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "WinogradSimd.h"
+
+#ifdef USE_WINOGRAD_SIMD
+
+#include <immintrin.h>
+
+#include "WinogradKernels.h"
+
+namespace {
+    struct Avx512 {
+        using type = __m512;
+        static constexpr auto WIDTH = 16;
+
+        static __mmask16 mask(const int n) {
+            return static_cast<__mmask16>((1u << n) - 1);
+        }
+        static __m512 load(const float* p) {
+            return _mm512_loadu_ps(p);
+        }
+        static __m512 load(const float* p, const int n) {
+            return _mm512_maskz_loadu_ps(mask(n), p);
+        }
+        static void store(float* p, const __m512 v, const int n) {
+            _mm512_mask_storeu_ps(p, mask(n), v);
+        }
+        static __m512 add(const __m512 a, const __m512 b) {
+            return _mm512_add_ps(a, b);
+        }
+        static __m512 sub(const __m512 a, const __m512 b) {
+            return _mm512_sub_ps(a, b);
+        }
+        // p = a0 b0 a1 b1 ... a15 b15
+        static void interleave(float* p, const __m512 a, const __m512 b) {
+            const auto lo = _mm512_unpacklo_ps(a, b);
+            const auto hi = _mm512_unpackhi_ps(a, b);
+            const auto first = _mm512_setr_epi32(0, 1, 2, 3, 16, 17, 18, 19,
+                                                 4, 5, 6, 7, 20, 21, 22, 23);
+            const auto second = _mm512_setr_epi32(8, 9, 10, 11, 24, 25, 26, 27,
+                                                  12, 13, 14, 15, 28, 29, 30, 31);
+            _mm512_storeu_ps(p, _mm512_permutex2var_ps(lo, first, hi));
+            _mm512_storeu_ps(p + WIDTH, _mm512_permutex2var_ps(lo, second, hi));
+        }
+    };
+}
+
+void WinogradSimd::transform_in_avx512(const float* in, float* V,
+                                       const int C, const int batch_size,
+                                       const int first, const int last) {
+    WinogradKernels::transform_in<Avx512>(in, V, C, batch_size, first, last);
+}
+
+void WinogradSimd::transform_out_avx512(const float* M, float* Y,
+                                        const int K, const int batch_size,
+                                        const int first, const int last,
+                                        const float* means,
+                                        const float* stddivs,
+                                        const float* eltwise, float* V_next) {
+    WinogradKernels::transform_out<Avx512>(M, Y, K, batch_size, first, last,
+                                           means, stddivs, eltwise, V_next);
+}
+
+#endif
@@ -0,0 +1,231 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WINOGRADKERNELS_H_INCLUDED
+#define WINOGRADKERNELS_H_INCLUDED
+
+#include "config.h"
+
+#include <cstring>
+
+/*
+    Winograd input and output transforms written against a vector type
+    Vec, instantiated by WinogradAvx2.cpp and WinogradAvx512.cpp.
+
+    Only include this from a file built for a specific instruction set.
+    Anything inline from a header that is also used elsewhere could end
+    up in the binary in its vectorized form, so this sticks to plain
+    loops and Vec.
+
+    The tiles of a board row are next to each other in V and M, so every
+    lane of a vector handles one tile and a row of tiles takes
+    (WTILES + Vec::WIDTH - 1) / Vec::WIDTH vectors. Tiles overlap by 2,
+    so the padded input rows are split into even and odd columns, which
+    turns the input of a row of tiles into contiguous loads.
+*/
+namespace WinogradKernels {
+    constexpr auto WINOGRAD_ALPHA = 4;
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+    constexpr auto WTILES = (W + 1) / 2;
+    constexpr auto P = WTILES * WTILES;
+
+    template <typename Vec>
+    struct InputRows {
+        static constexpr auto GROUPS = (WTILES + Vec::WIDTH - 1) / Vec::WIDTH;
+        // A tile reads the column pair after its own.
+        static constexpr auto COLUMNS = GROUPS * Vec::WIDTH + 1;
+        static constexpr auto ROWS = WTILES * 2 + 2;
+
+        // Padded rows, as in_pad of the scalar version. Only the board
+        // part is written, the padding stays zero.
+        InputRows() {
+            std::memset(even, 0, sizeof(even));
+            std::memset(odd, 0, sizeof(odd));
+        }
+
+        float even[ROWS][COLUMNS];
+        float odd[ROWS][COLUMNS];
+    };
+
+    // Transforms one plane into the tiles for channel c of V. offset is
+    // where the tiles of the plane's board start.
+    template <typename Vec>
+    void transform_in_plane(const float* plane, float* V,
+                            const int C, const int BP,
+                            const int c, const int offset,
+                            InputRows<Vec>& rows) {
+        using vec_t = typename Vec::type;
+        constexpr auto GROUPS = InputRows<Vec>::GROUPS;
+
+        for (auto yin = 0; yin < H; yin++) {
+            // Board column xin is padded column xin + 1.
+            const auto row = &plane[yin*W];
+            for (auto xin = 0; xin < W; xin += 2) {
+                rows.odd[yin + 1][xin / 2] = row[xin];
+            }
+            for (auto xin = 1; xin < W; xin += 2) {
+                rows.even[yin + 1][(xin + 1) / 2] = row[xin];
+            }
+        }
+
+        for (auto block_y = 0; block_y < WTILES; block_y++) {
+            const auto yin = 2 * block_y;
+            for (auto group = 0; group < GROUPS; group++) {
+                const auto block_x = group * Vec::WIDTH;
+                const auto tiles = WTILES - block_x < Vec::WIDTH
+                                 ? WTILES - block_x : Vec::WIDTH;
+
+                // Calculates transpose(B).x.B, see the scalar version.
+                vec_t x[WINOGRAD_ALPHA][WINOGRAD_ALPHA];
+                for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+                    x[i][0] = Vec::load(&rows.even[yin + i][block_x]);
+                    x[i][1] = Vec::load(&rows.odd[yin + i][block_x]);
+                    x[i][2] = Vec::load(&rows.even[yin + i][block_x + 1]);
+                    x[i][3] = Vec::load(&rows.odd[yin + i][block_x + 1]);
+                }
+
+                vec_t T1[WINOGRAD_ALPHA][WINOGRAD_ALPHA];
+                for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                    T1[0][j] = Vec::sub(x[0][j], x[2][j]);
+                    T1[1][j] = Vec::add(x[1][j], x[2][j]);
+                    T1[2][j] = Vec::sub(x[2][j], x[1][j]);
+                    T1[3][j] = Vec::sub(x[1][j], x[3][j]);
+                }
+
+                const auto tile = c * BP + offset + block_y * WTILES + block_x;
+                for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+                    const vec_t T2[WINOGRAD_ALPHA] = {
+                        Vec::sub(T1[i][0], T1[i][2]),
+                        Vec::add(T1[i][1], T1[i][2]),
+                        Vec::sub(T1[i][2], T1[i][1]),
+                        Vec::sub(T1[i][1], T1[i][3])
+                    };
+                    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                        Vec::store(&V[(i*WINOGRAD_ALPHA + j)*C*BP + tile],
+                                   T2[j], tiles);
+                    }
+                }
+            }
+        }
+    }
+
+    template <typename Vec>
+    void transform_in(const float* in, float* V,
+                      const int C, const int batch_size,
+                      const int first, const int last) {
+        const auto BP = batch_size * P;
+        InputRows<Vec> rows;
+        for (auto ch = first; ch < last; ch++) {
+            const auto batch = ch / C;
+            const auto c = ch % C;
+            transform_in_plane<Vec>(&in[ch*(W*H)], V, C, BP, c, batch * P,
+                                    rows);
+        }
+    }
+
+    // Batchnorm, the residual if any, and ReLU, for an output row. This
+    // takes Vec only so that every instruction set gets its own copy.
+    template <typename Vec>
+    void store_row(float* out, const float* row,
+                          const float mean, const float scale_stddiv,
+                          const float* eltwise) {
+        for (auto x = 0; x < W; x++) {
+            auto val = scale_stddiv * (row[x] - mean);
+            if (eltwise) {
+                val += eltwise[x];
+            }
+            out[x] = val > 0.0f ? val : 0.0f;
+        }
+    }
+
+    // Also applies batchnorm, adds eltwise if given and does ReLU. If
+    // V_next is given, the output is transformed into it as well.
+    template <typename Vec>
+    void transform_out(const float* M, float* Y,
+                       const int K, const int batch_size,
+                       const int first, const int last,
+                       const float* means, const float* stddivs,
+                       const float* eltwise, float* V_next) {
+        using vec_t = typename Vec::type;
+        constexpr auto GROUPS = (WTILES + Vec::WIDTH - 1) / Vec::WIDTH;
+        const auto BP = batch_size * P;
+        InputRows<Vec> rows;
+
+        // The two output rows of a row of tiles, with the columns of
+        // the tiles interleaved.
+        float row0[2 * GROUPS * Vec::WIDTH];
+        float row1[2 * GROUPS * Vec::WIDTH];
+
+        for (auto bk = first; bk < last; bk++) {
+            const auto batch = bk / K;
+            const auto k = bk % K;
+            const auto kHW = bk * W * H;
+            const auto mean = means[k];
+            const auto scale_stddiv = stddivs[k];
+            for (auto block_y = 0; block_y < WTILES; block_y++) {
+                const auto y = 2 * block_y;
+                for (auto group = 0; group < GROUPS; group++) {
+                    const auto block_x = group * Vec::WIDTH;
+                    const auto tiles = WTILES - block_x < Vec::WIDTH
+                                     ? WTILES - block_x : Vec::WIDTH;
+                    const auto b = batch * P + block_y * WTILES + block_x;
+
+                    // Calculates transpose(A).temp_m.A, see the scalar
+                    // version. r0 and r1 are temp_m.A.
+                    vec_t r0[WINOGRAD_ALPHA];
+                    vec_t r1[WINOGRAD_ALPHA];
+                    for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) {
+                        vec_t m[WINOGRAD_ALPHA];
+                        for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
+                            m[nu] = Vec::load(
+                                &M[xi*(WINOGRAD_ALPHA*K*BP) + nu*(K*BP)
+                                   + k*BP + b],
+                                tiles);
+                        }
+                        r0[xi] = Vec::add(Vec::add(m[0], m[1]), m[2]);
+                        r1[xi] = Vec::sub(Vec::sub(m[1], m[2]), m[3]);
+                    }
+
+                    const auto o00 = Vec::add(Vec::add(r0[0], r0[1]), r0[2]);
+                    const auto o01 = Vec::add(Vec::add(r1[0], r1[1]), r1[2]);
+                    const auto o10 = Vec::sub(Vec::sub(r0[1], r0[2]), r0[3]);
+                    const auto o11 = Vec::sub(Vec::sub(r1[1], r1[2]), r1[3]);
+                    Vec::interleave(&row0[2 * block_x], o00, o01);
+                    Vec::interleave(&row1[2 * block_x], o10, o11);
+                }
+
+                store_row<Vec>(&Y[kHW + y*W], row0, mean, scale_stddiv,
+                          eltwise ? &eltwise[kHW + y*W] : nullptr);
+                if (y + 1 < H) {
+                    store_row<Vec>(&Y[kHW + (y + 1)*W], row1, mean, scale_stddiv,
+                              eltwise ? &eltwise[kHW + (y + 1)*W] : nullptr);
+                }
+            }
+
+            // The plane is still in cache, turn it into the tiles the
+            // next convolution takes as input.
+            if (V_next) {
+                transform_in_plane<Vec>(&Y[kHW], V_next, K, BP, k, batch * P,
+                                        rows);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WINOGRADSIMD_H_INCLUDED
+#define WINOGRADSIMD_H_INCLUDED
+
+#include "config.h"
+
+// The vectorized transforms are only built for x86-64, where they are
+// picked at runtime by what the CPU supports.
+#if defined(__x86_64__) || defined(_M_X64)
+#define USE_WINOGRAD_SIMD
+#endif
+
+/*
+    The transforms Network::winograd_transform_in and winograd_transform_out
+    pick from. They only do the planes first to last - 1 of the batch. The
+    scalar versions are in Network.cpp, the vectorized ones work on a row
+    of tiles at once.
+
+    Every instruction set lives in its own translation unit, which is the
+    only one built with the flags that enable it.
+*/
+namespace WinogradSimd {
+    enum class Isa {
+        SCALAR, AVX2, AVX512
+    };
+
+    void transform_in_scalar(const float* in, float* V,
+                             int C, int batch_size, int first, int last);
+    void transform_out_scalar(const float* M, float* Y,
+                              int K, int batch_size, int first, int last,
+                              const float* means, const float* stddivs,
+                              const float* eltwise, float* V_next);
+
+#ifdef USE_WINOGRAD_SIMD
+    void transform_in_avx2(const float* in, float* V,
+                           int C, int batch_size, int first, int last);
+    void transform_out_avx2(const float* M, float* Y,
+                            int K, int batch_size, int first, int last,
+                            const float* means, const float* stddivs,
+                            const float* eltwise, float* V_next);
+    void transform_in_avx512(const float* in, float* V,
+                             int C, int batch_size, int first, int last);
+    void transform_out_avx512(const float* M, float* Y,
+                              int K, int batch_size, int first, int last,
+                              const float* means, const float* stddivs,
+                              const float* eltwise, float* V_next);
+#endif
+}
+
+#endif
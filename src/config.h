@@ -107,6 +107,16 @@ using net_t = float;
 #define SELFCHECK_PROBABILITY 2000
 #endif
 
+#if defined(USE_BLAS) && !defined(USE_OPENCL)
+/*
+ * USE_INT8: CPU builds can run the residual tower with 8-bit weights and
+ * activations, see --int8. Its results are checked against the float
+ * version with some probability.
+ */
+#define USE_INT8
+#define SELFCHECK_PROBABILITY 2000
+#endif
+
 #if (_MSC_VER >= 1400) /* VC8+ Disable all deprecation warnings */
     #pragma warning(disable : 4996)
 #endif /* VC8+ */
@@ -19,20 +19,37 @@
 
 #include "config.h"
 
+#include <atomic>
 #include <cstdint>
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <random>
 #include <regex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "GTP.h"
 #include "GameState.h"
 #include "NNCache.h"
+#include "NNCacheFile.h"
+#include "NodePool.h"
+#include "PackedWeights.h"
+#include "QuantizedNetwork.h"
 #include "Random.h"
+#include "SGFTree.h"
 #include "ThreadPool.h"
+#include "TranspositionTable.h"
+#include "UCTNode.h"
+#include "UCTSearch.h"
 #include "Utils.h"
+#include "WinogradSimd.h"
 #include "Zobrist.h"
 
 using namespace Utils;
@@ -181,6 +198,66 @@ TEST_F(LeelaTest, KoSqNotSame) {
     EXPECT_NE(hash, maingame.board.get_hash());
 }
 
+// Search moves pushed and popped must match moves played in the game
+TEST_F(LeelaTest, PushPopMoves) {
+    auto maingame = get_gamestate();
+    auto played = get_gamestate();
+    const auto hash = maingame.board.get_hash();
+
+    // E6 F6 E5 F5 D4 E4 E3 G4 F4, the last move captures
+    const auto moves = std::vector<std::pair<int, int>>{
+        {4, 5}, {5, 5}, {4, 4}, {5, 4}, {3, 3}, {4, 3}, {4, 2}, {6, 3}, {5, 3}};
+    for (const auto& move : moves) {
+        const auto vertex = maingame.board.get_vertex(move.first, move.second);
+        maingame.push_move(vertex);
+        played.play_move(vertex);
+    }
+    EXPECT_EQ(played.board.get_hash(), maingame.board.get_hash());
+    EXPECT_EQ(played.get_movenum(), maingame.get_movenum());
+    for (auto i = 0; i <= 8; i++) {
+        EXPECT_EQ(played.get_past_board(i).get_hash(),
+                  maingame.get_past_board(i).get_hash());
+    }
+
+    maingame.pop_move();
+    played.undo_move();
+    EXPECT_EQ(played.board.get_hash(), maingame.board.get_hash());
+
+    maingame.pop_all_moves();
+    EXPECT_EQ(hash, maingame.board.get_hash());
+    EXPECT_EQ(size_t{0}, maingame.get_movenum());
+}
+
+// The stone bit planes must follow the board through captures and undo
+TEST_F(LeelaTest, StonePlanes) {
+    auto maingame = get_gamestate();
+    const auto check = [&maingame]() {
+        const auto& board = maingame.board;
+        for (auto y = 0; y < BOARD_SIZE; y++) {
+            for (auto x = 0; x < BOARD_SIZE; x++) {
+                const auto idx = y * BOARD_SIZE + x;
+                for (auto color : {FastBoard::BLACK, FastBoard::WHITE}) {
+                    const auto& plane = board.get_stone_plane(color);
+                    const auto bit = (plane[idx / 64] >> (idx % 64)) & 1;
+                    EXPECT_EQ(bit == 1, board.get_square(x, y) == color);
+                }
+            }
+        }
+    };
+
+    // E6 F6 E5 F5 D4 E4 E3 G4 F4, the last move captures
+    const auto moves = std::vector<std::pair<int, int>>{
+        {4, 5}, {5, 5}, {4, 4}, {5, 4}, {3, 3}, {4, 3}, {4, 2}, {6, 3}, {5, 3}};
+    for (const auto& move : moves) {
+        maingame.push_move(maingame.board.get_vertex(move.first, move.second));
+        check();
+    }
+    maingame.pop_move();
+    check();
+    maingame.pop_all_moves();
+    check();
+}
+
 TEST_F(LeelaTest, MoveOnOccupiedSq) {
     auto maingame = get_gamestate();
     std::string output;
@@ -250,3 +327,1171 @@ TEST_F(LeelaTest, TimeControl2) {
     expect_regex(result.second, "Black time: 00:02:00, 1 period\\(s\\) of 120 seconds left");
     expect_regex(result.second, "White time: 00:02:00, 1 period\\(s\\) of 120 seconds left");
 }
+
+// Batched evaluation must match evaluating each position on its own
+TEST_F(LeelaTest, BatchedEvaluation) {
+    auto first = get_gamestate();
+    auto second = get_gamestate();
+    second.play_textmove("b", "Q16");
+    second.play_textmove("w", "D4");
+
+    const auto states = std::vector<const GameState*>{&first, &second, &first};
+    for (auto sym = 0; sym < 8; sym++) {
+        const auto batch = Network::get_scored_moves_batch(
+            states, Network::Ensemble::DIRECT, sym, true);
+        ASSERT_EQ(batch.size(), states.size());
+        for (auto i = size_t{0}; i < states.size(); i++) {
+            const auto single = Network::get_scored_moves(
+                states[i], Network::Ensemble::DIRECT, sym, true);
+            EXPECT_NEAR(batch[i].winrate, single.winrate, 1e-4f);
+            EXPECT_NEAR(batch[i].policy_pass, single.policy_pass, 1e-4f);
+            for (auto idx = size_t{0}; idx < single.policy.size(); idx++) {
+                EXPECT_NEAR(batch[i].policy[idx], single.policy[idx], 1e-4f);
+            }
+        }
+    }
+}
+
+// Splitting an evaluation over inference threads must not change it in
+// the last bit, for single positions and for batches.
+TEST_F(LeelaTest, InferenceThreads) {
+    auto& state = get_gamestate();
+    auto states = std::vector<GameState>{};
+    for (auto move : {"D4", "Q16", "D16", "Q4"}) {
+        state.play_textmove(state.get_to_move() == FastBoard::BLACK
+                            ? "b" : "w", move);
+        states.emplace_back(state);
+    }
+    auto batch = std::vector<const GameState*>{};
+    for (const auto& s : states) {
+        batch.emplace_back(&s);
+    }
+    const auto evaluate = [&]() {
+        auto results = Network::get_scored_moves_batch(
+            batch, Network::Ensemble::DIRECT, 0, true);
+        results.emplace_back(Network::get_scored_moves(
+            &states.back(), Network::Ensemble::DIRECT, 0, true));
+        return results;
+    };
+
+    Network::set_inference_threads(1);
+    const auto expected = evaluate();
+    for (auto threads : {2, 3, 4}) {
+        Network::set_inference_threads(threads);
+        const auto results = evaluate();
+        ASSERT_EQ(results.size(), expected.size());
+        for (auto i = size_t{0}; i < results.size(); i++) {
+            EXPECT_EQ(results[i].policy, expected[i].policy);
+            EXPECT_EQ(results[i].policy_pass, expected[i].policy_pass);
+            EXPECT_EQ(results[i].winrate, expected[i].winrate);
+        }
+    }
+    Network::set_inference_threads(1);
+}
+
+// The AVERAGE ensemble must match averaging the 8 symmetries by hand
+TEST_F(LeelaTest, AverageEnsemble) {
+    auto state = get_gamestate();
+    state.play_textmove("b", "Q16");
+    state.play_textmove("w", "D4");
+    state.play_textmove("b", "C3");
+
+    const auto average = Network::get_scored_moves(
+        &state, Network::Ensemble::AVERAGE, -1, true);
+    auto expected = Network::Netresult{};
+    for (auto sym = 0; sym < 8; sym++) {
+        const auto single = Network::get_scored_moves(
+            &state, Network::Ensemble::DIRECT, sym, true);
+        expected.winrate += single.winrate / 8.0f;
+        expected.policy_pass += single.policy_pass / 8.0f;
+        for (auto idx = size_t{0}; idx < single.policy.size(); idx++) {
+            expected.policy[idx] += single.policy[idx] / 8.0f;
+        }
+    }
+    EXPECT_NEAR(average.winrate, expected.winrate, 1e-4f);
+    EXPECT_NEAR(average.policy_pass, expected.policy_pass, 1e-4f);
+    for (auto idx = size_t{0}; idx < expected.policy.size(); idx++) {
+        EXPECT_NEAR(average.policy[idx], expected.policy[idx], 1e-4f);
+    }
+}
+
+// Filling a small cache replaces old entries but returns what was stored,
+// up to the quantization of the priors
+TEST_F(LeelaTest, NNCacheReplacement) {
+    auto& cache = NNCache::get_NNCache();
+    cache.resize(1000);
+
+    const auto make_result = [](const std::uint64_t hash) {
+        auto result = Network::Netresult{};
+        auto sum = 0.0f;
+        for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
+            result.policy[idx] = std::exp(-float((hash + idx) % 50) / 4.0f);
+            sum += result.policy[idx];
+        }
+        result.policy[hash % BOARD_SQUARES] = 0.0f;
+        for (auto& prior : result.policy) {
+            prior /= 2.0f * sum;
+        }
+        result.policy_pass = 0.5f;
+        result.winrate = (hash % 1000) / 1000.0f;
+        return result;
+    };
+    auto rng = Random{1234};
+    auto hashes = std::vector<std::uint64_t>(5000);
+    for (auto& hash : hashes) {
+        hash = rng.randuint64();
+        cache.insert(hash, make_result(hash));
+    }
+
+    auto found = 0;
+    for (const auto hash : hashes) {
+        auto result = Network::Netresult{};
+        if (!cache.lookup(hash, result)) {
+            continue;
+        }
+        found++;
+        const auto expected = make_result(hash);
+        for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
+            EXPECT_NEAR(result.policy[idx], expected.policy[idx],
+                        0.032f * expected.policy[idx]);
+        }
+        EXPECT_EQ(result.policy_pass, expected.policy_pass);
+        EXPECT_EQ(result.winrate, expected.winrate);
+    }
+    // The table is never smaller than asked for and most recent entries
+    // survive.
+    EXPECT_GE(found, 1000);
+    EXPECT_LT(found, 5000);
+    auto result = Network::Netresult{};
+    EXPECT_TRUE(cache.lookup(hashes.back(), result));
+
+    cache.set_size_from_playouts(cfg_max_playouts);
+}
+
+// An entry that is hit survives an insert that would replace it
+TEST_F(LeelaTest, NNCacheSecondChance) {
+    auto& cache = NNCache::get_NNCache();
+    // The smallest table, where every entry of a shard competes for the
+    // same 8 slots. Multiples of 64 all go to the first shard.
+    cache.resize(1);
+    auto result = Network::Netresult{};
+    result.policy_pass = 1.0f;
+    for (auto i = 1; i <= 8; i++) {
+        cache.insert(64 * i, result);
+    }
+    EXPECT_TRUE(cache.lookup(64 * 1, result));
+    cache.insert(64 * 9, result);
+    EXPECT_FALSE(cache.lookup(64 * 2, result));
+    EXPECT_TRUE(cache.lookup(64 * 1, result));
+    EXPECT_TRUE(cache.lookup(64 * 9, result));
+
+    cache.set_size_from_playouts(cfg_max_playouts);
+}
+
+// A mirrored position is found in the cache, with the policy mirrored
+TEST_F(LeelaTest, NNCacheSymmetry) {
+    auto state = get_gamestate();
+    auto mirrored = get_gamestate();
+    const auto moves = std::vector<std::pair<int, int>>{
+        {3, 3}, {15, 16}, {2, 13}, {16, 2}, {5, 2}};
+    for (const auto& move : moves) {
+        state.push_move(state.board.get_vertex(move.first, move.second));
+        mirrored.push_move(mirrored.board.get_vertex(
+            BOARD_SIZE - 1 - move.first, move.second));
+    }
+
+    auto& cache = NNCache::get_NNCache();
+    Network::get_scored_moves(&state, Network::Ensemble::DIRECT, 0);
+    const auto hits = cache.hit_rate().first;
+    const auto from_mirrored = Network::get_scored_moves(
+        &mirrored, Network::Ensemble::DIRECT, 0);
+    EXPECT_EQ(cache.hit_rate().first, hits + 1);
+
+    const auto cached = Network::get_scored_moves(
+        &state, Network::Ensemble::DIRECT, 0);
+    for (auto y = 0; y < BOARD_SIZE; y++) {
+        for (auto x = 0; x < BOARD_SIZE; x++) {
+            EXPECT_EQ(from_mirrored.policy[y * BOARD_SIZE + BOARD_SIZE - 1 - x],
+                      cached.policy[y * BOARD_SIZE + x]);
+        }
+    }
+    EXPECT_EQ(from_mirrored.policy_pass, cached.policy_pass);
+    EXPECT_EQ(from_mirrored.winrate, cached.winrate);
+}
+
+// Results written to a cache file are found again after reopening it
+TEST_F(LeelaTest, NNCacheFileReopen) {
+    const auto filename = std::string{"nncache_test.bin"};
+    std::remove(filename.c_str());
+
+    auto result = Network::Netresult{};
+    result.policy[42] = 0.5f;
+    result.policy_pass = 0.5f;
+    result.winrate = 0.6f;
+    auto compact = NNCache::CompactResult{};
+    NNCache::encode(result, compact);
+    {
+        NNCacheFile file;
+        ASSERT_TRUE(file.open(filename, 1024 * 1024));
+        file.insert(0x123456789, compact);
+    }
+
+    NNCacheFile file;
+    ASSERT_TRUE(file.open(filename, 1));
+    EXPECT_EQ(file.size(), size_t{1024 * 1024} / sizeof(NNCacheFile::Record));
+    auto found = NNCache::CompactResult{};
+    EXPECT_FALSE(file.lookup(0x987654321, found));
+    ASSERT_TRUE(file.lookup(0x123456789, found));
+    auto decoded = Network::Netresult{};
+    NNCache::decode(found, decoded);
+    EXPECT_EQ(decoded.policy, result.policy);
+    EXPECT_EQ(decoded.policy_pass, result.policy_pass);
+    EXPECT_EQ(decoded.winrate, result.winrate);
+    std::remove(filename.c_str());
+}
+
+// Threads that each map the file, as other processes would, never read
+// a record that mixes two results.
+TEST_F(LeelaTest, NNCacheFileConcurrent) {
+    const auto filename = std::string{"nncache_concurrent_test.bin"};
+    std::remove(filename.c_str());
+
+    const auto make_result = [](const std::uint64_t key) {
+        auto compact = NNCache::CompactResult{};
+        compact.winrate = float(key);
+        compact.max_prior = float(key);
+        compact.priors.fill(std::uint8_t(key));
+        return compact;
+    };
+    const auto matches = [](const std::uint64_t key,
+                            const NNCache::CompactResult& compact) {
+        return compact.winrate == float(key)
+            && compact.max_prior == float(key)
+            && std::all_of(begin(compact.priors), end(compact.priors),
+                           [key](std::uint8_t p) {
+                               return p == std::uint8_t(key);
+                           });
+    };
+
+    constexpr auto THREADS = 4;
+    std::atomic<int> bad_reads{0};
+    std::atomic<int> hits{0};
+    auto threads = std::vector<std::thread>{};
+    for (auto t = 0; t < THREADS; t++) {
+        threads.emplace_back([&, t]() {
+            NNCacheFile file;
+            if (!file.open(filename, 16 * sizeof(NNCacheFile::Record))) {
+                bad_reads++;
+                return;
+            }
+            auto rng = std::mt19937{std::uint32_t(t)};
+            for (auto i = 0; i < 20000; i++) {
+                const auto key = std::uint64_t{1 + rng() % 64};
+                file.insert(key, make_result(key));
+                auto found = NNCache::CompactResult{};
+                const auto other = std::uint64_t{1 + rng() % 64};
+                if (file.lookup(other, found)) {
+                    hits++;
+                    if (!matches(other, found)) {
+                        bad_reads++;
+                    }
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(bad_reads, 0);
+    EXPECT_GT(hits, 0);
+    std::remove(filename.c_str());
+}
+
+// Memory comes back to the pool it was taken from, whichever thread
+// frees it, and nothing is lost when that thread is gone.
+TEST_F(LeelaTest, NodePoolThreads) {
+    NodePool pool;
+    auto chunks = std::vector<void*>{};
+    for (auto i = 0; i < 1000; i++) {
+        chunks.emplace_back(pool.allocate(48));
+        EXPECT_EQ(&NodePool::of(chunks.back()), &pool);
+    }
+    const auto large = pool.allocate(3 << 20);
+    EXPECT_EQ(&NodePool::of(large), &pool);
+    EXPECT_GE(pool.get_used_bytes(), 1000u * 48 + (3 << 20));
+    NodePool::deallocate(large, 3 << 20);
+    const auto reserved = pool.get_reserved_bytes();
+    EXPECT_EQ(pool.get_used_bytes(), 1000u * 48);
+
+    std::thread([&]() {
+        for (const auto chunk : chunks) {
+            NodePool::deallocate(chunk, 48);
+        }
+    }).join();
+    EXPECT_EQ(pool.get_used_bytes(), 0u);
+
+    // The chunks freed by the exited thread are used again.
+    chunks.clear();
+    for (auto i = 0; i < 1000; i++) {
+        chunks.emplace_back(pool.allocate(48));
+    }
+    EXPECT_EQ(pool.get_reserved_bytes(), reserved);
+    for (const auto chunk : chunks) {
+        NodePool::deallocate(chunk, 48);
+    }
+}
+
+// A tree is freed with its pool without releasing the nodes one by one,
+// and the nodes of separate pools don't mix.
+TEST_F(LeelaTest, NodePoolRelease) {
+    auto state = get_gamestate();
+    std::atomic<int> nodes{0};
+    auto first = std::make_unique<NodePool>();
+    NodePool second;
+
+    auto root = new (*first) UCTNode(FastBoard::PASS);
+    float eval;
+    ASSERT_TRUE(root->create_children(nodes, state, eval));
+    root->inflate_all_children();
+    for (const auto& edge : root->get_edges()) {
+        EXPECT_EQ(&NodePool::of(edge.get()), first.get());
+    }
+    EXPECT_GT(first->get_used_bytes(), 0u);
+    EXPECT_GT(first->get_reserved_bytes(), 0u);
+
+    auto other = UCTNodeHandle(new (second) UCTNode(FastBoard::PASS));
+    ASSERT_TRUE(other->create_children(nodes, state, eval));
+    EXPECT_EQ(&NodePool::of(other->get_edge(0).inflate()), &second);
+
+    // root is not released, its memory goes with the pool.
+    first.reset();
+    EXPECT_EQ(other->get_num_children(), size_t{BOARD_SQUARES + 1});
+    other.reset();
+    EXPECT_EQ(second.get_used_bytes(), 0u);
+}
+
+// Positions share a key only if their history is the same: the last
+// positions in order, the ones before as a set for superko.
+TEST_F(LeelaTest, TranspositionKey) {
+    const auto opening = std::vector<std::string>{"q16", "d4", "d16", "q4"};
+    const auto transposed = std::vector<std::string>{"d16", "q4", "q16", "d4"};
+    const auto middle = std::vector<std::string>{
+        "c3", "r17", "c17", "r3", "k10", "k4", "k16", "d10", "q10"
+    };
+    const auto play = [](GameState& state,
+                         const std::vector<std::string>& moves) {
+        for (const auto& move : moves) {
+            ASSERT_TRUE(state.play_textmove(
+                state.get_to_move() == FastBoard::BLACK ? "b" : "w", move));
+        }
+    };
+
+    auto first = get_gamestate();
+    auto second = get_gamestate();
+    play(first, opening);
+    play(second, transposed);
+    EXPECT_EQ(first.board.get_hash(), second.board.get_hash());
+    EXPECT_NE(TranspositionTable::get_key(first),
+              TranspositionTable::get_key(second));
+
+    // The network inputs are the same, the earlier positions are not.
+    play(first, middle);
+    play(second, middle);
+    for (auto i = 0; i < Network::INPUT_MOVES; i++) {
+        EXPECT_EQ(first.get_past_board(i).get_hash(),
+                  second.get_past_board(i).get_hash());
+    }
+    EXPECT_NE(TranspositionTable::get_key(first),
+              TranspositionTable::get_key(second));
+
+    // Search moves give the same key as game moves.
+    auto searched = get_gamestate();
+    play(searched, opening);
+    const auto before = TranspositionTable::get_key(searched);
+    auto game = searched;
+    for (const auto& move : middle) {
+        play(game, {move});
+        searched.push_move(game.get_last_move());
+    }
+    EXPECT_EQ(TranspositionTable::get_key(searched),
+              TranspositionTable::get_key(first));
+    searched.pop_all_moves();
+    EXPECT_EQ(TranspositionTable::get_key(searched), before);
+}
+
+// Shared nodes live as long as any parent or the table holds them.
+TEST_F(LeelaTest, TranspositionRefcounts) {
+    auto state = get_gamestate();
+    std::atomic<int> nodes{0};
+    NodePool pool;
+    TranspositionTable table;
+    float eval;
+
+    const auto first = new (pool) UCTNode(FastBoard::PASS);
+    const auto second = new (pool) UCTNode(FastBoard::PASS);
+    ASSERT_TRUE(first->create_children(nodes, state, eval));
+    ASSERT_TRUE(second->create_children(nodes, state, eval));
+
+    auto edge = size_t{0};
+    const auto fresh = second->uct_select_child(FastBoard::BLACK, false, edge);
+    const auto move = fresh->get_move();
+    auto first_edge = size_t{0};
+    const auto shared = first->get_child(move, first_edge);
+    ASSERT_NE(shared, nullptr);
+
+    EXPECT_EQ(table.find_or_insert(1, shared), shared);
+    EXPECT_EQ(table.find_or_insert(1, fresh), shared);
+    ASSERT_TRUE(second->share_child(edge, fresh, shared));
+    // The reference find_or_insert took for us.
+    UCTNode::drop_reference(shared);
+    table.retire(fresh);
+    EXPECT_EQ(second->get_edge(edge).get(), shared);
+    second->virtual_loss_undo_edge(edge);
+    // Only the edge that got the virtual loss can be shared.
+    EXPECT_FALSE(second->share_child(edge, shared, shared));
+
+    // Held by both parents and the table.
+    UCTNode::drop_reference(first);
+    table.clear()();
+    EXPECT_EQ(second->get_edge(edge).get()->get_move(), move);
+    EXPECT_GT(pool.get_used_bytes(), 0u);
+    UCTNode::drop_reference(second);
+    EXPECT_EQ(pool.get_used_bytes(), 0u);
+
+    // A saturated count refuses more owners instead of wrapping.
+    const auto node = new (pool) UCTNode(FastBoard::PASS);
+    auto references = 1;
+    while (node->add_reference()) {
+        references++;
+    }
+    EXPECT_EQ(references, 255);
+    for (auto i = 0; i < references; i++) {
+        UCTNode::drop_reference(node);
+    }
+    EXPECT_EQ(pool.get_used_bytes(), 0u);
+}
+
+// Threads that reach the same positions at once all end up with the
+// node that was registered first.
+TEST_F(LeelaTest, TranspositionTableThreads) {
+    constexpr auto THREADS = 4;
+    constexpr auto KEYS = 500;
+    NodePool pool;
+    auto table = std::make_unique<TranspositionTable>();
+    auto found = std::vector<std::vector<UCTNode*>>(THREADS);
+
+    auto threads = std::vector<std::thread>{};
+    for (auto t = 0; t < THREADS; t++) {
+        threads.emplace_back([&, t]() {
+            for (auto key = 0; key < KEYS; key++) {
+                const auto node = new (pool) UCTNode(FastBoard::PASS);
+                const auto shared = table->find_or_insert(key, node);
+                found[t].emplace_back(shared);
+                if (shared != node) {
+                    UCTNode::drop_reference(node);
+                    UCTNode::drop_reference(shared);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto t = 1; t < THREADS; t++) {
+        EXPECT_EQ(found[t], found[0]);
+    }
+    // The table holds the only reference besides the winning thread's.
+    for (const auto node : found[0]) {
+        UCTNode::drop_reference(node);
+    }
+    EXPECT_GT(pool.get_used_bytes(), 0u);
+    table.reset();
+    EXPECT_EQ(pool.get_used_bytes(), 0u);
+}
+
+// A node found in the table stays alive for the thread that found it,
+// also when recycling lets go of the table's and the tree's references
+// to it at the same time.
+TEST_F(LeelaTest, TranspositionsDuringRecycling) {
+    constexpr auto ROUNDS = 1000;
+    NodePool pool;
+    TranspositionTable table;
+
+    for (auto round = 0; round < ROUNDS; round++) {
+        // Held by its parent and by the table.
+        const auto node = new (pool) UCTNode(FastBoard::PASS);
+        ASSERT_EQ(table.find_or_insert(round, node), node);
+
+        auto finder = std::thread([&table, &pool, round]() {
+            const auto fresh = new (pool) UCTNode(FastBoard::PASS);
+            const auto found = table.find_or_insert(round, fresh);
+            if (found && found != fresh) {
+                EXPECT_EQ(found->get_move(), FastBoard::PASS);
+                UCTNode::drop_reference(found);
+            }
+            UCTNode::drop_reference(fresh);
+        });
+        table.release_positions()();
+        UCTNode::drop_reference(node);
+        finder.join();
+    }
+    table.clear()();
+    EXPECT_EQ(pool.get_used_bytes(), 0u);
+}
+
+// A network result with a few strong moves and many weak ones.
+static Network::Netresult make_netresult(const int strong_moves) {
+    auto result = Network::Netresult{};
+    for (auto i = size_t{0}; i < result.policy.size(); i++) {
+        result.policy[i] = (int(i) < strong_moves) ? 0.09f : 0.0001f;
+    }
+    result.policy_pass = 0.0001f;
+    result.winrate = 0.6f;
+    return result;
+}
+
+// A tree that reaches its memory budget frees subtrees with few visits
+// in the background and keeps searching, also when nodes are shared.
+TEST_F(LeelaTest, TreeRecycling) {
+    cfg_max_tree_memory = 1024 * 1024;
+    for (const auto transpositions : {false, true}) {
+        cfg_transpositions = transpositions;
+        auto state = get_gamestate();
+        UCTSearch search(state);
+        search.set_playout_limit(UCTSearch::UNLIMITED_PLAYOUTS);
+        search.set_visit_limit(1000);
+
+        testing::internal::CaptureStderr();
+        search.start_search();
+        auto helper = std::thread([&]() {
+            auto scratch = UCTSearch::PlayoutScratch{state};
+            while (search.search_step(scratch, false)) {}
+        });
+        auto scratch = UCTSearch::PlayoutScratch{state};
+        auto max_bytes = size_t{0};
+        while (search.search_step(scratch, true)) {
+            max_bytes = std::max(max_bytes, search.get_tree_bytes());
+        }
+        helper.join();
+        search.end_search();
+        const auto output = testing::internal::GetCapturedStderr();
+
+        expect_regex(output, "recycling");
+        EXPECT_GE(search.get_root().get_visits(), 1000);
+        // Every thread may expand one more node when the tree is full.
+        EXPECT_LE(max_bytes, cfg_max_tree_memory + 2 * 16384);
+    }
+}
+
+// Searches of different positions run side by side on the pool, each to
+// its own visit limit within its own memory budget, and one of them can
+// be stopped and removed while the others go on.
+TEST_F(LeelaTest, SearchService) {
+    cfg_quiet = true;
+    auto& state = get_gamestate();
+    auto other = state;
+    other.play_textmove("b", "d4");
+    const auto budget = size_t{1024 * 1024};
+
+    UCTSearchService service;
+    const auto endless =
+        service.start(state, UCTSearch::UNLIMITED_PLAYOUTS, 0);
+    const auto first = service.start(state, 300, 0);
+    const auto second = service.start(other, 2000, budget);
+
+    service.wait(first);
+    service.wait(second);
+    const auto first_status = service.get_status(first);
+    EXPECT_FALSE(first_status.running);
+    EXPECT_GE(first_status.visits, 300);
+    const auto second_status = service.get_status(second);
+    EXPECT_FALSE(second_status.running);
+    EXPECT_GE(second_status.visits, 2000);
+    // Every slice may expand one more node when the tree is full.
+    EXPECT_LE(second_status.tree_bytes, budget + 2 * 16384);
+    EXPECT_NE(service.get_state(first).get_movenum(),
+              service.get_state(second).get_movenum());
+
+    // The search without a limit got its turns and keeps running.
+    const auto running = service.get_status(endless);
+    EXPECT_TRUE(running.running);
+    EXPECT_GT(running.visits, 300);
+    service.stop(endless);
+    const auto stopped = service.get_status(endless);
+    EXPECT_FALSE(stopped.running);
+    EXPECT_GE(stopped.visits, running.visits);
+
+    service.remove(endless);
+    EXPECT_FALSE(service.has_search(endless));
+    EXPECT_TRUE(service.has_search(first));
+    service.remove(first);
+}
+
+// Search until the root has at least visits visits, returns how many
+// it has.
+static int search_visits(UCTSearch& search, GameState& state, int visits) {
+    search.set_playout_limit(UCTSearch::UNLIMITED_PLAYOUTS);
+    search.set_visit_limit(visits);
+    search.start_search();
+    auto scratch = UCTSearch::PlayoutScratch{state};
+    while (search.search_step(scratch, true)) {}
+    search.end_search();
+    return search.get_root().get_visits();
+}
+
+// Every visit to an expanded child went through its edge, and no virtual
+// loss is left behind once the search is over.
+static void expect_consistent_tree(const UCTNode& node) {
+    auto edge_visits = 0;
+    for (const auto& edge : node.get_edges()) {
+        edge_visits += edge.get_visits();
+        if (edge.get_visits() == 0) {
+            continue;
+        }
+        EXPECT_FLOAT_EQ(edge.get_eval(FastBoard::BLACK),
+                        edge.get_blackevals() / edge.get_visits());
+        const auto child = edge.get();
+        if (child && child->has_children()) {
+            EXPECT_EQ(child->get_visits(), edge.get_visits());
+            expect_consistent_tree(*child);
+        }
+    }
+    EXPECT_EQ(node.get_visits(), 1 + edge_visits);
+}
+
+// Leaves evaluated in batches are backed up once each, and the search
+// stops within a batch of its limit and finds a move as good as one
+// that evaluates leaf by leaf.
+TEST_F(LeelaTest, BatchedSearch) {
+    cfg_quiet = true;
+    auto& state = get_gamestate();
+    state.play_textmove("b", "q16");
+    state.play_textmove("w", "d4");
+
+    cfg_batch_size = 1;
+    UCTSearch single(state);
+    search_visits(single, state, 400);
+    const auto single_best = single.get_best_root_move();
+
+    cfg_batch_size = 8;
+    UCTSearch batched(state);
+    const auto visits = search_visits(batched, state, 400);
+    EXPECT_GE(visits, 400);
+    EXPECT_LT(visits, 400 + cfg_batch_size);
+    expect_consistent_tree(batched.get_root());
+
+    // The virtual losses keep a batch from piling onto one leaf, which
+    // spreads the visits a little, but not to a clearly worse move.
+    const auto batched_best = batched.get_best_root_move();
+    EXPECT_NEAR(batched_best.second, single_best.second, 0.05f);
+}
+
+// The tree is kept when the game goes back before the position it was
+// started from, to another variation or to a loaded game, and moves
+// that were never searched don't cut it off.
+TEST_F(LeelaTest, TreeReuse) {
+    cfg_quiet = true;
+    auto& state = get_gamestate();
+    const auto play = [&state](const std::string& move) {
+        ASSERT_TRUE(state.play_textmove(
+            state.get_to_move() == FastBoard::BLACK ? "b" : "w", move));
+    };
+    UCTSearch search(state);
+
+    play("q16");
+    play("d4");
+    const auto searched = search_visits(search, state, 200);
+    ASSERT_GE(searched, 200);
+
+    // Before the anchor.
+    state.undo_move();
+    state.undo_move();
+    EXPECT_GT(search_visits(search, state, 1), searched);
+    // The nodes expanded to get back to the tree count on their edges.
+    expect_consistent_tree(search.get_root());
+    play("q16");
+    play("d4");
+    EXPECT_GE(search_visits(search, state, 1), searched);
+
+    // Moves the search never got to, then back.
+    play("c3");
+    play("r17");
+    play("k10");
+    search_visits(search, state, 1);
+    state.undo_move();
+    state.undo_move();
+    state.undo_move();
+    EXPECT_GE(search_visits(search, state, 1), searched);
+
+    // A sibling variation, then back.
+    state.undo_move();
+    play("d16");
+    search_visits(search, state, 1);
+    state.undo_move();
+    play("d4");
+    EXPECT_GE(search_visits(search, state, 1), searched);
+
+    // A game that continues from the searched position.
+    auto sgftree = std::make_unique<SGFTree>();
+    sgftree->load_from_string("(;GM[1]SZ[19]KM[7.5];B[pd];W[dp];B[pp])");
+    state = sgftree->follow_mainline_state();
+    search_visits(search, state, 1);
+    state.undo_move();
+    EXPECT_GE(search_visits(search, state, 1), searched);
+}
+
+// Noise is only mixed into the priors of the root while it is searched.
+TEST_F(LeelaTest, RootNoiseStripped) {
+    cfg_quiet = true;
+    auto& state = get_gamestate();
+
+    // The search gets the same network output from the cache.
+    auto probe_state = state;
+    NodePool pool;
+    std::atomic<int> nodes{0};
+    float eval;
+    auto probe = UCTNodeHandle(new (pool) UCTNode(FastBoard::PASS));
+    ASSERT_TRUE(probe->create_children(nodes, probe_state, eval));
+    auto priors = std::vector<float>(FastBoard::MAXSQ + 1, -1.0f);
+    for (const auto& edge : probe->get_edges()) {
+        priors[edge.get_move() + 1] = edge.get_prior();
+    }
+
+    cfg_noise = true;
+    UCTSearch search(state);
+    search_visits(search, state, 100);
+    auto noised = 0;
+    for (const auto& edge : search.get_root().get_edges()) {
+        noised += edge.get_prior() != priors[edge.get_move() + 1];
+    }
+    EXPECT_GT(noised, 0);
+
+    // Searched again as an inner node, then as the root without noise.
+    ASSERT_TRUE(state.play_textmove("b", "q16"));
+    search_visits(search, state, 1);
+    state.undo_move();
+    cfg_noise = false;
+    search_visits(search, state, 1);
+    for (const auto& edge : search.get_root().get_edges()) {
+        EXPECT_EQ(edge.get_prior(), priors[edge.get_move() + 1]);
+    }
+}
+
+static void expect_same_tree(const UCTNode& first, const UCTNode& second) {
+    EXPECT_EQ(first.get_visits(), second.get_visits());
+    EXPECT_EQ(first.get_blackevals(), second.get_blackevals());
+    ASSERT_EQ(first.get_num_children(), second.get_num_children());
+    for (auto i = size_t{0}; i < first.get_num_children(); i++) {
+        const auto a = first.get_edge(i);
+        const auto b = second.get_edge(i);
+        EXPECT_EQ(a.get_move(), b.get_move());
+        EXPECT_EQ(a.get_prior(), b.get_prior());
+        EXPECT_EQ(a.get_visits(), b.get_visits());
+        EXPECT_EQ(a.get_blackevals(), b.get_blackevals());
+        EXPECT_EQ(a.valid(), b.valid());
+        const auto expanded = a.get() && a.get()->has_children();
+        ASSERT_EQ(expanded, b.get() && b.get()->has_children());
+        if (expanded) {
+            expect_same_tree(*a.get(), *b.get());
+        }
+    }
+}
+
+// A saved tree loads back as it was, but only for the position and
+// history it was saved for.
+TEST_F(LeelaTest, TreeSnapshotRoundTrip) {
+    cfg_quiet = true;
+    const auto filename = std::string{"tree_snapshot_test.bin"};
+    const auto play = [](GameState& state,
+                         const std::vector<std::string>& moves) {
+        for (const auto& move : moves) {
+            ASSERT_TRUE(state.play_textmove(
+                state.get_to_move() == FastBoard::BLACK ? "b" : "w", move));
+        }
+    };
+    auto& state = get_gamestate();
+    play(state, {"q16", "d4", "d16", "q4"});
+    UCTSearch search(state);
+    search_visits(search, state, 300);
+    ASSERT_TRUE(search.save_tree(filename));
+
+    UCTSearch loaded(state);
+    ASSERT_TRUE(loaded.load_tree(filename));
+    expect_same_tree(search.get_root(), loaded.get_root());
+    // And searches on from there.
+    EXPECT_GT(search_visits(loaded, state, 400), 300);
+
+    // The same position reached in another order.
+    auto transposed = get_gamestate();
+    transposed.init_game(19, 7.5f);
+    play(transposed, {"d16", "q4", "q16", "d4"});
+    ASSERT_EQ(transposed.board.get_hash(), state.board.get_hash());
+    UCTSearch other(transposed);
+    EXPECT_FALSE(other.load_tree(filename));
+
+    // Edges damaged in the file. The most visited edge of the root is
+    // found by its visits and prior, which follow its blackevals and
+    // are followed by the child node and the move.
+    auto in = std::ifstream{filename, std::ios::binary};
+    const auto saved = std::string{std::istreambuf_iterator<char>{in}, {}};
+    in.close();
+    auto most = UCTNode::Edge{};
+    for (const auto& edge : search.get_root().get_edges()) {
+        if (!most || edge.get_visits() > most.get_visits()) {
+            most = edge;
+        }
+    }
+    const auto visits = std::int32_t{most.get_visits()};
+    const auto prior = most.get_prior();
+    auto pattern = std::string(sizeof(visits) + sizeof(prior), '\0');
+    std::memcpy(&pattern[0], &visits, sizeof(visits));
+    std::memcpy(&pattern[sizeof(visits)], &prior, sizeof(prior));
+    const auto at = saved.find(pattern);
+    ASSERT_NE(at, std::string::npos);
+    const auto load_damaged = [&](const int offset, const void* const data,
+                                  const size_t size) {
+        auto damaged = saved;
+        std::memcpy(&damaged[at + offset], data, size);
+        {
+            auto out = std::ofstream{filename, std::ios::binary};
+            out.write(damaged.data(), damaged.size());
+        }
+        return bool(loaded.load_tree(filename));
+    };
+    EXPECT_TRUE(load_damaged(0, &visits, sizeof(visits)));
+    // A move on the border of the board.
+    const auto border = std::int16_t{0};
+    EXPECT_FALSE(load_damaged(12, &border, sizeof(border)));
+    const auto negative = std::int32_t{-1};
+    EXPECT_FALSE(load_damaged(0, &negative, sizeof(negative)));
+    const auto nan = std::numeric_limits<double>::quiet_NaN();
+    EXPECT_FALSE(load_damaged(-8, &nan, sizeof(nan)));
+
+    // A file cut short.
+    {
+        auto out = std::ofstream{filename, std::ios::binary};
+        out.write(saved.data(), saved.size() / 2);
+    }
+    EXPECT_FALSE(loaded.load_tree(filename));
+    std::remove(filename.c_str());
+}
+
+// A node only has edges for the children it linked. Widening it adds
+// edges, the ones it had keep their place and statistics.
+TEST_F(LeelaTest, EdgeBlocks) {
+    auto state = get_gamestate();
+    std::atomic<int> nodes{0};
+    const auto netresult = make_netresult(10);
+
+    NodePool pool;
+    auto root = UCTNodeHandle(new (pool) UCTNode(FastBoard::PASS));
+    auto& node = *root;
+    ASSERT_TRUE(node.acquire_expansion(state, 0.5f));
+    node.expand_children(nodes, state, netresult, 0.5f);
+    EXPECT_EQ(node.get_num_children(), 10u);
+    EXPECT_EQ(nodes, 10);
+    EXPECT_TRUE(node.expandable());
+    EXPECT_EQ(node.get_visits(), 1);
+
+    node.update_edge(0, 0.25f);
+    node.update_edge(0, 0.75f);
+    const auto move = node.get_edge(0).get_move();
+    EXPECT_EQ(node.get_edge(0).get_visits(), 2);
+    EXPECT_EQ(node.get_visits(), 3);
+    EXPECT_NEAR(node.get_eval(FastBoard::BLACK), (0.6f + 1.0f) / 3, 1e-6f);
+
+    ASSERT_TRUE(node.acquire_expansion(state, 0.0f));
+    node.expand_children(nodes, state, netresult, 0.0f);
+    EXPECT_EQ(node.get_num_children(), size_t{BOARD_SQUARES + 1});
+    EXPECT_FALSE(node.expandable());
+    EXPECT_EQ(node.get_edge(0).get_move(), move);
+    EXPECT_EQ(node.get_edge(0).get_visits(), 2);
+    EXPECT_EQ(node.get_visits(), 3);
+
+    auto moves = std::vector<int>{};
+    for (const auto& edge : node.get_edges()) {
+        moves.emplace_back(edge.get_move());
+    }
+    std::sort(begin(moves), end(moves));
+    EXPECT_TRUE(std::adjacent_find(begin(moves), end(moves)) == end(moves));
+
+    // Sorting moves the statistics along with the children.
+    node.sort_children(FastBoard::BLACK);
+    EXPECT_EQ(node.get_edge(0).get_move(), move);
+    EXPECT_EQ(node.get_edge(0).get_visits(), 2);
+    EXPECT_EQ(node.get_visits(), 3);
+}
+
+// Search threads update edges without the node lock while another one
+// widens the node, no update may get lost.
+TEST_F(LeelaTest, EdgeUpdatesDuringWidening) {
+    auto state = get_gamestate();
+    std::atomic<int> nodes{0};
+    const auto netresult = make_netresult(10);
+
+    NodePool pool;
+    auto root = UCTNodeHandle(new (pool) UCTNode(FastBoard::PASS));
+    auto& node = *root;
+    ASSERT_TRUE(node.acquire_expansion(state, 0.5f));
+    node.expand_children(nodes, state, netresult, 0.5f);
+
+    constexpr auto UPDATES = 20000;
+    std::atomic<int> done{0};
+    auto search = std::thread([&]() {
+        for (auto i = 0; i < UPDATES; i++) {
+            auto edge = size_t{0};
+            node.uct_select_child(FastBoard::BLACK, false, edge);
+            node.update_edge(edge, 1.0f);
+            node.virtual_loss_undo_edge(edge);
+            done++;
+        }
+    });
+    while (done < UPDATES / 10) {
+        std::this_thread::yield();
+    }
+    ASSERT_TRUE(node.acquire_expansion(state, 0.0f));
+    node.expand_children(nodes, state, netresult, 0.0f);
+    search.join();
+
+    auto visits = 0;
+    for (const auto& edge : node.get_edges()) {
+        visits += edge.get_visits();
+        if (edge.get_visits() > 0) {
+            // No virtual loss was left behind.
+            EXPECT_EQ(edge.get_eval(FastBoard::BLACK), 1.0f);
+        }
+    }
+    EXPECT_EQ(visits, UPDATES);
+    EXPECT_EQ(node.get_visits(), UPDATES + 1);
+}
+
+// An 8-bit convolution must stay close to the float one
+TEST_F(LeelaTest, QuantizedConvolution) {
+    constexpr auto channels = 18;
+    constexpr auto outputs = 6;
+    auto rng = std::mt19937{1};
+    auto weight = std::uniform_real_distribution<float>{-0.5f, 0.5f};
+    auto weights = std::vector<float>(outputs * channels * 9);
+    for (auto& w : weights) {
+        w = weight(rng);
+    }
+    const auto means = std::vector<float>(outputs, 0.1f);
+    const auto stddivs = std::vector<float>(outputs, 2.0f);
+    auto input = std::vector<float>(channels * BOARD_SQUARES);
+    for (auto& in : input) {
+        in = rng() % 2;
+    }
+
+    auto net = QuantizedNetwork{};
+    net.push_convolution(channels, outputs, weights, means, stddivs);
+    net.calibrate({1.0f});
+    auto output = std::vector<float>{};
+    auto buffers = QuantizedNetwork::Buffers{};
+    net.forward(input, output, buffers);
+    ASSERT_EQ(output.size(), size_t(outputs * BOARD_SQUARES));
+
+    auto err = 0.0;
+    auto norm = 0.0;
+    for (auto o = 0; o < outputs; o++) {
+        for (auto y = 0; y < BOARD_SIZE; y++) {
+            for (auto x = 0; x < BOARD_SIZE; x++) {
+                auto sum = 0.0f;
+                for (auto c = 0; c < channels; c++) {
+                    for (auto ky = 0; ky < 3; ky++) {
+                        for (auto kx = 0; kx < 3; kx++) {
+                            const auto yin = y + ky - 1;
+                            const auto xin = x + kx - 1;
+                            if (yin >= 0 && yin < BOARD_SIZE
+                                && xin >= 0 && xin < BOARD_SIZE) {
+                                sum += weights[(o * channels + c) * 9
+                                               + ky * 3 + kx]
+                                     * input[c * BOARD_SQUARES
+                                             + yin * BOARD_SIZE + xin];
+                            }
+                        }
+                    }
+                }
+                const auto ref = std::max(0.0f,
+                                          stddivs[o] * (sum - means[o]));
+                const auto diff = output[o * BOARD_SQUARES
+                                         + y * BOARD_SIZE + x] - ref;
+                err += diff * diff;
+                norm += ref * ref;
+            }
+        }
+    }
+    EXPECT_LT(std::sqrt(err / norm), 0.01);
+}
+
+// The vectorized 8-bit dot products must give the same sums as the
+// scalar one. Only the instruction sets this CPU has are checked.
+TEST_F(LeelaTest, QuantizedDotProducts) {
+#ifdef USE_INT8_SIMD
+    constexpr auto outputs = 2 * Int8Simd::ROWS;
+    constexpr auto pixels = 3 * Int8Simd::COLUMNS;
+    constexpr auto length = 3 * Int8Simd::ALIGN;
+    auto rng = std::mt19937{1};
+    auto weights = std::vector<std::int8_t>(outputs * length);
+    for (auto& w : weights) {
+        w = static_cast<std::int8_t>(int(rng() % 256) - 128);
+    }
+    auto columns = std::vector<std::uint8_t>(pixels * length);
+    for (auto& x : columns) {
+        x = rng() % 128;
+    }
+
+    auto expected = std::vector<std::int32_t>(outputs * pixels);
+    Int8Simd::dot_scalar(weights.data(), columns.data(), expected.data(),
+                         outputs, pixels, length);
+
+    const auto cpu = Utils::detect_cpu_features();
+    if (cpu.avx2) {
+        auto out = std::vector<std::int32_t>(outputs * pixels);
+        Int8Simd::dot_avx2(weights.data(), columns.data(), out.data(),
+                           outputs, pixels, length);
+        EXPECT_EQ(out, expected);
+    }
+    if (cpu.avx512_vnni) {
+        auto out = std::vector<std::int32_t>(outputs * pixels);
+        Int8Simd::dot_avx512_vnni(weights.data(), columns.data(), out.data(),
+                                  outputs, pixels, length);
+        EXPECT_EQ(out, expected);
+    }
+#endif
+}
+
+// The vectorized Winograd transforms must match the scalar ones, also
+// when they only do a part of the batch.
+TEST_F(LeelaTest, WinogradTransforms) {
+#if defined(USE_WINOGRAD_SIMD) && defined(USE_BLAS)
+    constexpr auto C = 8;
+    constexpr auto batch_size = 2;
+    constexpr auto planes = C * batch_size;
+    constexpr auto P = (BOARD_SIZE + 1) * (BOARD_SIZE + 1)
+                       / Network::WINOGRAD_ALPHA;
+    constexpr auto tiles = Network::WINOGRAD_TILE * C * batch_size * P;
+    constexpr auto first = 3;
+    constexpr auto last = planes - 2;
+
+    auto rng = std::mt19937{1};
+    auto dist = std::uniform_real_distribution<float>{-1.0f, 1.0f};
+    const auto random_vector = [&](const size_t size) {
+        auto v = std::vector<float>(size);
+        for (auto& x : v) {
+            x = dist(rng);
+        }
+        return v;
+    };
+    const auto in = random_vector(planes * BOARD_SQUARES);
+    const auto M = random_vector(tiles);
+    const auto means = random_vector(C);
+    const auto stddivs = random_vector(C);
+    const auto eltwise = random_vector(planes * BOARD_SQUARES);
+
+    using TransformIn = void (*)(const float*, float*, int, int, int, int);
+    using TransformOut = void (*)(const float*, float*, int, int, int, int,
+                                  const float*, const float*,
+                                  const float*, float*);
+    struct Output {
+        std::vector<float> V = std::vector<float>(tiles);
+        std::vector<float> Y = std::vector<float>(planes * BOARD_SQUARES);
+        std::vector<float> V_next = std::vector<float>(tiles);
+    };
+    const auto run = [&](TransformIn transform_in,
+                         TransformOut transform_out) {
+        auto out = Output{};
+        transform_in(in.data(), out.V.data(), C, batch_size, first, last);
+        transform_out(M.data(), out.Y.data(), C, batch_size, first, last,
+                      means.data(), stddivs.data(), eltwise.data(),
+                      out.V_next.data());
+        return out;
+    };
+    const auto expect_near = [](const std::vector<float>& a,
+                                const std::vector<float>& b) {
+        ASSERT_EQ(a.size(), b.size());
+        for (auto i = size_t{0}; i < a.size(); i++) {
+            EXPECT_NEAR(a[i], b[i], 1e-4f) << "at " << i;
+        }
+    };
+
+    const auto expected = run(WinogradSimd::transform_in_scalar,
+                              WinogradSimd::transform_out_scalar);
+    const auto cpu = Utils::detect_cpu_features();
+    if (cpu.avx2) {
+        const auto out = run(WinogradSimd::transform_in_avx2,
+                             WinogradSimd::transform_out_avx2);
+        expect_near(out.V, expected.V);
+        expect_near(out.Y, expected.Y);
+        expect_near(out.V_next, expected.V_next);
+    }
+    if (cpu.avx512) {
+        const auto out = run(WinogradSimd::transform_in_avx512,
+                             WinogradSimd::transform_out_avx512);
+        expect_near(out.V, expected.V);
+        expect_near(out.Y, expected.Y);
+        expect_near(out.V_next, expected.V_next);
+    }
+#endif
+}
+
+// Tensors written to a packed weights file read back unchanged and
+// aligned
+TEST_F(LeelaTest, PackedWeightsRoundTrip) {
+    const auto filename = std::string{"packed_weights_test.bin"};
+    const auto first = std::vector<float>{1.0f, -2.5f, 3.25f};
+    const auto second = std::vector<float>(1000, 0.125f);
+    auto header = PackedWeights::Header{};
+    header.channels = 7;
+    ASSERT_TRUE(PackedWeights::write(filename, header,
+                                     {{first.data(), first.size()},
+                                      {second.data(), second.size()}}));
+    {
+        PackedWeights file;
+        ASSERT_TRUE(PackedWeights::is_packed(filename));
+        ASSERT_TRUE(file.open(filename));
+        EXPECT_EQ(file.header().channels, 7u);
+        EXPECT_EQ(file.header().tensor_count, 2u);
+        for (auto i = size_t{0}; i < 2; i++) {
+            const auto& expected = i == 0 ? first : second;
+            const auto tensor = file.tensor(i);
+            EXPECT_EQ(reinterpret_cast<std::uintptr_t>(tensor.first)
+                      % PackedWeights::ALIGN, 0u);
+            ASSERT_EQ(tensor.second, expected.size());
+            EXPECT_TRUE(std::equal(begin(expected), end(expected),
+                                   tensor.first));
+        }
+    }
+    std::remove(filename.c_str());
+}
+
+// Shared packed weights are named after the contents of the weights file,
+// not after its name or time.
+TEST_F(LeelaTest, SharedWeightsName) {
+    const auto write = [](const std::string& filename,
+                          const std::string& contents) {
+        auto file = std::ofstream{filename, std::ios::binary};
+        file << contents;
+    };
+    // Longer than one read, with a tail that isn't a whole word
+    auto contents = std::string(3 << 19, 'a') + "1\n0.5 0.25 -1\n";
+    write("shared_weights_a.txt", contents);
+    write("shared_weights_b.txt", contents);
+    contents[1000] = 'b';
+    write("shared_weights_c.txt", contents);
+
+    const auto a = PackedWeights::shared_filename("dir",
+                                                  "shared_weights_a.txt");
+    const auto b = PackedWeights::shared_filename("dir",
+                                                  "shared_weights_b.txt");
+    const auto c = PackedWeights::shared_filename("dir",
+                                                  "shared_weights_c.txt");
+    EXPECT_EQ(a.compare(0, 4, "dir/"), 0);
+    EXPECT_EQ(a, b);
+    EXPECT_NE(a, c);
+    EXPECT_EQ(PackedWeights::shared_filename("dir",
+                                             "shared_weights_missing.txt"),
+              "");
+    for (auto name : {"a", "b", "c"}) {
+        std::remove((std::string{"shared_weights_"} + name + ".txt").c_str());
+    }
+}